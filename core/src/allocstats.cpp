@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "allocstats.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+#if defined(_WIN32)
+#include <malloc.h>
+#define AVP_USABLE_SIZE(p) _msize(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define AVP_USABLE_SIZE(p) malloc_size(p)
+#else
+#include <malloc.h>
+#define AVP_USABLE_SIZE(p) malloc_usable_size(p)
+#endif
+
+namespace {
+
+// Allocations of a thread since its last stage boundary
+struct PendingCounters {
+    uint64_t count;
+    uint64_t bytes;
+    int64_t peakLiveBytes;
+};
+
+std::mutex statsMutex;
+AVP::AllocSnapshot stats;
+std::atomic<int64_t> heapLiveBytes(0);
+
+// Plain data, so no TLS constructor runs inside operator new
+thread_local PendingCounters pending = {0, 0, 0};
+// Set while the accounting itself allocates. Its blocks still count as live bytes, as their frees are seen like any other
+thread_local bool suspended = false;
+
+// In front of every operator new block, so a free only takes back what its allocation counted.
+// Blocks allocated before start() (e.g. by Qt and the settings) carry 0. The size keeps the block aligned for any type
+struct alignas(std::max_align_t) BlockHeader {
+    size_t countedBytes;
+};
+
+void recordAllocation(size_t bytes, size_t usableBytes)
+{
+    int64_t live = heapLiveBytes.fetch_add((int64_t)usableBytes, std::memory_order_relaxed) + (int64_t)usableBytes;
+    if(suspended)
+        return;
+    pending.count++;
+    pending.bytes += bytes;
+    if(live > pending.peakLiveBytes)
+        pending.peakLiveBytes = live;
+}
+
+void flushPending(const char *name)
+{
+    if(pending.count == 0)
+        return;
+
+    suspended = true;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        auto it = stats.find(name);
+        if(it == stats.end())
+            it = stats.emplace(name, AVP::AllocCounters()).first;
+        it->second.count += pending.count;
+        it->second.bytes += pending.bytes;
+        it->second.peakLiveBytes = std::max(it->second.peakLiveBytes, pending.peakLiveBytes);
+    }
+    suspended = false;
+    pending = {0, 0, 0};
+}
+
+void *countedMalloc(size_t size)
+{
+    BlockHeader *block = (BlockHeader*)malloc(sizeof(BlockHeader) + size);
+    if(!block)
+        return NULL;
+    block->countedBytes = 0;
+    if(AVP::AllocStats::isEnabled())
+    {
+        block->countedBytes = AVP_USABLE_SIZE(block);
+        recordAllocation(size, block->countedBytes);
+    }
+    return block + 1;
+}
+
+void countedFree(void *p)
+{
+    if(!p)
+        return;
+    BlockHeader *block = (BlockHeader*)p - 1;
+    if(block->countedBytes)
+        heapLiveBytes.fetch_sub((int64_t)block->countedBytes, std::memory_order_relaxed);
+    free(block);
+}
+
+}
+
+std::atomic<bool> AVP::AllocStats::enabled(false);
+
+void AVP::AllocStats::initFromEnvironment()
+{
+    const char *value = getenv("AVP_ALLOC_STATS");
+    if(value && *value && *value != '0')
+        start();
+}
+
+void AVP::AllocStats::start()
+{
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+void AVP::AllocStats::enterStage()
+{
+    if(isEnabled())
+        flushPending("other");
+}
+
+void AVP::AllocStats::leaveStage(const char *name)
+{
+    if(isEnabled())
+        flushPending(name);
+}
+
+void AVP::AllocStats::addAllocation(size_t bytes)
+{
+    if(isEnabled())
+        recordAllocation(bytes, 0);
+}
+
+int64_t AVP::AllocStats::liveBytes()
+{
+    return heapLiveBytes.load(std::memory_order_relaxed);
+}
+
+AVP::AllocSnapshot AVP::AllocStats::snapshot()
+{
+    AllocSnapshot result;
+    suspended = true;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        result = stats;
+    }
+    suspended = false;
+    return result;
+}
+
+AVP::AllocSnapshot AVP::AllocStats::diff(const AllocSnapshot &begin, const AllocSnapshot &end)
+{
+    AllocSnapshot result;
+    for(const auto &stage : end)
+    {
+        AllocCounters counters = stage.second;
+        auto it = begin.find(stage.first);
+        if(it != begin.end())
+        {
+            counters.count -= it->second.count;
+            counters.bytes -= it->second.bytes;
+        }
+        // Peaks cannot be subtracted, the highest value so far is kept
+        if(counters.count)
+            result[stage.first] = counters;
+    }
+    return result;
+}
+
+uint64_t AVP::AllocStats::totalCount(const AllocSnapshot &stats)
+{
+    uint64_t total = 0;
+    for(const auto &stage : stats)
+        total += stage.second.count;
+    return total;
+}
+
+std::string AVP::AllocStats::report(const AllocSnapshot &stats, int64_t frames)
+{
+    std::string result;
+    char line[160];
+    double perFrame = frames > 0 ? 1.0 / frames : 0;
+    AllocCounters total;
+
+    snprintf(line, sizeof(line), "%-20s %14s %14s %14s\n", "stage", "allocs/frame", "bytes/frame", "peak live MB");
+    result += line;
+    for(const auto &stage : stats)
+    {
+        snprintf(line, sizeof(line), "%-20s %14.2f %14.0f %14.1f\n", stage.first.c_str(), stage.second.count * perFrame, stage.second.bytes * perFrame, stage.second.peakLiveBytes / 1048576.0);
+        result += line;
+        total.count += stage.second.count;
+        total.bytes += stage.second.bytes;
+        total.peakLiveBytes = std::max(total.peakLiveBytes, stage.second.peakLiveBytes);
+    }
+    snprintf(line, sizeof(line), "%-20s %14.2f %14.0f %14.1f\n", "total", total.count * perFrame, total.bytes * perFrame, total.peakLiveBytes / 1048576.0);
+    result += line;
+    return result;
+}
+
+// opaque: the bytes the allocation counted, 0 if it was made before start()
+static void countedBufferFree(void *opaque, uint8_t *data)
+{
+    heapLiveBytes.fetch_sub((int64_t)(uintptr_t)opaque, std::memory_order_relaxed);
+    av_free(data);
+}
+
+AVBufferRef *AVP::countedBufferAlloc(size_t size)
+{
+    bool counted = AllocStats::isEnabled();
+    uint8_t *data = (uint8_t*)av_malloc(size);
+    if(!data)
+        return NULL;
+    AVBufferRef *buffer = av_buffer_create(data, size, countedBufferFree, (void*)(uintptr_t)(counted ? size : 0), 0);
+    if(!buffer)
+    {
+        av_free(data);
+        return NULL;
+    }
+    if(counted)
+        recordAllocation(size, size);
+    return buffer;
+}
+
+/*
+ * Counting replacements of the global allocation functions.
+ * The aligned overloads keep the default implementation and are not counted.
+ */
+void *operator new(size_t size)
+{
+    void *p = countedMalloc(size);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    void *p = countedMalloc(size);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return countedMalloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return countedMalloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    countedFree(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    countedFree(p);
+}
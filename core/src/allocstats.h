@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace AVP {
+
+struct AllocCounters {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    int64_t peakLiveBytes = 0;     // Heap growth since start(), highest value seen by an allocation
+};
+
+// Counters per stage name, names are those of the trace spans
+typedef std::map<std::string, AllocCounters, std::less<>> AllocSnapshot;
+
+/*
+ * Allocation accounting of the media pipelines.
+ * Counts operator new, and FFmpeg buffers allocated through countedBufferAlloc(), per pipeline stage.
+ * Trace spans (read, decode, filter...) are the stages. Allocations of a thread between spans count as "other".
+ * Enabled by the AVP_ALLOC_STATS environment variable (or --alloc-stats on the command line).
+ * When disabled, operator new and delete cost one relaxed atomic load and a small tag in front of each block.
+ * The tag records what an allocation counted, so frees of blocks allocated before start() leave the live bytes alone.
+ *
+ * FFmpeg offers no allocator hook (av_max_alloc() only limits the size of one allocation),
+ * so allocations made inside FFmpeg are only seen for the buffer pools using countedBufferAlloc().
+ */
+class AllocStats {
+public:
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+    // Start counting if AVP_ALLOC_STATS is set
+    static void initFromEnvironment();
+    static void start();
+
+    // Stage boundaries, called by Trace spans
+    static void enterStage();
+    static void leaveStage(const char *name);
+
+    // Allocation not made by operator new, e.g. by av_samples_alloc(). Not tracked as live bytes, as its free is not seen
+    static void addAllocation(size_t bytes);
+
+    // Heap growth since start(), as seen by the counters
+    static int64_t liveBytes();
+
+    // Counters of every stage, flushed up to the last stage boundary of each thread
+    static AllocSnapshot snapshot();
+    // Difference of two snapshots
+    static AllocSnapshot diff(const AllocSnapshot &begin, const AllocSnapshot &end);
+    static uint64_t totalCount(const AllocSnapshot &stats);
+    // Table of allocations per frame of every stage
+    static std::string report(const AllocSnapshot &stats, int64_t frames);
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+// Allocator for av_buffer_pool_init() counting its allocations
+AVBufferRef *countedBufferAlloc(size_t size);
+
+}
+
+#endif // ALLOCSTATS_H
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "audiomix.h"
+
+#ifdef AVP_CPU_X86
+#include <immintrin.h>
+#endif
+#ifdef AVP_CPU_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AVP_TARGET(x) __attribute__((target(x)))
+#else
+#define AVP_TARGET(x)
+#endif
+
+/*
+ * The SIMD kernels mix a vector of samples per output channel at a time, with every input channel loaded once per vector.
+ * Stereo output is interleaved with unpack instructions, other layouts go through a small block written out sample by sample.
+ */
+static const int kMixMaxChannels = 16;
+
+static inline void downmixScalarRange(const float * const *planes, int inChannels, int begin, int end, const float *matrix, int outChannels, float *out)
+{
+    for(int i = begin; i < end; i++)
+        for(int o = 0; o < outChannels; o++)
+        {
+            const float *row = matrix + o * inChannels;
+            float sum = row[0] * planes[0][i];
+            for(int c = 1; c < inChannels; c++)
+                sum = sum + row[c] * planes[c][i];
+            out[(int64_t)i * outChannels + o] = sum;
+        }
+}
+
+void AVP::downmixScalar(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out)
+{
+    downmixScalarRange(planes, inChannels, 0, samples, matrix, outChannels, out);
+}
+
+#ifdef AVP_CPU_X86
+
+AVP_TARGET("sse2") static inline __m128 mixRow4(const float * const *planes, int inChannels, int i, const float *row)
+{
+    __m128 sum = _mm_mul_ps(_mm_set1_ps(row[0]), _mm_loadu_ps(planes[0] + i));
+    for(int c = 1; c < inChannels; c++)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(row[c]), _mm_loadu_ps(planes[c] + i)));
+    return sum;
+}
+
+AVP_TARGET("sse2") void AVP::downmixSSE2(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out)
+{
+    alignas(16) float block[kMixMaxChannels][4];
+    int i = 0;
+
+    if(outChannels == 2)
+    {
+        for(; i + 4 <= samples; i += 4)
+        {
+            __m128 left = mixRow4(planes, inChannels, i, matrix);
+            __m128 right = mixRow4(planes, inChannels, i, matrix + inChannels);
+            _mm_storeu_ps(out + (int64_t)i * 2, _mm_unpacklo_ps(left, right));
+            _mm_storeu_ps(out + (int64_t)i * 2 + 4, _mm_unpackhi_ps(left, right));
+        }
+    }
+    else if(outChannels <= kMixMaxChannels)
+    {
+        for(; i + 4 <= samples; i += 4)
+        {
+            for(int o = 0; o < outChannels; o++)
+                _mm_store_ps(block[o], mixRow4(planes, inChannels, i, matrix + o * inChannels));
+            for(int k = 0; k < 4; k++)
+                for(int o = 0; o < outChannels; o++)
+                    out[(int64_t)(i + k) * outChannels + o] = block[o][k];
+        }
+    }
+
+    downmixScalarRange(planes, inChannels, i, samples, matrix, outChannels, out);
+}
+
+AVP_TARGET("avx2") static inline __m256 mixRow8(const float * const *planes, int inChannels, int i, const float *row)
+{
+    __m256 sum = _mm256_mul_ps(_mm256_set1_ps(row[0]), _mm256_loadu_ps(planes[0] + i));
+    for(int c = 1; c < inChannels; c++)
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(row[c]), _mm256_loadu_ps(planes[c] + i)));
+    return sum;
+}
+
+AVP_TARGET("avx2") void AVP::downmixAVX2(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out)
+{
+    alignas(32) float block[kMixMaxChannels][8];
+    int i = 0;
+
+    if(outChannels == 2)
+    {
+        for(; i + 8 <= samples; i += 8)
+        {
+            __m256 left = mixRow8(planes, inChannels, i, matrix);
+            __m256 right = mixRow8(planes, inChannels, i, matrix + inChannels);
+            // Unpack works within 128-bit lanes: samples 0-1, 4-5 and 2-3, 6-7
+            __m256 low = _mm256_unpacklo_ps(left, right);
+            __m256 high = _mm256_unpackhi_ps(left, right);
+            _mm256_storeu_ps(out + (int64_t)i * 2, _mm256_permute2f128_ps(low, high, 0x20));
+            _mm256_storeu_ps(out + (int64_t)i * 2 + 8, _mm256_permute2f128_ps(low, high, 0x31));
+        }
+    }
+    else if(outChannels <= kMixMaxChannels)
+    {
+        for(; i + 8 <= samples; i += 8)
+        {
+            for(int o = 0; o < outChannels; o++)
+                _mm256_store_ps(block[o], mixRow8(planes, inChannels, i, matrix + o * inChannels));
+            for(int k = 0; k < 8; k++)
+                for(int o = 0; o < outChannels; o++)
+                    out[(int64_t)(i + k) * outChannels + o] = block[o][k];
+        }
+    }
+
+    downmixScalarRange(planes, inChannels, i, samples, matrix, outChannels, out);
+}
+
+#endif
+
+#ifdef AVP_CPU_NEON
+
+static inline float32x4_t mixRow4(const float * const *planes, int inChannels, int i, const float *row)
+{
+    float32x4_t sum = vmulq_n_f32(vld1q_f32(planes[0] + i), row[0]);
+    for(int c = 1; c < inChannels; c++)
+        sum = vaddq_f32(sum, vmulq_n_f32(vld1q_f32(planes[c] + i), row[c]));
+    return sum;
+}
+
+void AVP::downmixNEON(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out)
+{
+    alignas(16) float block[kMixMaxChannels][4];
+    int i = 0;
+
+    if(outChannels == 2)
+    {
+        for(; i + 4 <= samples; i += 4)
+        {
+            float32x4x2_t stereo;
+            stereo.val[0] = mixRow4(planes, inChannels, i, matrix);
+            stereo.val[1] = mixRow4(planes, inChannels, i, matrix + inChannels);
+            vst2q_f32(out + (int64_t)i * 2, stereo);
+        }
+    }
+    else if(outChannels <= kMixMaxChannels)
+    {
+        for(; i + 4 <= samples; i += 4)
+        {
+            for(int o = 0; o < outChannels; o++)
+                vst1q_f32(block[o], mixRow4(planes, inChannels, i, matrix + o * inChannels));
+            for(int k = 0; k < 4; k++)
+                for(int o = 0; o < outChannels; o++)
+                    out[(int64_t)(i + k) * outChannels + o] = block[o][k];
+        }
+    }
+
+    downmixScalarRange(planes, inChannels, i, samples, matrix, outChannels, out);
+}
+
+#endif
+
+AVP::DownmixFunction AVP::downmixKernel(CpuLevel level)
+{
+    switch(level)
+    {
+#ifdef AVP_CPU_X86
+    case kCpuLevelAVX512:
+    case kCpuLevelAVX2:
+        return downmixAVX2;
+    case kCpuLevelSSSE3:
+    case kCpuLevelSSE2:
+        return downmixSSE2;
+#endif
+#ifdef AVP_CPU_NEON
+    case kCpuLevelNEON:
+        return downmixNEON;
+#endif
+    default:
+        return downmixScalar;
+    }
+}
+
+void AVP::downmix(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out)
+{
+    downmixKernel(CpuDispatch::level())(planes, inChannels, samples, matrix, outChannels, out);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef AUDIOMIX_H
+#define AUDIOMIX_H
+
+#include "cpudispatch.h"
+
+namespace AVP {
+
+/*
+ * Audio downmix kernel.
+ * Mixes planar float samples into interleaved float samples: out[i * outChannels + o] = sum of matrix[o * inChannels + c] * planes[c][i] over c.
+ * The products are added in channel order without fused multiply-add (audiomix.cpp is built with -ffp-contract=off), so all kernels produce bit-exact identical output.
+ * out: must hold samples * outChannels floats.
+ */
+typedef void (*DownmixFunction)(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out);
+
+void downmixScalar(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out);
+#ifdef AVP_CPU_X86
+void downmixSSE2(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out);
+void downmixAVX2(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out);
+#endif
+#ifdef AVP_CPU_NEON
+void downmixNEON(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out);
+#endif
+
+// Best kernel for a CPU level
+DownmixFunction downmixKernel(CpuLevel level);
+
+// Kernel bound to CpuDispatch::level()
+void downmix(const float * const *planes, int inChannels, int samples, const float *matrix, int outChannels, float *out);
+
+}
+
+#endif // AUDIOMIX_H
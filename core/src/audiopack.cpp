@@ -0,0 +1,463 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "audiopack.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef AVP_CPU_X86
+#include <immintrin.h>
+#endif
+#ifdef AVP_CPU_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AVP_TARGET(x) __attribute__((target(x)))
+#else
+#define AVP_TARGET(x)
+#endif
+
+// 24-bit full scale
+static const float kS24Scale = 8388608.0f;
+static const float kS24Max = 8388607.0f;
+static const float kS24Min = -8388608.0f;
+static const float kDitherUnit = 1.0f / 16777216.0f;
+
+/*
+ * The SSSE3, AVX-512 and NEON kernels convert a block of samples of every channel into an interleaved int32 block first,
+ * then pack 4 (or 16) samples at a time into 3-byte words with one byte shuffle, instead of three byte stores per sample.
+ * The block stays in L1 cache. Layouts with more channels fall back to the strided kernels.
+ */
+static const int kPackBlock = 64;
+static const int kPackMaxChannels = 16;
+
+// Keeps the low 3 bytes of each 32-bit sample, packing 4 samples into 12 bytes. Out of range indices produce zero
+#define AVP_S24_SHUFFLE 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+
+AVP::DitherState::DitherState(uint32_t seed)
+{
+    for(int i = 0; i < 16; i++)
+    {
+        // xorshift32 must never be seeded with 0
+        seed = seed * 1664525u + 1013904223u;
+        lanes[i] = seed ? seed : 0x9E3779B9u;
+    }
+}
+
+static inline uint32_t xorshift32(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Triangular noise in (-1, 1) LSB
+static inline float tpdf(uint32_t &state)
+{
+    float a = (float)(xorshift32(state) >> 8);
+    float b = (float)(xorshift32(state) >> 8);
+    return (a - b) * kDitherUnit;
+}
+
+static inline void writeS24(uint8_t *dst, int32_t sample)
+{
+    dst[0] = (uint8_t)(sample);
+    dst[1] = (uint8_t)(sample >> 8);
+    dst[2] = (uint8_t)(sample >> 16);
+}
+
+static inline int32_t convertS24(float sample, float scale, uint32_t *ditherLane)
+{
+    float val = sample * scale;
+    if(ditherLane)
+        val += tpdf(*ditherLane);
+    if(val > kS24Max)
+        val = kS24Max;
+    else if(!(val >= kS24Min))     // Also catches NaN
+        val = kS24Min;
+    return (int32_t)std::lrint(val);
+}
+
+static inline void packS24ScalarChannel(const float *src, uint8_t *dst, int stride, int begin, int end, float scale, uint32_t *ditherLane)
+{
+    for(int i = begin; i < end; i++)
+        writeS24(dst + (int64_t)i * stride, convertS24(src[i], scale, ditherLane));
+}
+
+void AVP::packS24Scalar(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out)
+{
+    const float scale = gain * kS24Scale;
+    const int stride = channels * 3;
+    for(int c = 0; c < channels; c++)
+        packS24ScalarChannel(planes[c], out + c * 3, stride, 0, samples, scale, dither ? &dither->lanes[0] : 0);
+}
+
+#ifdef AVP_CPU_X86
+
+AVP_TARGET("sse2") static inline __m128 tpdf4(__m128i &state)
+{
+    __m128 a, b;
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+    a = _mm_cvtepi32_ps(_mm_srli_epi32(state, 8));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+    b = _mm_cvtepi32_ps(_mm_srli_epi32(state, 8));
+    return _mm_mul_ps(_mm_sub_ps(a, b), _mm_set1_ps(kDitherUnit));
+}
+
+AVP_TARGET("sse2") void AVP::packS24SSE2(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out)
+{
+    const float scale = gain * kS24Scale;
+    const int stride = channels * 3;
+    const __m128 vScale = _mm_set1_ps(scale);
+    const __m128 vMax = _mm_set1_ps(kS24Max);
+    const __m128 vMin = _mm_set1_ps(kS24Min);
+    alignas(16) int32_t packed[4];
+
+    for(int c = 0; c < channels; c++)
+    {
+        const float *src = planes[c];
+        uint8_t *dst = out + c * 3;
+        __m128i state = _mm_setzero_si128();
+        int i = 0;
+
+        if(dither)
+            state = _mm_loadu_si128((const __m128i*)dither->lanes);
+
+        for(; i + 4 <= samples; i += 4)
+        {
+            __m128 val = _mm_mul_ps(_mm_loadu_ps(src + i), vScale);
+            if(dither)
+                val = _mm_add_ps(val, tpdf4(state));
+            val = _mm_min_ps(_mm_max_ps(val, vMin), vMax);
+            _mm_store_si128((__m128i*)packed, _mm_cvtps_epi32(val));
+
+            uint8_t *p = dst + (int64_t)i * stride;
+            writeS24(p, packed[0]);
+            writeS24(p + stride, packed[1]);
+            writeS24(p + stride * 2, packed[2]);
+            writeS24(p + stride * 3, packed[3]);
+        }
+
+        if(dither)
+            _mm_storeu_si128((__m128i*)dither->lanes, state);
+
+        packS24ScalarChannel(src, dst, stride, i, samples, scale, dither ? &dither->lanes[0] : 0);
+    }
+}
+
+AVP_TARGET("ssse3") void AVP::packS24SSSE3(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out)
+{
+    if(channels > kPackMaxChannels)
+    {
+        packS24SSE2(planes, channels, samples, gain, dither, out);
+        return;
+    }
+
+    const float scale = gain * kS24Scale;
+    const __m128 vScale = _mm_set1_ps(scale);
+    const __m128 vMax = _mm_set1_ps(kS24Max);
+    const __m128 vMin = _mm_set1_ps(kS24Min);
+    const __m128i shuffle = _mm_setr_epi8(AVP_S24_SHUFFLE);
+    alignas(16) int32_t block[kPackBlock * kPackMaxChannels];
+    alignas(16) int32_t packed[4];
+
+    for(int begin = 0; begin < samples; begin += kPackBlock)
+    {
+        const int count = std::min(kPackBlock, samples - begin);
+        const int total = count * channels;
+        uint8_t *dst = out + (int64_t)begin * channels * 3;
+
+        // Convert every channel into the interleaved block
+        for(int c = 0; c < channels; c++)
+        {
+            const float *src = planes[c] + begin;
+            int32_t *column = block + c;
+            __m128i state = _mm_setzero_si128();
+            int i = 0;
+
+            if(dither)
+                state = _mm_loadu_si128((const __m128i*)dither->lanes);
+
+            for(; i + 4 <= count; i += 4)
+            {
+                __m128 val = _mm_mul_ps(_mm_loadu_ps(src + i), vScale);
+                if(dither)
+                    val = _mm_add_ps(val, tpdf4(state));
+                val = _mm_min_ps(_mm_max_ps(val, vMin), vMax);
+                _mm_store_si128((__m128i*)packed, _mm_cvtps_epi32(val));
+                for(int k = 0; k < 4; k++)
+                    column[(i + k) * channels] = packed[k];
+            }
+
+            if(dither)
+                _mm_storeu_si128((__m128i*)dither->lanes, state);
+
+            for(; i < count; i++)
+                column[i * channels] = convertS24(src[i], scale, dither ? &dither->lanes[0] : 0);
+        }
+
+        // 16-byte stores overlap the next group by 4 bytes, so the last groups are written bytewise
+        int k = 0;
+        for(; k + 6 <= total; k += 4)
+            _mm_storeu_si128((__m128i*)(dst + k * 3), _mm_shuffle_epi8(_mm_load_si128((const __m128i*)(block + k)), shuffle));
+        for(; k < total; k++)
+            writeS24(dst + k * 3, block[k]);
+    }
+}
+
+AVP_TARGET("avx2") static inline __m256 tpdf8(__m256i &state)
+{
+    __m256 a, b;
+    state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+    state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+    state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+    a = _mm256_cvtepi32_ps(_mm256_srli_epi32(state, 8));
+    state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+    state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+    state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+    b = _mm256_cvtepi32_ps(_mm256_srli_epi32(state, 8));
+    return _mm256_mul_ps(_mm256_sub_ps(a, b), _mm256_set1_ps(kDitherUnit));
+}
+
+AVP_TARGET("avx2") void AVP::packS24AVX2(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out)
+{
+    const float scale = gain * kS24Scale;
+    const int stride = channels * 3;
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vMax = _mm256_set1_ps(kS24Max);
+    const __m256 vMin = _mm256_set1_ps(kS24Min);
+    alignas(32) int32_t packed[8];
+
+    for(int c = 0; c < channels; c++)
+    {
+        const float *src = planes[c];
+        uint8_t *dst = out + c * 3;
+        __m256i state = _mm256_setzero_si256();
+        int i = 0;
+
+        if(dither)
+            state = _mm256_loadu_si256((const __m256i*)dither->lanes);
+
+        for(; i + 8 <= samples; i += 8)
+        {
+            __m256 val = _mm256_mul_ps(_mm256_loadu_ps(src + i), vScale);
+            if(dither)
+                val = _mm256_add_ps(val, tpdf8(state));
+            val = _mm256_min_ps(_mm256_max_ps(val, vMin), vMax);
+            _mm256_store_si256((__m256i*)packed, _mm256_cvtps_epi32(val));
+
+            uint8_t *p = dst + (int64_t)i * stride;
+            for(int k = 0; k < 8; k++)
+                writeS24(p + k * stride, packed[k]);
+        }
+
+        if(dither)
+            _mm256_storeu_si256((__m256i*)dither->lanes, state);
+
+        packS24ScalarChannel(src, dst, stride, i, samples, scale, dither ? &dither->lanes[0] : 0);
+    }
+}
+
+AVP_TARGET("avx512f") static inline __m512 tpdf16(__m512i &state)
+{
+    __m512 a, b;
+    state = _mm512_xor_si512(state, _mm512_slli_epi32(state, 13));
+    state = _mm512_xor_si512(state, _mm512_srli_epi32(state, 17));
+    state = _mm512_xor_si512(state, _mm512_slli_epi32(state, 5));
+    a = _mm512_cvtepi32_ps(_mm512_srli_epi32(state, 8));
+    state = _mm512_xor_si512(state, _mm512_slli_epi32(state, 13));
+    state = _mm512_xor_si512(state, _mm512_srli_epi32(state, 17));
+    state = _mm512_xor_si512(state, _mm512_slli_epi32(state, 5));
+    b = _mm512_cvtepi32_ps(_mm512_srli_epi32(state, 8));
+    return _mm512_mul_ps(_mm512_sub_ps(a, b), _mm512_set1_ps(kDitherUnit));
+}
+
+AVP_TARGET("avx512f,avx512bw") void AVP::packS24AVX512(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out)
+{
+    if(channels > kPackMaxChannels)
+    {
+        packS24AVX2(planes, channels, samples, gain, dither, out);
+        return;
+    }
+
+    const float scale = gain * kS24Scale;
+    const __m512 vScale = _mm512_set1_ps(scale);
+    const __m512 vMax = _mm512_set1_ps(kS24Max);
+    const __m512 vMin = _mm512_set1_ps(kS24Min);
+    const __m512i shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(AVP_S24_SHUFFLE));
+    alignas(64) int32_t block[kPackBlock * kPackMaxChannels];
+    alignas(64) int32_t packed[16];
+
+    for(int begin = 0; begin < samples; begin += kPackBlock)
+    {
+        const int count = std::min(kPackBlock, samples - begin);
+        const int total = count * channels;
+        uint8_t *dst = out + (int64_t)begin * channels * 3;
+
+        // Convert every channel into the interleaved block
+        for(int c = 0; c < channels; c++)
+        {
+            const float *src = planes[c] + begin;
+            int32_t *column = block + c;
+            __m512i state = _mm512_setzero_si512();
+            int i = 0;
+
+            if(dither)
+                state = _mm512_loadu_si512(dither->lanes);
+
+            for(; i + 16 <= count; i += 16)
+            {
+                __m512 val = _mm512_mul_ps(_mm512_loadu_ps(src + i), vScale);
+                if(dither)
+                    val = _mm512_add_ps(val, tpdf16(state));
+                val = _mm512_min_ps(_mm512_max_ps(val, vMin), vMax);
+                _mm512_store_si512(packed, _mm512_cvtps_epi32(val));
+                for(int k = 0; k < 16; k++)
+                    column[(i + k) * channels] = packed[k];
+            }
+
+            if(dither)
+                _mm512_storeu_si512(dither->lanes, state);
+
+            for(; i < count; i++)
+                column[i * channels] = convertS24(src[i], scale, dither ? &dither->lanes[0] : 0);
+        }
+
+        // Shuffle 16 samples within each 128-bit lane, then compress the 12 useful bytes of every lane into a 48-byte store
+        int k = 0;
+        for(; k + 16 <= total; k += 16)
+            _mm512_mask_compressstoreu_epi32(dst + k * 3, 0x7777, _mm512_shuffle_epi8(_mm512_load_si512(block + k), shuffle));
+        for(; k < total; k++)
+            writeS24(dst + k * 3, block[k]);
+    }
+}
+
+#endif // AVP_CPU_X86
+
+#ifdef AVP_CPU_NEON
+
+static inline float32x4_t tpdf4(uint32x4_t &state)
+{
+    float32x4_t a, b;
+    state = veorq_u32(state, vshlq_n_u32(state, 13));
+    state = veorq_u32(state, vshrq_n_u32(state, 17));
+    state = veorq_u32(state, vshlq_n_u32(state, 5));
+    a = vcvtq_f32_u32(vshrq_n_u32(state, 8));
+    state = veorq_u32(state, vshlq_n_u32(state, 13));
+    state = veorq_u32(state, vshrq_n_u32(state, 17));
+    state = veorq_u32(state, vshlq_n_u32(state, 5));
+    b = vcvtq_f32_u32(vshrq_n_u32(state, 8));
+    return vmulq_n_f32(vsubq_f32(a, b), kDitherUnit);
+}
+
+void AVP::packS24NEON(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out)
+{
+    if(channels > kPackMaxChannels)
+    {
+        packS24Scalar(planes, channels, samples, gain, dither, out);
+        return;
+    }
+
+    const float scale = gain * kS24Scale;
+    const float32x4_t vMax = vdupq_n_f32(kS24Max);
+    const float32x4_t vMin = vdupq_n_f32(kS24Min);
+    static const int8_t shuffleTable[16] = {AVP_S24_SHUFFLE};
+    const uint8x16_t shuffle = vreinterpretq_u8_s8(vld1q_s8(shuffleTable));
+    alignas(16) int32_t block[kPackBlock * kPackMaxChannels];
+    alignas(16) int32_t packed[4];
+
+    for(int begin = 0; begin < samples; begin += kPackBlock)
+    {
+        const int count = std::min(kPackBlock, samples - begin);
+        const int total = count * channels;
+        uint8_t *dst = out + (int64_t)begin * channels * 3;
+
+        // Convert every channel into the interleaved block
+        for(int c = 0; c < channels; c++)
+        {
+            const float *src = planes[c] + begin;
+            int32_t *column = block + c;
+            uint32x4_t state = vdupq_n_u32(0);
+            int i = 0;
+
+            if(dither)
+                state = vld1q_u32(dither->lanes);
+
+            for(; i + 4 <= count; i += 4)
+            {
+                float32x4_t val = vmulq_n_f32(vld1q_f32(src + i), scale);
+                if(dither)
+                    val = vaddq_f32(val, tpdf4(state));
+                // vmaxnm returns the number when the other operand is NaN, like the scalar clamp
+                val = vminq_f32(vmaxnmq_f32(val, vMin), vMax);
+                vst1q_s32(packed, vcvtnq_s32_f32(val));
+                for(int k = 0; k < 4; k++)
+                    column[(i + k) * channels] = packed[k];
+            }
+
+            if(dither)
+                vst1q_u32(dither->lanes, state);
+
+            for(; i < count; i++)
+                column[i * channels] = convertS24(src[i], scale, dither ? &dither->lanes[0] : 0);
+        }
+
+        // 16-byte stores overlap the next group by 4 bytes, so the last groups are written bytewise
+        int k = 0;
+        for(; k + 6 <= total; k += 4)
+            vst1q_u8(dst + k * 3, vqtbl1q_u8(vreinterpretq_u8_s32(vld1q_s32(block + k)), shuffle));
+        for(; k < total; k++)
+            writeS24(dst + k * 3, block[k]);
+    }
+}
+
+#endif // AVP_CPU_NEON
+
+AVP::PackS24Function AVP::packS24Kernel(CpuLevel level)
+{
+    switch(level)
+    {
+#ifdef AVP_CPU_X86
+    case kCpuLevelAVX512:
+        return packS24AVX512;
+    case kCpuLevelAVX2:
+        return packS24AVX2;
+    case kCpuLevelSSSE3:
+        return packS24SSSE3;
+    case kCpuLevelSSE2:
+        return packS24SSE2;
+#endif
+#ifdef AVP_CPU_NEON
+    case kCpuLevelNEON:
+        return packS24NEON;
+#endif
+    default:
+        return packS24Scalar;
+    }
+}
+
+void AVP::packS24(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out)
+{
+    packS24Kernel(CpuDispatch::level())(planes, channels, samples, gain, dither, out);
+}
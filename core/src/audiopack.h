@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef AUDIOPACK_H
+#define AUDIOPACK_H
+
+#include "cpudispatch.h"
+
+#include <cstdint>
+
+namespace AVP {
+
+/*
+ * Per-lane state of the TPDF dither noise generator.
+ * Every SIMD lane owns an independent xorshift32 generator, so the dither sequence depends on the kernel in use.
+ * Without dither, all kernels produce bit-exact identical output.
+ */
+struct DitherState {
+    uint32_t lanes[16];
+
+    explicit DitherState(uint32_t seed = 0x41565053);
+};
+
+/*
+ * Audio PCM pack kernel.
+ * Applies gain to planar float samples, optionally adds 1 LSB TPDF dither, clamps and writes interleaved 24-bit little-endian PCM.
+ * Replaces the "volume" filter + S32 resampling + PCM_S24LE encoding passes with a single pass.
+ * planes: channels pointers to samples float values in [-1.0, 1.0).
+ * out: must hold samples * channels * 3 bytes.
+ * dither: NULL to disable dither.
+ */
+typedef void (*PackS24Function)(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out);
+
+void packS24Scalar(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out);
+#ifdef AVP_CPU_X86
+void packS24SSE2(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out);
+void packS24SSSE3(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out);
+void packS24AVX2(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out);
+void packS24AVX512(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out);
+#endif
+#ifdef AVP_CPU_NEON
+void packS24NEON(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out);
+#endif
+
+// Best kernel for a CPU level
+PackS24Function packS24Kernel(CpuLevel level);
+
+// Kernel bound to CpuDispatch::level()
+void packS24(const float * const *planes, int channels, int samples, float gain, DitherState *dither, uint8_t *out);
+
+}
+
+#endif // AUDIOPACK_H
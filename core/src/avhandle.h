@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef AVHANDLE_H
+#define AVHANDLE_H
+
+#include "allocstats.h"
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/macros.h>
+#include <libavutil/samplefmt.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libswscale/swscale.h>
+#include <libswresample/swresample.h>
+}
+
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace AVP {
+
+/*
+ * Move-only owner of an FFmpeg object.
+ * Frees the object with Deleter when going out of scope, so no "goto end" cleanup is needed for it.
+ * Handles may be declared at the top of a function using goto, as they are constructed empty.
+ */
+template<typename T, typename Deleter>
+class AVHandle {
+public:
+    AVHandle() = default;
+    explicit AVHandle(T *ptr) : ptr(ptr) {}
+    ~AVHandle() { reset(); }
+
+    AVHandle(AVHandle &&other) noexcept : ptr(other.release()) {}
+    AVHandle &operator=(AVHandle &&other) noexcept
+    {
+        if(this != &other)
+            reset(other.release());
+        return *this;
+    }
+    AVHandle(const AVHandle &) = delete;
+    AVHandle &operator=(const AVHandle &) = delete;
+
+    T *get() const { return ptr; }
+    T *operator->() const { return ptr; }
+    explicit operator bool() const { return ptr != nullptr; }
+
+    T *release()
+    {
+        T *old = ptr;
+        ptr = nullptr;
+        return old;
+    }
+    void reset(T *newPtr = nullptr)
+    {
+        if(ptr)
+            Deleter()(ptr);
+        ptr = newPtr;
+    }
+    // For FFmpeg functions taking T** (e.g. avformat_open_input), frees the current object first
+    T **out()
+    {
+        reset();
+        return &ptr;
+    }
+
+private:
+    T *ptr = nullptr;
+};
+
+struct FrameDeleter { void operator()(AVFrame *p) const { av_frame_free(&p); } };
+struct PacketDeleter { void operator()(AVPacket *p) const { av_packet_free(&p); } };
+struct CodecContextDeleter { void operator()(AVCodecContext *p) const { avcodec_free_context(&p); } };
+struct InputFormatContextDeleter { void operator()(AVFormatContext *p) const { avformat_close_input(&p); } };
+struct OutputFormatContextDeleter
+{
+    void operator()(AVFormatContext *p) const
+    {
+        if(!(p->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&p->pb);
+        avformat_free_context(p);
+    }
+};
+struct FilterGraphDeleter { void operator()(AVFilterGraph *p) const { avfilter_graph_free(&p); } };
+struct FilterInOutDeleter { void operator()(AVFilterInOut *p) const { avfilter_inout_free(&p); } };
+struct SwsContextDeleter { void operator()(SwsContext *p) const { sws_freeContext(p); } };
+struct SwrContextDeleter { void operator()(SwrContext *p) const { swr_free(&p); } };
+
+typedef AVHandle<AVFrame, FrameDeleter> FramePtr;
+typedef AVHandle<AVPacket, PacketDeleter> PacketPtr;
+typedef AVHandle<AVCodecContext, CodecContextDeleter> CodecContextPtr;
+typedef AVHandle<AVFormatContext, InputFormatContextDeleter> InputFormatContextPtr;
+typedef AVHandle<AVFormatContext, OutputFormatContextDeleter> OutputFormatContextPtr;
+typedef AVHandle<AVFilterGraph, FilterGraphDeleter> FilterGraphPtr;
+typedef AVHandle<AVFilterInOut, FilterInOutDeleter> FilterInOutPtr;
+typedef AVHandle<SwsContext, SwsContextDeleter> SwsContextPtr;
+typedef AVHandle<SwrContext, SwrContextDeleter> SwrContextPtr;
+
+inline FramePtr makeFrame() { return FramePtr(av_frame_alloc()); }
+inline PacketPtr makePacket() { return PacketPtr(av_packet_alloc()); }
+
+/*
+ * Recycles AVFrame / AVPacket objects instead of allocating new ones.
+ * Objects are handed out as handles, which return them to the pool when they go out of scope.
+ * Pools are thread-safe, so a handle may be released on another thread (e.g. packets queued to a worker).
+ * The pool must outlive all handles it gave out.
+ */
+template<typename T>
+class ObjectPool;
+
+template<typename T>
+class PooledHandle {
+public:
+    PooledHandle() = default;
+    PooledHandle(T *ptr, ObjectPool<T> *pool) : ptr(ptr), pool(pool) {}
+    ~PooledHandle() { reset(); }
+
+    PooledHandle(PooledHandle &&other) noexcept : ptr(other.ptr), pool(other.pool) { other.ptr = nullptr; }
+    PooledHandle &operator=(PooledHandle &&other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            ptr = other.ptr;
+            pool = other.pool;
+            other.ptr = nullptr;
+        }
+        return *this;
+    }
+    PooledHandle(const PooledHandle &) = delete;
+    PooledHandle &operator=(const PooledHandle &) = delete;
+
+    T *get() const { return ptr; }
+    T *operator->() const { return ptr; }
+    explicit operator bool() const { return ptr != nullptr; }
+
+    void reset()
+    {
+        if(ptr)
+            pool->release(ptr);
+        ptr = nullptr;
+    }
+
+private:
+    T *ptr = nullptr;
+    ObjectPool<T> *pool = nullptr;
+};
+
+template<typename T>
+class ObjectPool {
+public:
+    explicit ObjectPool(size_t capacity = 16) : capacity(capacity) {}
+    ~ObjectPool()
+    {
+        for(T *p : objects)
+            freeObject(p);
+    }
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+    // Empty object, holding no data references
+    PooledHandle<T> acquire()
+    {
+        T *p = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(!objects.empty())
+            {
+                p = objects.back();
+                objects.pop_back();
+            }
+        }
+        if(!p)
+            p = allocObject();
+        return PooledHandle<T>(p, this);
+    }
+
+    // Most objects kept for reuse, the ones beyond it are freed
+    void setCapacity(size_t newCapacity)
+    {
+        std::vector<T*> extra;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            capacity = newCapacity;
+            while(objects.size() > capacity)
+            {
+                extra.push_back(objects.back());
+                objects.pop_back();
+            }
+        }
+        for(T *p : extra)
+            freeObject(p);
+    }
+
+    // Returns the object to the pool, dropping its data references
+    void release(T *p)
+    {
+        unrefObject(p);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(objects.size() < capacity)
+            {
+                objects.push_back(p);
+                return;
+            }
+        }
+        freeObject(p);
+    }
+
+protected:
+    std::mutex mutex;
+    std::vector<T*> objects;
+    size_t capacity;
+
+    static T *allocObject();
+    static void unrefObject(T *p);
+    static void freeObject(T *p);
+};
+
+template<> inline AVFrame *ObjectPool<AVFrame>::allocObject() { return av_frame_alloc(); }
+template<> inline void ObjectPool<AVFrame>::unrefObject(AVFrame *p) { av_frame_unref(p); }
+template<> inline void ObjectPool<AVFrame>::freeObject(AVFrame *p) { av_frame_free(&p); }
+template<> inline AVPacket *ObjectPool<AVPacket>::allocObject() { return av_packet_alloc(); }
+template<> inline void ObjectPool<AVPacket>::unrefObject(AVPacket *p) { av_packet_unref(p); }
+template<> inline void ObjectPool<AVPacket>::freeObject(AVPacket *p) { av_packet_free(&p); }
+
+typedef PooledHandle<AVFrame> PooledFrame;
+typedef PooledHandle<AVPacket> PooledPacket;
+typedef ObjectPool<AVPacket> PacketPool;
+
+/*
+ * Frame pool that also recycles the data buffers, through one AVBufferPool per plane.
+ * A buffer returns to its pool once every reference to it is gone (e.g. also after an encoder holding the frame for B-frames is done), so in steady state no allocation happens.
+ * Buffer allocations are counted by AllocStats.
+ * Changing the geometry starts new buffer pools, buffers still in use stay valid.
+ */
+class FramePool : public ObjectPool<AVFrame> {
+public:
+    explicit FramePool(size_t capacity = 16) : ObjectPool<AVFrame>(capacity) {}
+    ~FramePool() { uninitBufferPools(); }
+
+    // Empty frame on failure
+    PooledFrame acquireVideo(AVPixelFormat format, int width, int height)
+    {
+        PooledFrame frame = acquire();
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        if(!isVideo || format != poolFormat || width != poolWidth || height != poolHeight)
+        {
+            ptrdiff_t linesizes[4];
+            size_t sizes[4] = {0};
+            uninitBufferPools();
+            if(av_image_fill_linesizes(poolLinesizes, format, width) < 0)
+                return frame;
+            for(int i = 0; i < 4; i++)
+            {
+                poolLinesizes[i] = FFALIGN(poolLinesizes[i], kAlign);
+                linesizes[i] = poolLinesizes[i];
+            }
+            if(av_image_fill_plane_sizes(sizes, format, height, linesizes) < 0)
+                return frame;
+            for(int i = 0; i < 4; i++)
+                if(sizes[i])
+                    bufferPools[i] = av_buffer_pool_init(sizes[i] + kAlign, countedBufferAlloc);
+            isVideo = true;
+            poolFormat = format;
+            poolWidth = width;
+            poolHeight = height;
+        }
+
+        for(int i = 0; i < 4 && bufferPools[i]; i++)
+        {
+            frame->buf[i] = av_buffer_pool_get(bufferPools[i]);
+            if(!frame->buf[i])
+            {
+                av_frame_unref(frame.get());
+                return frame;
+            }
+            frame->data[i] = frame->buf[i]->data;
+            frame->linesize[i] = poolLinesizes[i];
+        }
+        frame->format = format;
+        frame->width = width;
+        frame->height = height;
+        return frame;
+    }
+
+    // Planar formats with more channels than data pointers are not pooled
+    PooledFrame acquireAudio(AVSampleFormat format, const AVChannelLayout *layout, int sampleRate, int nbSamples)
+    {
+        PooledFrame frame = acquire();
+        int planes = av_sample_fmt_is_planar(format) ? layout->nb_channels : 1;
+        frame->format = format;
+        frame->sample_rate = sampleRate;
+        frame->nb_samples = nbSamples;
+        if(av_channel_layout_copy(&frame->ch_layout, layout) < 0)
+            return frame;
+        if(planes > AV_NUM_DATA_POINTERS)
+        {
+            av_frame_get_buffer(frame.get(), 0);
+            return frame;
+        }
+
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        if(isVideo || format != poolFormat || nbSamples != poolWidth || layout->nb_channels != poolHeight)
+        {
+            // One buffer per plane: the linesize, not the returned size of all planes together
+            int linesize = 0;
+            uninitBufferPools();
+            if(av_samples_get_buffer_size(&linesize, layout->nb_channels, nbSamples, format, kAlign) < 0)
+                return frame;
+            poolLinesizes[0] = linesize;
+            bufferPools[0] = av_buffer_pool_init(linesize, countedBufferAlloc);
+            isVideo = false;
+            poolFormat = format;
+            poolWidth = nbSamples;
+            poolHeight = layout->nb_channels;
+        }
+
+        for(int i = 0; i < planes; i++)
+        {
+            frame->buf[i] = av_buffer_pool_get(bufferPools[0]);
+            if(!frame->buf[i])
+            {
+                av_frame_unref(frame.get());
+                return frame;
+            }
+            frame->data[i] = frame->buf[i]->data;
+        }
+        frame->extended_data = frame->data;
+        frame->linesize[0] = poolLinesizes[0];
+        return frame;
+    }
+
+private:
+    static const int kAlign = 64;
+
+    std::mutex bufferMutex;
+    AVBufferPool *bufferPools[4] = {NULL};
+    int poolLinesizes[4] = {0};
+    bool isVideo = false;
+    int poolFormat = -1;
+    int poolWidth = 0;      // Samples per frame for audio
+    int poolHeight = 0;     // Channels for audio
+
+    void uninitBufferPools()
+    {
+        for(int i = 0; i < 4; i++)
+            av_buffer_pool_uninit(&bufferPools[i]);
+        poolFormat = -1;
+    }
+};
+
+/*
+ * Resizes a packet for size bytes of payload, reusing its buffer when possible.
+ * Unlike av_new_packet, no allocation happens once the buffer is large enough and no longer referenced elsewhere.
+ * The padding after the payload is zeroed as av_new_packet does, as it may hold an earlier, longer payload.
+ */
+inline int reusePacket(AVPacket *packet, int size)
+{
+    if(packet->buf && av_buffer_is_writable(packet->buf) && packet->buf->size >= (size_t)size + AV_INPUT_BUFFER_PADDING_SIZE)
+    {
+        packet->data = packet->buf->data;
+        packet->size = size;
+        memset(packet->data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        av_packet_free_side_data(packet);
+        packet->flags = 0;
+        return 0;
+    }
+    av_packet_unref(packet);
+    return av_new_packet(packet, size);
+}
+
+}
+
+#endif // AVHANDLE_H
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "avplayout.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+/*
+ * Special note to this optimization:
+ * The old filter string asked for a crop at 2327, which the crop filter clamped to 2326, so the folded output is unchanged.
+ */
+static AVP::AVPLayout builtinLayout(AVP::AVPSize size, const char *name, const char *realSize, const char *dolbySuffix)
+{
+    const AVP::AVPBuiltinGeometry &geometry = AVP::kAVPBuiltinGeometry[size];
+    return {size, name, realSize, dolbySuffix, geometry.width, geometry.height, geometry.pictureWidth, geometry.pictureX, geometry.canvasWidth,
+            std::vector<AVP::AVPRegion>(geometry.regions, geometry.regions + AVP::kAVPBuiltinRegions)};
+}
+
+static std::deque<AVP::AVPLayout> &registry()
+{
+    static std::deque<AVP::AVPLayout> layouts = {
+        builtinLayout(AVP::kAVPSmallSize, "Small", "5.5Mx2.1M", "5m"),
+        builtinLayout(AVP::kAVPMediumSize, "Medium", "9Mx2.1M", "9m"),
+        builtinLayout(AVP::kAVPLargeSize, "Large", "12Mx2.1M", "12m")
+    };
+    return layouts;
+}
+
+const AVP::AVPLayout &AVP::getLayout(AVPSize size)
+{
+    const std::deque<AVPLayout> &layouts = registry();
+    if(size >= 0 && (size_t)size < layouts.size())
+        return layouts[size];
+    return layouts[kAVPMediumSize];
+}
+
+bool AVP::hasBuiltinGeometry(const AVPLayout &layout, int index)
+{
+    if(index < 0 || index >= kAVPBuiltinLayouts)
+        return false;
+    const AVPBuiltinGeometry &geometry = kAVPBuiltinGeometry[index];
+    if(layout.width != geometry.width || layout.height != geometry.height || layout.pictureWidth != geometry.pictureWidth ||
+       layout.pictureX != geometry.pictureX || layout.canvasWidth != geometry.canvasWidth || layout.regions.size() != kAVPBuiltinRegions)
+        return false;
+    for(int i = 0; i < kAVPBuiltinRegions; i++)
+    {
+        const AVPRegion &a = layout.regions[i];
+        const AVPRegion &b = geometry.regions[i];
+        if(a.srcX != b.srcX || a.srcY != b.srcY || a.width != b.width || a.height != b.height || a.dstX != b.dstX || a.dstY != b.dstY)
+            return false;
+    }
+    return true;
+}
+
+int AVP::getLayoutCount()
+{
+    return (int)registry().size();
+}
+
+static std::string toLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+    return str;
+}
+
+bool AVP::findLayout(const std::string &name, AVPSize *size)
+{
+    const std::deque<AVPLayout> &layouts = registry();
+    std::string lower = toLower(name);
+    for(size_t i = 0; i < layouts.size(); i++)
+    {
+        if(toLower(layouts[i].name) == lower || toLower(layouts[i].dolbySuffix) == lower)
+        {
+            *size = (AVPSize)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string trim(const std::string &str)
+{
+    size_t begin = str.find_first_not_of(" \t\r");
+    if(begin == std::string::npos)
+        return "";
+    size_t end = str.find_last_not_of(" \t\r");
+    return str.substr(begin, end - begin + 1);
+}
+
+// Reads exactly count integers
+static bool parseInts(const std::string &value, int *out, int count)
+{
+    std::istringstream stream(value);
+    for(int i = 0; i < count; i++)
+        if(!(stream >> out[i]))
+            return false;
+    std::string rest;
+    return !(stream >> rest);
+}
+
+static bool validateLayout(const AVP::AVPLayout &layout, std::string *error)
+{
+    if(layout.name.empty())
+        *error = "missing name";
+    else if(layout.width <= 0 || layout.height <= 0 || layout.height % 2)
+        *error = "width and height must be positive, height must be even";
+    else if(layout.pictureWidth <= 0 || layout.pictureWidth % 2 || layout.pictureX < 0 || layout.pictureX + layout.pictureWidth > layout.canvasWidth)
+        *error = "picture must be even and lie on the canvas";
+    else if(layout.regions.empty())
+        *error = "no regions";
+    if(!error->empty())
+        return false;
+
+    for(size_t i = 0; i < layout.regions.size(); i++)
+    {
+        const AVP::AVPRegion &a = layout.regions[i];
+        if(a.width <= 0 || a.height <= 0 || a.srcX < 0 || a.srcY < 0 || a.srcX + a.width > layout.canvasWidth || a.srcY + a.height > layout.height)
+            *error = "region " + std::to_string(i + 1) + " is outside the canvas";
+        else if(a.dstX < 0 || a.dstY < 0 || a.dstX + a.width > AVP::kAVPFrameWidth || a.dstY + a.height > AVP::kAVPFrameHeight)
+            *error = "region " + std::to_string(i + 1) + " is outside the frame";
+        for(size_t j = 0; j < i && error->empty(); j++)
+        {
+            const AVP::AVPRegion &b = layout.regions[j];
+            if(a.dstX < b.dstX + b.width && b.dstX < a.dstX + a.width && a.dstY < b.dstY + b.height && b.dstY < a.dstY + a.height)
+                *error = "regions " + std::to_string(j + 1) + " and " + std::to_string(i + 1) + " overlap in the frame";
+        }
+        if(!error->empty())
+            return false;
+    }
+    return true;
+}
+
+bool AVP::parseLayout(std::istream &stream, AVPLayout *layout, std::string *error)
+{
+    AVPLayout result = {kAVPMediumSize, "", "", "", 0, kAVPHeight, 0, 0, 0, {}};
+    bool hasPicture = false;
+    std::string line;
+    int lineNumber = 0;
+
+    error->clear();
+    while(std::getline(stream, line))
+    {
+        lineNumber ++;
+        line = trim(line.substr(0, line.find('#')));
+        if(line.empty())
+            continue;
+
+        size_t equal = line.find('=');
+        std::string key = trim(line.substr(0, equal));
+        std::string value = equal == std::string::npos ? "" : trim(line.substr(equal + 1));
+        int numbers[6] = {0};
+        bool ok = true;
+        if(value.empty())
+        {
+            *error = "line " + std::to_string(lineNumber) + ": missing value";
+            return false;
+        }
+
+        if(key == "name")
+            result.name = value;
+        else if(key == "realSize")
+            result.realSize = value;
+        else if(key == "dolbySuffix")
+            result.dolbySuffix = value;
+        else if(key == "width")
+            ok = parseInts(value, &result.width, 1);
+        else if(key == "height")
+            ok = parseInts(value, &result.height, 1);
+        else if(key == "canvas")
+            ok = parseInts(value, &result.canvasWidth, 1);
+        else if(key == "picture")
+        {
+            ok = parseInts(value, numbers, 2);
+            result.pictureWidth = numbers[0];
+            result.pictureX = numbers[1];
+            hasPicture = true;
+        }
+        else if(key == "region")
+        {
+            ok = parseInts(value, numbers, 6);
+            result.regions.push_back({numbers[0], numbers[1], numbers[2], numbers[3], numbers[4], numbers[5]});
+        }
+        else
+        {
+            *error = "line " + std::to_string(lineNumber) + ": unknown key \"" + key + "\"";
+            return false;
+        }
+        if(!ok)
+        {
+            *error = "line " + std::to_string(lineNumber) + ": bad value for \"" + key + "\"";
+            return false;
+        }
+    }
+
+    if(!hasPicture)
+        result.pictureWidth = result.width - result.width % 2;
+    if(result.canvasWidth == 0)
+        result.canvasWidth = result.pictureX + result.pictureWidth;
+    if(result.dolbySuffix.empty())
+        result.dolbySuffix = toLower(result.name);
+    if(!validateLayout(result, error))
+        return false;
+
+    *layout = result;
+    return true;
+}
+
+static int loadDirectory(const std::filesystem::path &directory)
+{
+    std::error_code errorCode;
+    std::vector<std::filesystem::path> files;
+    for(const std::filesystem::directory_entry &entry : std::filesystem::directory_iterator(directory, errorCode))
+        if(entry.path().extension() == ".avplayout")
+            files.push_back(entry.path());
+    std::sort(files.begin(), files.end());
+
+    int count = 0;
+    for(const std::filesystem::path &file : files)
+    {
+        std::ifstream stream(file);
+        AVP::AVPLayout layout;
+        std::string error;
+        AVP::AVPSize existing;
+        if(!stream)
+            error = "can not open file";
+        else if(AVP::parseLayout(stream, &layout, &error) && AVP::findLayout(layout.name, &existing))
+            error = "layout \"" + layout.name + "\" is already defined";
+        if(!error.empty())
+        {
+            fprintf(stderr, "Layout %s: %s\n", file.u8string().c_str(), error.c_str());
+            continue;
+        }
+        layout.size = (AVP::AVPSize)registry().size();
+        registry().push_back(layout);
+        count ++;
+    }
+    return count;
+}
+
+int AVP::loadLayouts(const std::string &applicationDir)
+{
+    int count = loadDirectory(std::filesystem::u8path(applicationDir) / "layouts");
+    const char *path = getenv("AVP_LAYOUT_PATH");
+    if(path && *path)
+        count += loadDirectory(std::filesystem::u8path(path));
+    return count;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef AVPLAYOUT_H
+#define AVPLAYOUT_H
+
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace AVP {
+
+// Built-in layouts. Layouts loaded from descriptors follow at kAVPBuiltinLayouts and up.
+enum AVPSize : int {
+    kAVPSmallSize,
+    kAVPMediumSize,
+    kAVPLargeSize
+};
+
+const int kAVPBuiltinLayouts = 3;
+
+const int kAVPHeight = 1080;
+// Canvas of the built-in V2 layouts
+const int kAVPCanvasWidth = 6166;
+const int kAVPFrameWidth = 3840;
+const int kAVPFrameHeight = 2160;
+
+// Rectangle of the canvas shown by one projector, and where it is stored in the MXL frame
+struct AVPRegion {
+    int srcX;
+    int srcY;
+    int width;
+    int height;
+    int dstX;
+    int dstY;
+};
+
+struct AVPLayout {
+    AVPSize size;
+    std::string name;           // "Small", "Medium", "Large" or the descriptor name
+    std::string realSize;       // Physical corridor size
+    std::string dolbySuffix;    // Size part of Dolby style file names
+    int width;                  // Nominal picture width
+    int height;                 // Picture and canvas height
+    int pictureWidth;           // Even picture width placed on the canvas
+    int pictureX;               // Left edge of the picture on the canvas
+    int canvasWidth;
+    std::vector<AVPRegion> regions;
+
+    // Aspect ratio used to pad inputs that do not fit the picture
+    double padRatio() const { return (double)width / height; }
+};
+
+/*
+ * Geometry of the built-in layouts, known at compile time so the remap kernels can be specialised on it.
+ * The V2 canvas is 6166 pixels wide, so the right projector strip starts at 6166 - 3840 = 2326.
+ */
+const int kAVPBuiltinRegions = 2;
+
+struct AVPBuiltinGeometry {
+    int width;
+    int height;
+    int pictureWidth;
+    int pictureX;
+    int canvasWidth;
+    AVPRegion regions[kAVPBuiltinRegions];
+};
+
+constexpr AVPBuiltinGeometry kAVPBuiltinGeometry[kAVPBuiltinLayouts] = {
+    {2830, kAVPHeight, 2830, 1668, kAVPCanvasWidth, {{0, 0, 3840, 1080, 0, 0}, {2326, 0, 3840, 1080, 0, 1080}}},
+    {4633, kAVPHeight, 4632, 767, kAVPCanvasWidth, {{0, 0, 3840, 1080, 0, 0}, {2326, 0, 3840, 1080, 0, 1080}}},
+    {6167, kAVPHeight, 6166, 0, kAVPCanvasWidth, {{0, 0, 3840, 1080, 0, 0}, {2326, 0, 3840, 1080, 0, 1080}}}
+};
+
+// True if the layout has the geometry of built-in layout index
+bool hasBuiltinGeometry(const AVPLayout &layout, int index);
+
+// Layouts of other sizes return the Medium layout
+const AVPLayout &getLayout(AVPSize size);
+int getLayoutCount();
+// Matches the name or Dolby suffix, ignoring case
+bool findLayout(const std::string &name, AVPSize *size);
+
+/*
+ * Layout descriptors, one "key = value" per line, "#" starts a comment:
+ *   name = Wide                   Required, used by --size and the watch sidecar
+ *   realSize = 14Mx2.1M
+ *   dolbySuffix = 14m             Defaults to the lower case name
+ *   width = 7000                  Required nominal picture width
+ *   height = 1080
+ *   canvas = 7000                 Canvas width, defaults to the picture width
+ *   picture = 7000 0              Picture width and left edge on the canvas, defaults to the even width at 0
+ *   region = 0 0 3840 1080 0 0    srcX srcY width height dstX dstY, one line per projector region
+ * Regions must lie on the canvas and in the 3840x2160 frame without overlapping each other in the frame.
+ * Frame areas no region covers are black.
+ */
+bool parseLayout(std::istream &stream, AVPLayout *layout, std::string *error);
+
+/*
+ * Registers the descriptors (*.avplayout) in <applicationDir>/layouts and in AVP_LAYOUT_PATH if set.
+ * Call once at startup, before any worker uses a layout. Errors are printed to stderr.
+ * Returns the number of layouts added.
+ */
+int loadLayouts(const std::string &applicationDir);
+
+// Round up to the next even integer, as most filters and encoders require
+template<typename T> int toUpperInt(T val)
+{
+    if((int)val % 2 == 1)
+        return (int)val + 1;
+    else
+        return (int)val;
+}
+
+}
+
+#endif // AVPLAYOUT_H
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "codecsetup.h"
+
+#include "avplayout.h"
+
+extern "C" {
+#include <libavutil/avstring.h>
+#include <libavutil/dict.h>
+#include <libavutil/opt.h>
+}
+
+/*
+ * Encoder options of each speed tier, in FFmpeg command line syntax.
+ * Standard leaves the FFmpeg defaults (EPZS motion search, simple macroblock decision), as before the tiers existed.
+ * Draft keeps EPZS but narrows its search range and subpel refinement; the diamond is already the smallest by default.
+ * Best decides macroblocks by rate distortion with trellis quantization and refines subpel vectors by SATD.
+ */
+static const struct {
+    const char *name;
+    const char *options;
+} speedTiers[AVP::kEncoderSpeedCount] = {
+    {"draft", "me_range=8:subq=2"},
+    {"standard", ""},
+    {"best", "mbd=rd:trellis=1:subcmp=satd"}
+};
+
+const char *AVP::getEncoderSpeedName(EncoderSpeed speed)
+{
+    if(speed < 0 || speed >= kEncoderSpeedCount)
+        speed = kEncoderStandard;
+    return speedTiers[speed].name;
+}
+
+bool AVP::findEncoderSpeed(const std::string &name, EncoderSpeed *speed)
+{
+    for(int i = 0; i < kEncoderSpeedCount; i++)
+    {
+        if(av_strcasecmp(name.c_str(), speedTiers[i].name) == 0)
+        {
+            *speed = (EncoderSpeed)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+int AVP::openDecoder(const AVStream *stream, const AVCodec *decoder, AVCodecContext **cxt, int threadCount)
+{
+    int avError = 0;
+
+    *cxt = avcodec_alloc_context3(decoder);
+    if(!*cxt)
+        return AVERROR(ENOMEM);
+    avError = avcodec_parameters_to_context(*cxt, stream->codecpar);
+    if(avError < 0)
+        return avError;
+    if(threadCount > 0)
+        (*cxt) -> thread_count = threadCount;
+    return avcodec_open2(*cxt, decoder, 0);
+}
+
+int AVP::setupMxlVideoEncoder(AVCodecContext **cxt, double bitRateMbps, AVRational frameRate, AVColorPrimaries colorPrimaries, AVColorTransferCharacteristic colorTrc, AVColorSpace colorSpace, EncoderSpeed speed)
+{
+    int avError = 0;
+    AVDictionary *options = NULL;
+
+    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO);
+    if(!encoder)
+        return AVERROR_ENCODER_NOT_FOUND;
+    *cxt = avcodec_alloc_context3(encoder);
+    if(!*cxt)
+        return AVERROR(ENOMEM);
+
+    (*cxt) -> time_base = av_inv_q(frameRate);
+    (*cxt) -> width = kAVPFrameWidth;
+    (*cxt) -> height = kAVPFrameHeight;
+    (*cxt) -> bit_rate = bitRateMbps * 1000000;
+    (*cxt) -> rc_max_rate = (*cxt)->bit_rate;
+    (*cxt) -> rc_min_rate = (*cxt)->bit_rate;
+    (*cxt) -> rc_buffer_size = (*cxt)->bit_rate / 2;
+    (*cxt) -> bit_rate_tolerance = 0;
+    (*cxt) -> pix_fmt = AV_PIX_FMT_YUV422P;
+    (*cxt) -> color_primaries = colorPrimaries;
+    (*cxt) -> colorspace = colorSpace;
+    (*cxt) -> color_trc = colorTrc;
+    (*cxt) -> profile = 0;
+    (*cxt) -> max_b_frames = 0;
+    (*cxt) -> framerate = frameRate;
+
+    // Private options (motion_est, trellis, mpv_flags) live in the encoder's priv_data
+    avError = av_dict_parse_string(&options, speedTiers[speed < 0 || speed >= kEncoderSpeedCount ? kEncoderStandard : speed].options, "=", ":", 0);
+    if(avError >= 0)
+        avError = av_opt_set_dict2(*cxt, &options, AV_OPT_SEARCH_CHILDREN);
+    if(avError >= 0 && av_dict_count(options) > 0)
+        avError = AVERROR_OPTION_NOT_FOUND;
+    av_dict_free(&options);
+    return avError < 0 ? avError : 0;
+}
+
+int AVP::setupWavAudioEncoder(AVCodecContext **cxt, const AVChannelLayout *layout, int sampleRate)
+{
+    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_PCM_S24LE);
+    if(!encoder)
+        return AVERROR_ENCODER_NOT_FOUND;
+    *cxt = avcodec_alloc_context3(encoder);
+    if(!*cxt)
+        return AVERROR(ENOMEM);
+
+    (*cxt) -> time_base = {1, sampleRate};
+    (*cxt) -> sample_fmt = AV_SAMPLE_FMT_S32;
+    (*cxt) -> sample_rate = sampleRate;
+    return av_channel_layout_copy(&(*cxt)->ch_layout, layout);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef CODECSETUP_H
+#define CODECSETUP_H
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+#include <string>
+
+namespace AVP {
+
+// MPEG-2 encoder speed tiers, trading encoding speed for picture quality at the same bitrate
+enum EncoderSpeed : int {
+    kEncoderDraft,      // No motion search, for client approval
+    kEncoderStandard,   // FFmpeg defaults
+    kEncoderBest        // Rate-distortion decisions and trellis quantization, for the final delivery
+};
+const int kEncoderSpeedCount = 3;
+
+// "draft", "standard" or "best"
+const char *getEncoderSpeedName(EncoderSpeed speed);
+bool findEncoderSpeed(const std::string &name, EncoderSpeed *speed);
+
+/*
+ * Allocates a decoder context for stream and opens it.
+ * threadCount: 0 keeps the FFmpeg default.
+ * Returns 0 or a negative AVERROR. *cxt is set on both paths and must be freed by the caller.
+ */
+int openDecoder(const AVStream *stream, const AVCodec *decoder, AVCodecContext **cxt, int threadCount = 0);
+
+/*
+ * MPEG-2 4:2:2 constant bitrate encoder for 3840 x 2160 MXL frames.
+ * The encoder is allocated and configured but not opened (open it with cxt->codec).
+ */
+int setupMxlVideoEncoder(AVCodecContext **cxt, double bitRateMbps, AVRational frameRate, AVColorPrimaries colorPrimaries, AVColorTransferCharacteristic colorTrc, AVColorSpace colorSpace, EncoderSpeed speed = kEncoderStandard);
+
+// 24-bit PCM encoder for AVP WAV outputs, fed by packS24() packets
+int setupWavAudioEncoder(AVCodecContext **cxt, const AVChannelLayout *layout, int sampleRate);
+
+}
+
+#endif // CODECSETUP_H
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "cpudispatch.h"
+
+extern "C" {
+#include <libavutil/cpu.h>
+}
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#if defined(AVP_CPU_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+std::atomic<AVP::CpuLevel> AVP::CpuDispatch::current(AVP::kCpuLevelScalar);
+AVP::CpuLevel AVP::CpuDispatch::detected = AVP::kCpuLevelScalar;
+
+static const char *levelNames[] = {"scalar", "sse2", "ssse3", "avx2", "avx512", "neon"};
+
+static AVP::CpuLevel probeHost()
+{
+#if defined(AVP_CPU_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = info[3] & (1 << 26);
+    bool ssse3 = info[2] & (1 << 9);
+    bool osxsave = info[2] & (1 << 27);
+    bool avx = info[2] & (1 << 28);
+    bool avx2 = false;
+    bool avx512 = false;
+
+    // AVX and AVX-512 also need the OS to save the wider registers
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    if(maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = avx && (info[1] & (1 << 5)) && (xcr0 & 0x06) == 0x06;
+        avx512 = (info[1] & (1 << 16)) && (info[1] & (1 << 30)) && (xcr0 & 0xE6) == 0xE6;
+    }
+
+    if(avx512 && avx2)
+        return AVP::kCpuLevelAVX512;
+    if(avx2)
+        return AVP::kCpuLevelAVX2;
+    if(ssse3)
+        return AVP::kCpuLevelSSSE3;
+    if(sse2)
+        return AVP::kCpuLevelSSE2;
+    return AVP::kCpuLevelScalar;
+#elif defined(AVP_CPU_X86)
+    // libgcc checks the OS register state for AVX and AVX-512 as well
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx2"))
+        return AVP::kCpuLevelAVX512;
+    if(__builtin_cpu_supports("avx2"))
+        return AVP::kCpuLevelAVX2;
+    if(__builtin_cpu_supports("ssse3"))
+        return AVP::kCpuLevelSSSE3;
+    if(__builtin_cpu_supports("sse2"))
+        return AVP::kCpuLevelSSE2;
+    return AVP::kCpuLevelScalar;
+#elif defined(AVP_CPU_NEON)
+    // Advanced SIMD is mandatory on ARM64
+    return AVP::kCpuLevelNEON;
+#else
+    return AVP::kCpuLevelScalar;
+#endif
+}
+
+/*
+ * Mirror a forced level on FFmpeg, so swscale, the filters and the codecs take the same paths as our kernels.
+ * The SSSE3 level keeps SSE4.x, which shipped on the same pre-AVX generations.
+ */
+static void forceFFmpegLevel(AVP::CpuLevel level, AVP::CpuLevel detected)
+{
+    av_force_cpu_flags(-1);
+    if(level == detected)
+        return;
+    if(level == AVP::kCpuLevelScalar)
+    {
+        av_force_cpu_flags(0);
+        return;
+    }
+
+#ifdef AVP_CPU_X86
+    int flags = av_get_cpu_flags();
+    if(level < AVP::kCpuLevelAVX512)
+        flags &= ~(AV_CPU_FLAG_AVX512 | AV_CPU_FLAG_AVX512ICL);
+    if(level < AVP::kCpuLevelAVX2)
+        flags &= ~(AV_CPU_FLAG_AVX | AV_CPU_FLAG_AVXSLOW | AV_CPU_FLAG_XOP | AV_CPU_FLAG_FMA4 | AV_CPU_FLAG_AVX2 | AV_CPU_FLAG_FMA3);
+    if(level < AVP::kCpuLevelSSSE3)
+        flags &= ~(AV_CPU_FLAG_SSE3 | AV_CPU_FLAG_SSE3SLOW | AV_CPU_FLAG_SSSE3 | AV_CPU_FLAG_SSSE3SLOW | AV_CPU_FLAG_ATOM | AV_CPU_FLAG_SSE4 | AV_CPU_FLAG_SSE42 | AV_CPU_FLAG_AESNI);
+    av_force_cpu_flags(flags);
+#endif
+}
+
+void AVP::CpuDispatch::ensureDetected()
+{
+    static std::once_flag once;
+    std::call_once(once, []() {
+        detected = probeHost();
+        current.store(detected, std::memory_order_relaxed);
+    });
+}
+
+bool AVP::CpuDispatch::isSupported(CpuLevel level)
+{
+    ensureDetected();
+    if(level == kCpuLevelScalar)
+        return true;
+    if(level == kCpuLevelNEON || detected == kCpuLevelNEON)
+        return level == detected;
+    return level <= detected;
+}
+
+void AVP::CpuDispatch::initFromEnvironment()
+{
+    const char *name = getenv("AVP_CPU_LEVEL");
+    if(name && *name && !setLevel(name))
+        fprintf(stderr, "AVP_CPU_LEVEL=%s is unknown or not supported by this CPU, using %s\n", name, levelName(level()));
+}
+
+bool AVP::CpuDispatch::setLevel(CpuLevel level)
+{
+    if(!isSupported(level))
+        return false;
+    current.store(level, std::memory_order_relaxed);
+    forceFFmpegLevel(level, detected);
+    return true;
+}
+
+bool AVP::CpuDispatch::setLevel(const char *name)
+{
+    CpuLevel level;
+    if(!parseLevel(name, &level))
+        return false;
+    return setLevel(level);
+}
+
+const char *AVP::CpuDispatch::levelName(CpuLevel level)
+{
+    if(level < kCpuLevelScalar || level > kCpuLevelNEON)
+        return "";
+    return levelNames[level];
+}
+
+bool AVP::CpuDispatch::parseLevel(const char *name, CpuLevel *level)
+{
+    for(int i = kCpuLevelScalar; i <= kCpuLevelNEON; i++)
+        if(strcmp(name, levelNames[i]) == 0)
+        {
+            *level = (CpuLevel)i;
+            return true;
+        }
+    return false;
+}
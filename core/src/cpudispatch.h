@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef CPUDISPATCH_H
+#define CPUDISPATCH_H
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AVP_CPU_X86 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define AVP_CPU_NEON 1
+#endif
+
+namespace AVP {
+
+// Instruction set levels of hand-written kernels. x86 levels are ordered, NEON is the ARM64 baseline.
+enum CpuLevel {
+    kCpuLevelScalar,
+    kCpuLevelSSE2,
+    kCpuLevelSSSE3,
+    kCpuLevelAVX2,
+    kCpuLevelAVX512,
+    kCpuLevelNEON
+};
+
+/*
+ * Runtime CPU feature dispatch.
+ * The host is probed once at startup and kernels are bound to the best implementation for level().
+ * AVP_CPU_LEVEL (or --cpu-level) forces a lower level on both our kernels and FFmpeg, so the paths can be compared on one machine.
+ */
+class CpuDispatch {
+public:
+    static CpuLevel level() { ensureDetected(); return current.load(std::memory_order_relaxed); }
+    // Best level of the host, ignoring overrides
+    static CpuLevel detectedLevel() { ensureDetected(); return detected; }
+    static bool isSupported(CpuLevel level);
+
+    // Apply AVP_CPU_LEVEL if set
+    static void initFromEnvironment();
+    // Returns false if the level is unknown or not supported by the host
+    static bool setLevel(CpuLevel level);
+    static bool setLevel(const char *name);
+
+    static const char *levelName(CpuLevel level);
+    static bool parseLevel(const char *name, CpuLevel *level);
+
+private:
+    static void ensureDetected();
+
+    static std::atomic<CpuLevel> current;
+    static CpuLevel detected;
+};
+
+}
+
+#endif // CPUDISPATCH_H
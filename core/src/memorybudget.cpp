@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "memorybudget.h"
+
+#include "avplayout.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <cstdio>
+#include <unistd.h>
+#endif
+
+// Qt, the FFmpeg libraries, codec tables and contexts
+static const int64_t kBaseBytes = 160ll << 20;
+// Reference frames held by long-GOP decoders (e.g. the HEVC DPB of a typical camera file)
+static const int kDecoderReferenceFrames = 6;
+// Output frames: the one being converted, the encoder input and its reconstruction
+static const int kOutputFrames = 3;
+// Worst case of one queued audio packet (e.g. uncompressed multichannel PCM)
+static const int64_t kAudioPacketBytes = 256ll << 10;
+
+static const int kDefaultAudioQueuePackets = 64;
+static const int kMinAudioQueuePackets = 8;
+// One canvas is converted at a time, the audio worker also converts one frame at a time
+static const int kCanvasFrames = 1;
+static const int kAudioFrames = 1;
+
+static int64_t frameBytes(AVPixelFormat format, int width, int height)
+{
+    int size = av_image_get_buffer_size(format, width, height, 64);
+    // Unknown formats are taken as 8-bit 4:4:4
+    return size > 0 ? size : (int64_t)width * height * 3;
+}
+
+static int64_t predictPeak(int64_t inputFrame, int64_t filterBytes, int64_t outputFrame, int audioQueuePackets)
+{
+    return kBaseBytes
+         + inputFrame * (kDecoderReferenceFrames + 1)
+         + filterBytes
+         + outputFrame * kOutputFrames
+         + kAudioPacketBytes * audioQueuePackets;
+}
+
+AVP::MemoryPlan AVP::planConversionMemory(int64_t budgetBytes, int inputWidth, int inputHeight, AVPixelFormat inputFormat, bool hasAudio)
+{
+    MemoryPlan plan;
+    const int64_t inputFrame = frameBytes(inputFormat, inputWidth, inputHeight);
+    // Intermediates: the filtered canvas and its YUV422 copy, which is folded into the output frame
+    const int64_t filterBytes = frameBytes(inputFormat, kAVPCanvasWidth, kAVPHeight) + frameBytes(AV_PIX_FMT_YUV422P, kAVPCanvasWidth, kAVPHeight);
+    const int64_t outputFrame = frameBytes(AV_PIX_FMT_YUV422P, kAVPFrameWidth, kAVPFrameHeight);
+    const int audioPackets = hasAudio ? kDefaultAudioQueuePackets : 0;
+
+    // No budget: the defaults
+    plan.predictedPeakBytes = predictPeak(inputFrame, filterBytes, outputFrame, audioPackets);
+    if(budgetBytes <= 0)
+        return plan;
+
+    // Pools hold no more frames than counted above
+    plan.canvasPoolFrames = kCanvasFrames;
+    plan.outputPoolFrames = kOutputFrames;
+    plan.audioPoolFrames = kAudioFrames;
+
+    // Shorter audio queues until the peak fits
+    plan.audioQueuePackets = kDefaultAudioQueuePackets;
+    while(hasAudio && plan.predictedPeakBytes > budgetBytes && plan.audioQueuePackets > kMinAudioQueuePackets)
+    {
+        plan.audioQueuePackets /= 2;
+        plan.predictedPeakBytes = predictPeak(inputFrame, filterBytes, outputFrame, plan.audioQueuePackets);
+    }
+    plan.fitsBudget = plan.predictedPeakBytes <= budgetBytes;
+    return plan;
+}
+
+int64_t AVP::currentResidentBytes()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.WorkingSetSize;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if(task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+        return 0;
+    return info.resident_size;
+#else
+    // Second field: resident pages
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(!statm)
+        return 0;
+    long long pages = 0;
+    long long residentPages = 0;
+    int fields = fscanf(statm, "%lld %lld", &pages, &residentPages);
+    fclose(statm);
+    if(fields != 2)
+        return 0;
+    return residentPages * sysconf(_SC_PAGESIZE);
+#endif
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+
+#include <cstdint>
+
+namespace AVP {
+
+// Resources of a conversion, sized to a memory budget
+struct MemoryPlan {
+    int audioQueuePackets = 0;      // 0 keeps the default queue depth
+    int canvasPoolFrames = 0;       // Frame pool depths, 0 keeps the pool default
+    int outputPoolFrames = 0;
+    int audioPoolFrames = 0;
+    int64_t predictedPeakBytes = 0;
+    bool fitsBudget = true;
+};
+
+/*
+ * Plans a conversion to stay under budgetBytes (0 for no budget).
+ * The estimate adds up the decoder frames (references and the single decoding thread), the remap filter intermediates,
+ * the 3840x2160 422 output frames in flight, the audio packet queue and a fixed base for the libraries.
+ * A budget starts from the defaults and only reduces them: the frame pools keep no more frames than the estimate counts,
+ * then the audio queue is halved until the peak fits. Decoding stays single threaded.
+ * If even the smallest plan exceeds the budget, it is returned with fitsBudget false.
+ */
+MemoryPlan planConversionMemory(int64_t budgetBytes, int inputWidth, int inputHeight, AVPixelFormat inputFormat, bool hasAudio);
+
+// Resident set size of the process now, 0 if unknown. Sampled during a job for its peak,
+// as the lifetime peak of the OS would repeat the largest earlier job
+int64_t currentResidentBytes();
+
+}
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,441 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "remap.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+extern "C" {
+#include <libavutil/common.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/pixdesc.h>
+}
+
+std::string AVP::canvasGraph(AVPSize size, int inputWidth, int inputHeight, bool scalePicture, AVRational frameRate)
+{
+    const AVPLayout &layout = getLayout(size);
+    char buffer[1024];
+    std::string graph;
+
+    /*
+     * Special note to this fix:
+     * Although most video tools will generate videos that has an even width/height, some of the videos (and most images) may have an odd width/height.
+     * The "pad" filter receives an odd size and automatically rounds down to an even number. If the rounded size is smaller than the size of the input image, the filter system will throw an exception.
+     * So it is necessary to pass parameters to the "pad" filter that accept even data with a larger size than the input content.
+     */
+    int padWidth = toUpperInt(inputWidth);
+    int padHeight = toUpperInt(inputHeight);
+    int padX = 0;
+    int padY = 0;
+    if(inputWidth == layout.width && inputHeight == layout.height)
+        scalePicture = false;
+
+    if(!scalePicture && inputHeight > 0)
+    {
+        if((inputWidth / inputHeight) < (layout.width / layout.height))
+        {
+            padWidth = toUpperInt(inputHeight * layout.padRatio());
+            padHeight = toUpperInt(inputHeight);
+            padX = toUpperInt(((inputHeight * layout.padRatio()) / 2) - (inputWidth / 2));
+        }
+        else if((inputWidth / inputHeight) > (layout.width / layout.height))
+        {
+            padWidth = toUpperInt(inputWidth);
+            padHeight = toUpperInt(inputWidth / layout.padRatio());
+            padY = toUpperInt(((inputWidth / layout.padRatio()) / 2) - (inputHeight / 2));
+        }
+    }
+
+    // Fit the picture and place it on the canvas
+    snprintf(buffer, sizeof(buffer), "[in]pad=%d:%d:%d:%d:black[expanded];", padWidth, padHeight, padX, padY);
+    graph += buffer;
+    if(layout.pictureWidth < layout.canvasWidth)
+        snprintf(buffer, sizeof(buffer), "[expanded]scale=%d:%d[scaled];[scaled]pad=%d:%d:%d:0:black", layout.pictureWidth, layout.height, layout.canvasWidth, layout.height, layout.pictureX);
+    else
+        snprintf(buffer, sizeof(buffer), "[expanded]scale=%d:%d", layout.canvasWidth, layout.height);
+    graph += buffer;
+
+    if(frameRate.num > 0 && frameRate.den > 0)
+    {
+        snprintf(buffer, sizeof(buffer), "[canvas];[canvas]fps=%d/%d[out]", frameRate.num, frameRate.den);
+        graph += buffer;
+    }
+    else
+        graph += "[out]";
+
+    return graph;
+}
+
+/*
+ * Special note to this optimization:
+ * For the built-in layouts every strip width, offset and row count is a template argument, so each memcpy has a constant size and the loops over regions and planes disappear.
+ * The rectangles are derived at compile time from kAVPBuiltinGeometry by the same rules as the generic tables, which stay in use for loaded layouts and other formats.
+ */
+struct FixedRect {
+    int srcX;
+    int srcY;
+    int width;
+    int height;
+    int dstX;
+    int dstY;
+};
+
+struct FixedRects {
+    FixedRect rects[AVP::kAVPBuiltinRegions];
+    int count;
+    int outputWidth;
+    int outputHeight;
+};
+
+static constexpr FixedRects fixedFoldRects(const AVP::AVPBuiltinGeometry &geometry)
+{
+    FixedRects result = {};
+    for(int i = 0; i < AVP::kAVPBuiltinRegions; i++)
+    {
+        const AVP::AVPRegion &region = geometry.regions[i];
+        result.rects[result.count++] = {region.srcX, region.srcY, region.width, region.height, region.dstX, region.dstY};
+    }
+    result.outputWidth = AVP::kAVPFrameWidth;
+    result.outputHeight = AVP::kAVPFrameHeight;
+    return result;
+}
+
+// Built-in regions are full height strips ordered by srcX, so the columns taken so far are [pictureX, coveredEnd)
+static constexpr FixedRects fixedUnfoldRects(const AVP::AVPBuiltinGeometry &geometry)
+{
+    FixedRects result = {};
+    int coveredEnd = geometry.pictureX;
+    for(int i = 0; i < AVP::kAVPBuiltinRegions; i++)
+    {
+        const AVP::AVPRegion &region = geometry.regions[i];
+        int begin = std::max(region.srcX, coveredEnd);
+        int end = std::min(region.srcX + region.width, geometry.pictureX + geometry.pictureWidth);
+        if(begin < end)
+        {
+            result.rects[result.count++] = {region.dstX + begin - region.srcX, region.dstY, end - begin, geometry.height, begin - geometry.pictureX, 0};
+            coveredEnd = end;
+        }
+    }
+    result.outputWidth = geometry.pictureWidth;
+    result.outputHeight = geometry.height;
+    return result;
+}
+
+static constexpr bool coversOutput(const FixedRects &rects)
+{
+    long long area = 0;
+    for(int i = 0; i < rects.count; i++)
+        area += (long long)rects.rects[i].width * rects.rects[i].height;
+    return area == (long long)rects.outputWidth * rects.outputHeight;
+}
+
+template<int kIndex, bool kFold>
+constexpr FixedRects kFixedRects = kFold ? fixedFoldRects(AVP::kAVPBuiltinGeometry[kIndex]) : fixedUnfoldRects(AVP::kAVPBuiltinGeometry[kIndex]);
+
+template<int kIndex, bool kFold>
+static constexpr FixedRect fixedRect(size_t i)
+{
+    return kFixedRects<kIndex, kFold>.rects[i];
+}
+
+template<int kSrcOffset, int kSrcY, int kDstOffset, int kDstY, int kBytes, int kRows>
+static inline void copyFixedPlane(const uint8_t *src, int srcLinesize, uint8_t *dst, int dstLinesize)
+{
+    src += (ptrdiff_t)kSrcY * srcLinesize + kSrcOffset;
+    dst += (ptrdiff_t)kDstY * dstLinesize + kDstOffset;
+    for(int i = 0; i < kRows; i++)
+    {
+        memcpy(dst, src, kBytes);
+        src += srcLinesize;
+        dst += dstLinesize;
+    }
+}
+
+// One rectangle of 8-bit planar YUV, chroma spans rounded as in RemapTable::compile
+template<int kSrcX, int kSrcY, int kWidth, int kHeight, int kDstX, int kDstY, int kShiftW, int kShiftH>
+static inline void copyFixedRect(const AVFrame *src, AVFrame *dst)
+{
+    constexpr int kChromaBytes = std::min(AV_CEIL_RSHIFT(kSrcX + kWidth, kShiftW) - (kSrcX >> kShiftW), AV_CEIL_RSHIFT(kDstX + kWidth, kShiftW) - (kDstX >> kShiftW));
+    constexpr int kChromaRows = std::min(AV_CEIL_RSHIFT(kSrcY + kHeight, kShiftH) - (kSrcY >> kShiftH), AV_CEIL_RSHIFT(kDstY + kHeight, kShiftH) - (kDstY >> kShiftH));
+
+    copyFixedPlane<kSrcX, kSrcY, kDstX, kDstY, kWidth, kHeight>(src->data[0], src->linesize[0], dst->data[0], dst->linesize[0]);
+    for(int plane = 1; plane < 3; plane++)
+        copyFixedPlane<(kSrcX >> kShiftW), (kSrcY >> kShiftH), (kDstX >> kShiftW), (kDstY >> kShiftH), kChromaBytes, kChromaRows>(src->data[plane], src->linesize[plane], dst->data[plane], dst->linesize[plane]);
+}
+
+template<int kIndex, bool kFold, int kShiftW, int kShiftH, size_t... I>
+static inline void copyFixedRects(const AVFrame *src, AVFrame *dst, std::index_sequence<I...>)
+{
+    (copyFixedRect<fixedRect<kIndex, kFold>(I).srcX, fixedRect<kIndex, kFold>(I).srcY, fixedRect<kIndex, kFold>(I).width, fixedRect<kIndex, kFold>(I).height,
+                   fixedRect<kIndex, kFold>(I).dstX, fixedRect<kIndex, kFold>(I).dstY, kShiftW, kShiftH>(src, dst), ...);
+}
+
+template<int kIndex, bool kFold, int kShiftW, int kShiftH>
+static void fixedRemapKernel(const AVFrame *src, AVFrame *dst)
+{
+    // Built-in layouts cover the whole output, so no black fill is needed
+    static_assert(coversOutput(kFixedRects<kIndex, kFold>), "built-in layout leaves part of the output uncovered");
+    copyFixedRects<kIndex, kFold, kShiftW, kShiftH>(src, dst, std::make_index_sequence<kFixedRects<kIndex, kFold>.count>());
+}
+
+typedef void (*RemapKernel)(const AVFrame *src, AVFrame *dst);
+
+// [layout][fold][4:2:2, 4:2:0]
+static const RemapKernel fixedRemapKernels[AVP::kAVPBuiltinLayouts][2][2] = {
+    {{fixedRemapKernel<0, false, 1, 0>, fixedRemapKernel<0, false, 1, 1>}, {fixedRemapKernel<0, true, 1, 0>, fixedRemapKernel<0, true, 1, 1>}},
+    {{fixedRemapKernel<1, false, 1, 0>, fixedRemapKernel<1, false, 1, 1>}, {fixedRemapKernel<1, true, 1, 0>, fixedRemapKernel<1, true, 1, 1>}},
+    {{fixedRemapKernel<2, false, 1, 0>, fixedRemapKernel<2, false, 1, 1>}, {fixedRemapKernel<2, true, 1, 0>, fixedRemapKernel<2, true, 1, 1>}}
+};
+
+static RemapKernel findFixedRemapKernel(const AVP::AVPLayout &layout, AVPixelFormat format, bool fold)
+{
+    int subsampling;
+    if(format == AV_PIX_FMT_YUV422P || format == AV_PIX_FMT_YUVJ422P)
+        subsampling = 0;
+    else if(format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P)
+        subsampling = 1;
+    else
+        return nullptr;
+    if(!AVP::hasBuiltinGeometry(layout, layout.size))
+        return nullptr;
+    return fixedRemapKernels[layout.size][fold ? 1 : 0][subsampling];
+}
+
+AVP::RemapTable AVP::RemapTable::compileFold(const AVPLayout &layout, AVPixelFormat format, bool specialised)
+{
+    RemapTable table;
+    std::vector<Rect> rects;
+    int64_t coveredArea = 0;
+
+    for(const AVPRegion &region : layout.regions)
+    {
+        rects.push_back({region.srcX, region.srcY, region.width, region.height, region.dstX, region.dstY});
+        coveredArea += (int64_t)region.width * region.height;
+    }
+
+    table.inputWidth = layout.canvasWidth;
+    table.inputHeight = layout.height;
+    table.outputWidth = kAVPFrameWidth;
+    table.outputHeight = kAVPFrameHeight;
+    // Regions do not overlap in the frame, so the frame is covered if the areas add up
+    table.fillBlack = coveredArea < (int64_t)kAVPFrameWidth * kAVPFrameHeight;
+    table.compile(rects, format);
+    if(specialised && table.isValid())
+        table.kernel = findFixedRemapKernel(layout, format, true);
+    return table;
+}
+
+AVP::RemapTable AVP::RemapTable::compileUnfold(const AVPLayout &layout, AVPixelFormat format, bool specialised)
+{
+    RemapTable table;
+    std::vector<Rect> rects;
+    int64_t coveredArea = 0;
+    const int pictureEnd = layout.pictureX + layout.pictureWidth;
+
+    // Rows between region edges are covered by the same regions
+    std::vector<int> edges = {0, layout.height};
+    for(const AVPRegion &region : layout.regions)
+    {
+        edges.push_back(region.srcY);
+        edges.push_back(region.srcY + region.height);
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    for(size_t i = 0; i + 1 < edges.size(); i++)
+    {
+        int y0 = edges[i];
+        int y1 = edges[i + 1];
+        // Canvas columns of this band already taken from an earlier region. Where projectors overlap, the first region wins.
+        std::vector<std::pair<int, int>> covered;
+
+        for(const AVPRegion &region : layout.regions)
+        {
+            if(region.srcY > y0 || region.srcY + region.height < y1)
+                continue;
+            int begin = std::max(region.srcX, layout.pictureX);
+            int end = std::min(region.srcX + region.width, pictureEnd);
+
+            int x = begin;
+            while(x < end)
+            {
+                bool skipped = false;
+                for(const std::pair<int, int> &span : covered)
+                {
+                    if(span.first <= x && x < span.second)
+                    {
+                        x = span.second;
+                        skipped = true;
+                        break;
+                    }
+                }
+                if(skipped)
+                    continue;
+
+                int pieceEnd = end;
+                for(const std::pair<int, int> &span : covered)
+                    if(span.first > x && span.first < pieceEnd)
+                        pieceEnd = span.first;
+                rects.push_back({region.dstX + x - region.srcX, region.dstY + y0 - region.srcY, pieceEnd - x, y1 - y0, x - layout.pictureX, y0});
+                coveredArea += (int64_t)(pieceEnd - x) * (y1 - y0);
+                x = pieceEnd;
+            }
+            if(begin < end)
+                covered.push_back({begin, end});
+        }
+    }
+
+    table.inputWidth = kAVPFrameWidth;
+    table.inputHeight = kAVPFrameHeight;
+    table.outputWidth = layout.pictureWidth;
+    table.outputHeight = layout.height;
+    table.fillBlack = coveredArea < (int64_t)layout.pictureWidth * layout.height;
+    table.compile(rects, format);
+    if(specialised && table.isValid())
+        table.kernel = findFixedRemapKernel(layout, format, false);
+    return table;
+}
+
+void AVP::RemapTable::compile(const std::vector<Rect> &rects, AVPixelFormat pixFmt)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(pixFmt);
+    if(!desc || (desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL)))
+        return;
+
+    // Bytes per pixel of each plane
+    int steps[4] = {0};
+    for(int i = 0; i < desc->nb_components; i++)
+        steps[desc->comp[i].plane] = std::max(steps[desc->comp[i].plane], desc->comp[i].step);
+
+    /*
+     * Special note to this optimization:
+     * Luma is copied at the exact region edges. Subsampled planes start at x >> log2_chroma_w, so with an odd edge (like pictureX 767 of the Medium layout) chroma is off by half a sample at most.
+     * The crop filter used before rounded the whole crop to an even x instead, shifting luma as well.
+     * Source and destination spans can differ by one chroma sample when their parity differs, the shorter one is copied.
+     */
+    copies.clear();
+    for(int plane = 0; plane < av_pix_fmt_count_planes(pixFmt); plane++)
+    {
+        int shiftW = (plane == 1 || plane == 2) ? desc->log2_chroma_w : 0;
+        int shiftH = (plane == 1 || plane == 2) ? desc->log2_chroma_h : 0;
+        for(const Rect &rect : rects)
+        {
+            Copy copy;
+            copy.plane = plane;
+            copy.srcOffset = (rect.srcX >> shiftW) * steps[plane];
+            copy.dstOffset = (rect.dstX >> shiftW) * steps[plane];
+            copy.bytes = std::min(AV_CEIL_RSHIFT(rect.srcX + rect.width, shiftW) - (rect.srcX >> shiftW),
+                                  AV_CEIL_RSHIFT(rect.dstX + rect.width, shiftW) - (rect.dstX >> shiftW)) * steps[plane];
+            copy.srcY = rect.srcY >> shiftH;
+            copy.dstY = rect.dstY >> shiftH;
+            copy.rows = std::min(AV_CEIL_RSHIFT(rect.srcY + rect.height, shiftH) - (rect.srcY >> shiftH),
+                                 AV_CEIL_RSHIFT(rect.dstY + rect.height, shiftH) - (rect.dstY >> shiftH));
+            copies.push_back(copy);
+        }
+    }
+    format = pixFmt;
+}
+
+int AVP::RemapTable::apply(const AVFrame *src, AVFrame *dst) const
+{
+    if(!isValid() || src->format != format || dst->format != format ||
+       src->width != inputWidth || src->height != inputHeight || dst->width != outputWidth || dst->height != outputHeight)
+        return AVERROR(EINVAL);
+
+    if(kernel)
+    {
+        kernel(src, dst);
+        return 0;
+    }
+
+    if(fillBlack)
+    {
+        ptrdiff_t linesizes[4];
+        for(int i = 0; i < 4; i++)
+            linesizes[i] = dst->linesize[i];
+        int avError = av_image_fill_black(dst->data, linesizes, format, (AVColorRange)dst->color_range, outputWidth, outputHeight);
+        if(avError < 0)
+            return avError;
+    }
+
+    for(const Copy &copy : copies)
+    {
+        const uint8_t *srcRow = src->data[copy.plane] + (ptrdiff_t)copy.srcY * src->linesize[copy.plane] + copy.srcOffset;
+        uint8_t *dstRow = dst->data[copy.plane] + (ptrdiff_t)copy.dstY * dst->linesize[copy.plane] + copy.dstOffset;
+        for(int i = 0; i < copy.rows; i++)
+        {
+            memcpy(dstRow, srcRow, copy.bytes);
+            srcRow += src->linesize[copy.plane];
+            dstRow += dst->linesize[copy.plane];
+        }
+    }
+    return 0;
+}
+
+std::string AVP::videoBufferArgs(int width, int height, int pixFmt, AVRational timeBase, AVRational sampleAspectRatio)
+{
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d", width, height, pixFmt, timeBase.num, timeBase.den, sampleAspectRatio.num, sampleAspectRatio.den);
+    return buffer;
+}
+
+int AVP::createVideoFilterGraph(AVFilterGraph *graph, const std::string &bufferArgs, const std::string &description, AVFilterContext **srcCxt, AVFilterContext **sinkCxt)
+{
+    int avError = 0;
+    AVFilterInOut *filterInput = NULL;
+    AVFilterInOut *filterOutput = NULL;
+
+    avError = avfilter_graph_create_filter(srcCxt, avfilter_get_by_name("buffer"), "in", bufferArgs.c_str(), 0, graph);
+    if(avError < 0)
+        return avError;
+    avError = avfilter_graph_create_filter(sinkCxt, avfilter_get_by_name("buffersink"), "out", 0, 0, graph);
+    if(avError < 0)
+        return avError;
+
+    filterInput = avfilter_inout_alloc();
+    filterOutput = avfilter_inout_alloc();
+    if(!filterInput || !filterOutput)
+    {
+        avError = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    filterInput -> name = av_strdup("in");
+    filterInput -> filter_ctx = *srcCxt;
+    filterInput -> pad_idx = 0;
+    filterInput -> next = NULL;
+
+    filterOutput -> name = av_strdup("out");
+    filterOutput -> filter_ctx = *sinkCxt;
+    filterOutput -> pad_idx = 0;
+    filterOutput -> next = NULL;
+
+    avError = avfilter_graph_parse_ptr(graph, description.c_str(), &filterOutput, &filterInput, 0);
+    if(avError < 0)
+        goto end;
+
+    avError = avfilter_graph_config(graph, 0);
+
+end:
+    avfilter_inout_free(&filterInput);
+    avfilter_inout_free(&filterOutput);
+    return avError;
+}
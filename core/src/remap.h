@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef REMAP_H
+#define REMAP_H
+
+#include "avplayout.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
+#include <libavfilter/avfilter.h>
+}
+
+#include <string>
+#include <vector>
+
+namespace AVP {
+
+/*
+ * Remap engine, first half: fits an input picture to the corridor and places it on the layout canvas (canvasWidth x height).
+ * Unless scalePicture is set, inputs whose aspect ratio differs from the corridor are padded with black instead of stretched.
+ * frameRate: output frame rate, or {0, 0} to keep the input timing (e.g. still images).
+ * The canvas is folded into the 3840 x 2160 MXL frame by RemapTable::compileFold.
+ */
+std::string canvasGraph(AVPSize size, int inputWidth, int inputHeight, bool scalePicture, AVRational frameRate);
+
+/*
+ * Copies between the layout canvas and the MXL frame, precomputed from the layout regions.
+ * A table is compiled once per job and pixel format. Applying it is a plain memcpy per row of each region and plane, no filter graph is involved.
+ * Built-in layouts in 8-bit planar YUV use kernels instantiated on their compile-time geometry instead, unless specialised is false.
+ */
+class RemapTable {
+public:
+    // Canvas to MXL frame
+    static RemapTable compileFold(const AVPLayout &layout, AVPixelFormat format, bool specialised = true);
+    // Unfold engine: MXL frame back to the pictureWidth x height corridor picture
+    static RemapTable compileUnfold(const AVPLayout &layout, AVPixelFormat format, bool specialised = true);
+
+    // False for formats that can not be copied by rows (bitstream, palette and hardware formats)
+    bool isValid() const { return format != AV_PIX_FMT_NONE; }
+    int getWidth() const { return outputWidth; }
+    int getHeight() const { return outputHeight; }
+    bool isSpecialised() const { return kernel != nullptr; }
+
+    // dst must be writable, in the compiled format and of the output size
+    int apply(const AVFrame *src, AVFrame *dst) const;
+
+private:
+    // Pixel rectangle copied from the source to the destination
+    struct Rect {
+        int srcX;
+        int srcY;
+        int width;
+        int height;
+        int dstX;
+        int dstY;
+    };
+    // Byte rectangle of one plane
+    struct Copy {
+        int plane;
+        int srcOffset;
+        int srcY;
+        int dstOffset;
+        int dstY;
+        int bytes;
+        int rows;
+    };
+
+    AVPixelFormat format = AV_PIX_FMT_NONE;
+    int inputWidth = 0;
+    int inputHeight = 0;
+    int outputWidth = 0;
+    int outputHeight = 0;
+    bool fillBlack = false;
+    std::vector<Copy> copies;
+    void (*kernel)(const AVFrame *src, AVFrame *dst) = nullptr;
+
+    void compile(const std::vector<Rect> &rects, AVPixelFormat pixFmt);
+};
+
+// Arguments of the "buffer" source for a video stream
+std::string videoBufferArgs(int width, int height, int pixFmt, AVRational timeBase, AVRational sampleAspectRatio);
+
+/*
+ * Creates the "in" buffer source and the "out" buffer sink, links them through description and configures the graph.
+ * Both contexts are owned by graph. Returns 0 or a negative AVERROR.
+ */
+int createVideoFilterGraph(AVFilterGraph *graph, const std::string &bufferArgs, const std::string &description, AVFilterContext **srcCxt, AVFilterContext **sinkCxt);
+
+}
+
+#endif // REMAP_H
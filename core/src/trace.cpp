@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    const char *name;
+    int64_t begin;
+    int64_t end;
+};
+
+struct ThreadBuffer {
+    int tid;
+    std::string name;
+    std::mutex mutex;       // Only contended while the trace is written
+    std::vector<TraceEvent> events;
+};
+
+std::mutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;
+std::string outputPath;
+int nextTid = 1;
+
+// Buffers are owned by the registry, so events of finished threads are kept
+thread_local ThreadBuffer *threadBuffer = nullptr;
+
+ThreadBuffer *getThreadBuffer()
+{
+    if(!threadBuffer)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registry.emplace_back(new ThreadBuffer);
+        threadBuffer = registry.back().get();
+        threadBuffer->tid = nextTid++;
+        threadBuffer->events.reserve(4096);
+    }
+    return threadBuffer;
+}
+
+void writeEscaped(FILE *file, const char *str)
+{
+    for(; *str; str++)
+    {
+        if(*str == '"' || *str == '\\')
+            fputc('\\', file);
+        if((unsigned char)*str >= 0x20)
+            fputc(*str, file);
+    }
+}
+
+}
+
+std::atomic<bool> AVP::Trace::enabled(false);
+
+void AVP::Trace::initFromEnvironment()
+{
+    const char *path = getenv("AVP_TRACE");
+    if(path && *path)
+        start(path);
+}
+
+void AVP::Trace::start(const char *path)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    outputPath = path;
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+bool AVP::Trace::stop()
+{
+    if(!enabled.exchange(false))
+        return false;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    FILE *file = fopen(outputPath.c_str(), "w");
+    if(!file)
+        return false;
+
+    bool first = true;
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+    for(const std::unique_ptr<ThreadBuffer> &buffer : registry)
+    {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        if(!buffer->name.empty())
+        {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", first ? "" : ",", buffer->tid);
+            writeEscaped(file, buffer->name.c_str());
+            fputs("\"}}", file);
+            first = false;
+        }
+        for(const TraceEvent &event : buffer->events)
+        {
+            fprintf(file, "%s\n{\"name\":\"", first ? "" : ",");
+            writeEscaped(file, event.name);
+            fprintf(file, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}", buffer->tid, (long long)event.begin, (long long)(event.end - event.begin));
+            first = false;
+        }
+        buffer->events.clear();
+    }
+    fputs("\n]}\n", file);
+    return fclose(file) == 0;
+}
+
+void AVP::Trace::setThreadName(const char *name)
+{
+    if(!isEnabled())
+        return;
+    ThreadBuffer *buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->name = name;
+}
+
+int64_t AVP::Trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t AVP::Trace::beginSpan()
+{
+    AllocStats::enterStage();
+    return now();
+}
+
+void AVP::Trace::endSpan(const char *name, int64_t beginTime)
+{
+    AllocStats::leaveStage(name);
+    if(isEnabled())
+        addSpan(name, beginTime, now());
+}
+
+void AVP::Trace::addSpan(const char *name, int64_t begin, int64_t end)
+{
+    ThreadBuffer *buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->events.push_back({name, begin, end});
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "allocstats.h"
+
+#include <atomic>
+#include <cstdint>
+
+namespace AVP {
+
+/*
+ * Timeline tracing of the conversion and playback pipelines.
+ * Spans are recorded into per-thread buffers and written as Chrome trace-event JSON, which can be opened in Perfetto or chrome://tracing.
+ * Enabled by the AVP_TRACE environment variable (or --trace on the command line) holding the output path.
+ * Spans are also the stages of AllocStats, so they are timed while either is enabled.
+ * When both are disabled, a span costs two relaxed atomic loads.
+ */
+class Trace {
+public:
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static bool isActive() { return isEnabled() || AllocStats::isEnabled(); }
+
+    // Start recording if AVP_TRACE is set
+    static void initFromEnvironment();
+    static void start(const char *outputPath);
+    // Write recorded events to the output path and stop recording
+    static bool stop();
+
+    // Name shown for the calling thread
+    static void setThreadName(const char *name);
+
+    static int64_t now();
+    // name must be a string literal or otherwise outlive the trace
+    static void addSpan(const char *name, int64_t begin, int64_t end);
+
+    // Manual spans, for code where a scope does not fit (e.g. across goto)
+    static int64_t begin() { return isActive() ? beginSpan() : -1; }
+    static void end(const char *name, int64_t beginTime)
+    {
+        if(beginTime >= 0)
+            endSpan(name, beginTime);
+    }
+
+private:
+    static int64_t beginSpan();
+    static void endSpan(const char *name, int64_t beginTime);
+
+    static std::atomic<bool> enabled;
+};
+
+// Records a span from construction to the end of the scope
+class TraceScope {
+public:
+    explicit TraceScope(const char *name)
+        : name(name)
+        , begin(Trace::begin())
+    {}
+    ~TraceScope() { Trace::end(name, begin); }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    int64_t begin;
+};
+
+}
+
+#define AVP_TRACE_CONCAT_INNER(a, b) a##b
+#define AVP_TRACE_CONCAT(a, b) AVP_TRACE_CONCAT_INNER(a, b)
+#define AVP_TRACE_SCOPE(name) AVP::TraceScope AVP_TRACE_CONCAT(avpTraceScope, __LINE__)(name)
+
+#endif // TRACE_H
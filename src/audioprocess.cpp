@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "audioprocess.h"
+
+#include "trace.h"
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+TAudioProcess::TAudioProcess(QObject *parent, AVCodecContext *decoderCxt, AVFormatContext *outputFmtCxt, AVRational inputTimeBase, float gain, bool dither, int maxQueuedPackets, int maxPooledFrames)
+    : QThread{parent}
+    , maxQueuedPackets(maxQueuedPackets > 0 ? maxQueuedPackets : kMaxQueuedPackets)
+    , packetPool(this->maxQueuedPackets + 2)
+    , floatFramePool(maxPooledFrames > 0 ? maxPooledFrames : kMaxPooledFrames)
+{
+    this->decoderCxt = decoderCxt;
+    this->outputFmtCxt = outputFmtCxt;
+    this->inputTimeBase = inputTimeBase;
+    this->gain = gain;
+    this->dither = dither;
+}
+
+TAudioProcess::~TAudioProcess()
+{
+    abort();
+    wait();
+
+    packetQueue.clear();
+}
+
+void TAudioProcess::pushPacket(AVPacket *packet)
+{
+    AVP::PooledPacket queued = packetPool.acquire();
+    av_packet_move_ref(queued.get(), packet);
+
+    queueMutex.lock();
+    while(packetQueue.size() >= maxQueuedPackets && !isAborted)
+        queueNotFull.wait(&queueMutex);
+    if(isAborted)
+    {
+        queueMutex.unlock();
+        return;
+    }
+    packetQueue.push_back(std::move(queued));
+    queueNotEmpty.wakeOne();
+    queueMutex.unlock();
+}
+
+void TAudioProcess::finish()
+{
+    queueMutex.lock();
+    isInputFinished = true;
+    queueNotEmpty.wakeAll();
+    queueMutex.unlock();
+}
+
+void TAudioProcess::abort()
+{
+    queueMutex.lock();
+    isAborted = true;
+    queueNotEmpty.wakeAll();
+    queueNotFull.wakeAll();
+    queueMutex.unlock();
+}
+
+int TAudioProcess::receiveFrames()
+{
+    AVFrame *frameReady = NULL;
+    int64_t traceTime = -1;
+
+    while(true)
+    {
+        traceTime = AVP::Trace::begin();
+        avError = avcodec_receive_frame(decoderCxt, frameIn.get());
+        AVP::Trace::end("audio decode", traceTime);
+        if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
+            return 0;
+        if(avError < 0)
+        {
+            avErrorMsg = tr("转换失败：音频解码出错。");
+            return avError;
+        }
+
+        if(frameIn->pkt_dts != AV_NOPTS_VALUE)
+            progressMs.store(av_rescale_q(frameIn->pkt_dts, inputTimeBase, {1, 1000}), std::memory_order_relaxed);
+
+        // Convert to planar float if needed
+        traceTime = AVP::Trace::begin();
+        frameReady = frameIn.get();
+        AVP::PooledFrame frameFloat;
+        if(resamplerCxt)
+        {
+            frameFloat = floatFramePool.acquireAudio(AV_SAMPLE_FMT_FLTP, &frameIn->ch_layout, frameIn->sample_rate, frameIn->nb_samples);
+            avError = swr_convert_frame(resamplerCxt.get(), frameFloat.get(), frameIn.get());
+            frameReady = frameFloat.get();
+        }
+
+        // Apply volume and pack to PCM S24LE
+        avError = AVP::reusePacket(packetOut.get(), frameReady->nb_samples * frameReady->ch_layout.nb_channels * 3);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("转换失败：内存不足。");
+            return avError;
+        }
+        AVP::packS24((const float * const *)frameReady->extended_data, frameReady->ch_layout.nb_channels, frameReady->nb_samples, gain, dither ? &ditherState : NULL, packetOut->data);
+        AVP::Trace::end("audio pack", traceTime);
+
+        // Make timestamp
+        packetOut -> pts = audioPTSCounter;
+        packetOut -> dts = audioPTSCounter;
+        packetOut -> duration = frameReady->nb_samples;
+        audioPTSCounter += frameReady->nb_samples;
+        av_packet_rescale_ts(packetOut.get(), {1, decoderCxt->sample_rate}, outputFmtCxt->streams[0]->time_base);
+
+        // Write
+        traceTime = AVP::Trace::begin();
+        avError = av_write_frame(outputFmtCxt, packetOut.get());
+        AVP::Trace::end("audio write", traceTime);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入音频输出文件失败：无法写入音频数据。");
+            return avError;
+        }
+
+        // Unref input frame. The output packet buffer is kept for the next frame.
+        av_frame_unref(frameIn.get());
+    }
+}
+
+void TAudioProcess::run()
+{
+    AVP::PooledPacket packet;
+    int64_t traceTime = -1;
+    bool wasAborted = false;    // isAborted as read under queueMutex, abort() sets it from other threads
+
+    AVP::Trace::setThreadName("TAudioProcess");
+
+    frameIn = AVP::makeFrame();
+    packetOut = AVP::makePacket();
+
+    /*
+     * Special note to this optimization:
+     * Gain, clamp, dither and 24-bit packing are done in one pass by AVP::packS24, writing straight into the output packet.
+     * Only sources not decoded as planar float need a resampler pass first.
+     */
+    if(decoderCxt->sample_fmt != AV_SAMPLE_FMT_FLTP)
+    {
+        avError = swr_alloc_set_opts2(resamplerCxt.out(), &decoderCxt->ch_layout, AV_SAMPLE_FMT_FLTP, decoderCxt->sample_rate, &decoderCxt->ch_layout, decoderCxt->sample_fmt, decoderCxt->sample_rate, 0, 0);
+        avError = swr_init(resamplerCxt.get());
+        if(avError < 0)
+        {
+            avErrorMsg = tr("转换失败：无法初始化音频重采样。");
+            goto end;
+        }
+    }
+
+    while(true)
+    {
+        // Wait for packets
+        traceTime = AVP::Trace::begin();
+        queueMutex.lock();
+        while(packetQueue.empty() && !isInputFinished && !isAborted)
+            queueNotEmpty.wait(&queueMutex);
+        if(isAborted || packetQueue.empty())
+        {
+            wasAborted = isAborted;
+            queueMutex.unlock();
+            break;
+        }
+        packet = std::move(packetQueue.front());
+        packetQueue.pop_front();
+        queueNotFull.wakeOne();
+        queueMutex.unlock();
+        AVP::Trace::end("audio wait", traceTime);
+
+        // Decode and convert
+        traceTime = AVP::Trace::begin();
+        avError = avcodec_send_packet(decoderCxt, packet.get());
+        AVP::Trace::end("audio decode", traceTime);
+        packet.reset();
+        if(receiveFrames() < 0)
+            goto end;
+    }
+
+    // Flush decoder
+    if(!wasAborted)
+    {
+        avError = avcodec_send_packet(decoderCxt, NULL);
+        if(receiveFrames() < 0)
+            goto end;
+    }
+
+    avError = 0;
+
+end:    // Jump flag for errors
+
+    // Unblock the demuxer if we stopped early
+    if(avError < 0)
+        abort();
+
+    frameIn.reset();
+    packetOut.reset();
+    resamplerCxt.reset();
+}
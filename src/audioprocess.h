@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef TAUDIOPROCESS_H
+#define TAUDIOPROCESS_H
+
+#include "audiopack.h"
+#include "avhandle.h"
+
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <deque>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
+}
+
+/*
+ * Audio conversion worker.
+ * Runs decode -> volume -> PCM S24LE on its own thread while the video is being encoded.
+ * Packets are fed by the demuxing thread through a bounded queue, so the input is read only once.
+ */
+class TAudioProcess : public QThread
+{
+    Q_OBJECT
+public:
+    // maxQueuedPackets, maxPooledFrames: 0 for the default depth
+    explicit TAudioProcess(QObject *parent = nullptr, AVCodecContext *decoderCxt = nullptr, AVFormatContext *outputFmtCxt = nullptr, AVRational inputTimeBase = {1, 1}, float gain = 1.0, bool dither = false, int maxQueuedPackets = 0, int maxPooledFrames = 0);
+    ~TAudioProcess();
+
+    // Takes over the packet reference. Blocks while the queue is full.
+    void pushPacket(AVPacket *packet);
+    // No more packets will come. The worker drains the queue and flushes the decoder.
+    void finish();
+    // Stop as soon as possible, dropping queued packets.
+    void abort();
+
+    int64_t getProgress() const {return progressMs.load(std::memory_order_relaxed);}
+    int getError() const {return avError;}
+    QString getErrorMsg() const {return avErrorMsg;}
+
+protected:
+    void run();
+
+private:
+    static const int kMaxQueuedPackets = 64;
+    static const int kMaxPooledFrames = 4;
+
+    size_t maxQueuedPackets = kMaxQueuedPackets;
+    AVCodecContext *decoderCxt = nullptr;
+    AVFormatContext *outputFmtCxt = nullptr;
+    AVRational inputTimeBase = {1, 1};
+    float gain = 1.0;
+    bool dither = false;
+
+    // Queued packets are recycled through the pool
+    AVP::PacketPool packetPool;
+    std::deque<AVP::PooledPacket> packetQueue;
+    QMutex queueMutex;
+    QWaitCondition queueNotEmpty;
+    QWaitCondition queueNotFull;
+    bool isInputFinished = false;
+    bool isAborted = false;
+
+    std::atomic<int64_t> progressMs{0};
+
+    int avError = 0;
+    QString avErrorMsg;
+
+    AVP::FramePtr frameIn;
+    AVP::FramePool floatFramePool;
+    AVP::PacketPtr packetOut;
+    AVP::SwrContextPtr resamplerCxt;
+    AVP::DitherState ditherState;
+    uint64_t audioPTSCounter = 0;
+
+    int receiveFrames();
+};
+
+#endif // TAUDIOPROCESS_H
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "commandline.h"
+
+#include "settings.h"
+#include "allocstats.h"
+#include "cpudispatch.h"
+#include "trace.h"
+#include "watchdaemon.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QTextStream>
+
+extern "C" {
+#include <libavutil/parseutils.h>
+}
+
+static QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+CommandLine::CommandLine(QObject *parent)
+    : QObject{parent}
+{}
+
+CommandLine::~CommandLine()
+{
+    if(doProcessThread)
+    {
+        doProcessThread->wait();
+        delete doProcessThread;
+    }
+}
+
+bool CommandLine::isCommandLineMode(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        QString arg = argv[i];
+        if(arg == "-i" || arg == "--input" || arg.startsWith("--input=") || arg == "--watch" || arg.startsWith("--watch=") || arg == "-h" || arg == "--help")
+            return true;
+    }
+    return false;
+}
+
+bool CommandLine::parse(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(tr("无界面转换模式。输入与输出均可使用 pipe: 地址（如 pipe:0 为标准输入，pipe:1 为标准输出）。"));
+    parser.addHelpOption();
+    QCommandLineOption inputOption(QStringList() << "i" << "input", tr("输入视频文件，或 pipe:0。"), "path");
+    QCommandLineOption outputDirOption(QStringList() << "o" << "output-dir", tr("输出目录。"), "dir", ".");
+    QCommandLineOption nameOption(QStringList() << "n" << "name", tr("输出文件名。默认为输入文件名。"), "name");
+    QCommandLineOption videoOutputOption("video-output", tr("视频输出位置，覆盖输出目录与文件名。如 pipe:1。"), "path");
+    QCommandLineOption audioOutputOption("audio-output", tr("音频输出位置，覆盖输出目录与文件名。如 pipe:3。"), "path");
+    QCommandLineOption sizeOption(QStringList() << "s" << "size", tr("AVP尺寸：small(5m)、medium(9m)、large(12m)或已载入的布局名称。"), "size", "medium");
+    QCommandLineOption bitRateOption("bitrate", tr("视频码率(Mbps)。"), "mbps", "20");
+    QCommandLineOption speedOption("speed", tr("编码速度：draft（草稿，最快，用于审片）、standard（标准）或best（最佳画质，用于最终交付）。"), "tier", "standard");
+    QCommandLineOption frameRateOption("framerate", tr("输出帧率，如24或24000/1001。"), "rate", "24");
+    QCommandLineOption colorOption("color", tr("色彩空间：bt470或bt709。"), "color", "bt709");
+    QCommandLineOption volumeOption("volume", tr("音量百分比。"), "percent", "100");
+    QCommandLineOption ditherOption("dither", tr("输出音频时加入抖动。"));
+    QCommandLineOption paddingOption("padding", tr("缩放画面并填充黑边。"));
+    QCommandLineOption noDolbyNamingOption("no-dolby-naming", tr("不使用杜比命名规则。"));
+    QCommandLineOption watchOption("watch", tr("监视目录并自动转换放入其中的文件。可多次指定。以上选项作为默认设置。"), "dir");
+    QCommandLineOption jobsOption("jobs", tr("监视模式下同时进行的转换数。"), "count", "1");
+    QCommandLineOption traceOption("trace", tr("将转换过程的时间线写入Chrome trace JSON文件，可用Perfetto打开。也可通过环境变量AVP_TRACE指定。"), "path");
+    QCommandLineOption cpuLevelOption("cpu-level", tr("强制使用的指令集：scalar、sse2、ssse3、avx2、avx512或neon，用于性能对比。也可通过环境变量AVP_CPU_LEVEL指定。"), "level");
+    QCommandLineOption memoryBudgetOption("memory-budget", tr("内存预算(MB)。将按预算减少解码线程与队列长度，以较慢的速度避免使用虚拟内存。"), "mb", "0");
+    QCommandLineOption allocStatsOption("alloc-stats", tr("统计各处理阶段每帧的内存分配次数与字节数，转换结束后输出。也可通过环境变量AVP_ALLOC_STATS=1启用。"));
+    parser.addOptions({inputOption, outputDirOption, nameOption, videoOutputOption, audioOutputOption, sizeOption, bitRateOption, speedOption, frameRateOption, colorOption, volumeOption, ditherOption, paddingOption, noDolbyNamingOption, watchOption, jobsOption, traceOption, cpuLevelOption, memoryBudgetOption, allocStatsOption});
+    parser.process(arguments);
+
+    if(parser.isSet(traceOption))
+        AVP::Trace::start(parser.value(traceOption).toLocal8Bit().constData());
+    if(parser.isSet(allocStatsOption))
+        AVP::AllocStats::start();
+
+    if(parser.isSet(cpuLevelOption) && !AVP::CpuDispatch::setLevel(parser.value(cpuLevelOption).toLatin1().constData()))
+    {
+        err() << tr("错误：未知或此CPU不支持的指令集。") << Qt::endl;
+        return false;
+    }
+
+    watchFolders = parser.values(watchOption);
+    maxJobs = parser.value(jobsOption).toInt();
+    if(watchFolders.isEmpty())
+    {
+        if(!parser.isSet(inputOption))
+        {
+            err() << tr("错误：没有指定输入文件。") << Qt::endl;
+            return false;
+        }
+        settings.inputVideoPath = parser.value(inputOption);
+        settings.inputVideoInfo.setFile(settings.inputVideoPath);
+        if(!AVP::isPipePath(settings.inputVideoPath) && !settings.inputVideoInfo.exists())
+        {
+            err() << tr("错误：输入文件不存在。") << Qt::endl;
+            return false;
+        }
+    }
+
+    if(!settings.setSizeFromString(parser.value(sizeOption)))
+    {
+        err() << tr("错误：未知的AVP尺寸。") << Qt::endl;
+        return false;
+    }
+
+    if(av_parse_video_rate(&settings.outputFrameRate, parser.value(frameRateOption).toUtf8()) < 0)
+    {
+        err() << tr("错误：无效的帧率。") << Qt::endl;
+        return false;
+    }
+
+    if(!settings.setColorFromString(parser.value(colorOption)))
+    {
+        err() << tr("错误：未知的色彩空间。") << Qt::endl;
+        return false;
+    }
+
+    if(!settings.setEncoderSpeedFromString(parser.value(speedOption)))
+    {
+        err() << tr("错误：未知的编码速度。") << Qt::endl;
+        return false;
+    }
+
+    settings.outputVideoBitRate = parser.value(bitRateOption).toDouble();
+    settings.outputVolume = parser.value(volumeOption).toInt();
+    settings.outputAudioDither = parser.isSet(ditherOption);
+    settings.scalePicture = parser.isSet(paddingOption);
+    settings.memoryBudgetMB = qMax(0, parser.value(memoryBudgetOption).toInt());
+    settings.useDolbyNaming = !parser.isSet(noDolbyNamingOption);
+
+    settings.outputFilePath = parser.value(outputDirOption);
+    if(parser.isSet(nameOption))
+        settings.outputFileName = parser.value(nameOption);
+    else if(AVP::isPipePath(settings.inputVideoPath))
+        settings.outputFileName = "AVPStudio";
+    else
+        settings.outputFileName = settings.inputVideoInfo.completeBaseName();
+    settings.outputVideoPathOverride = parser.value(videoOutputOption);
+    settings.outputAudioPathOverride = parser.value(audioOutputOption);
+
+    return true;
+}
+
+bool CommandLine::start()
+{
+    // Daemon mode runs until killed
+    if(!watchFolders.isEmpty())
+    {
+        watchDaemon = new WatchDaemon(this, watchFolders, maxJobs, settings);
+        return watchDaemon->start();
+    }
+
+    doProcessThread = new TDoProcess(nullptr);
+
+    connect(doProcessThread, SIGNAL(setProgressMax(int64_t)), this, SLOT(do_setProgressMax(int64_t)));
+    connect(doProcessThread, SIGNAL(setProgress(int64_t)), this, SLOT(do_setProgress(int64_t)));
+    connect(doProcessThread, SIGNAL(setLabel(QString)), this, SLOT(do_setLabel(QString)));
+    connect(doProcessThread, SIGNAL(completed(bool,QString)), this, SLOT(do_completed(bool,QString)));
+
+    doProcessThread->start();
+    return true;
+}
+
+void CommandLine::do_setProgressMax(int64_t num)
+{
+    progressMax = num;
+    lastPercent = -1;
+}
+
+void CommandLine::do_setProgress(int64_t num)
+{
+    // Length of piped input is unknown, so only the converted time can be shown
+    if(progressMax <= 0)
+    {
+        int seconds = num / 1000;
+        if(seconds == lastPercent)
+            return;
+        lastPercent = seconds;
+        err() << "\r" << label << " " << QString("%1:%2").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0')) << Qt::flush;
+        return;
+    }
+
+    int percent = num * 100 / progressMax;
+    if(percent == lastPercent)
+        return;
+    lastPercent = percent;
+    err() << "\r" << label << " " << percent << "%" << Qt::flush;
+}
+
+void CommandLine::do_setLabel(QString str)
+{
+    if(label != "")
+        err() << Qt::endl;
+    label = str;
+    err() << label << Qt::flush;
+}
+
+void CommandLine::do_completed(bool isError, QString errorStr)
+{
+    err() << Qt::endl;
+    if(isError)
+        err() << tr("转换失败：") << errorStr << Qt::endl;
+    else
+        err() << tr("转换完成。") << Qt::endl;
+    if(settings.memoryBudgetMB > 0)
+    {
+        const AVP::MemoryPlan &plan = doProcessThread->getMemoryPlan();
+        err() << tr("内存：预计峰值") << (plan.predictedPeakBytes >> 20) << tr(" MB，实际峰值") << (doProcessThread->getPeakResidentBytes() >> 20) << " MB" << Qt::endl;
+        if(!plan.fitsBudget)
+            err() << tr("警告：即使使用最少的资源，预计内存用量也超出预算。") << Qt::endl;
+    }
+    if(!doProcessThread->getAllocReport().isEmpty())
+        err() << tr("内存分配统计：") << Qt::endl << doProcessThread->getAllocReport() << Qt::flush;
+    QCoreApplication::exit(isError ? 1 : 0);
+}
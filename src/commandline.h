@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#include "doprocess.h"
+#include "watchdaemon.h"
+
+#include <QObject>
+#include <QStringList>
+
+/*
+ * Headless conversion driven by command line arguments.
+ * Input and outputs accept FFmpeg "pipe:" URLs, so the conversion can sit in the middle of a pipeline:
+ *     ffmpeg -i master.mov -f nut - | AVPStudio -i pipe:0 --video-output pipe:1 --audio-output pipe:3 3>audio.wav | ...
+ * Progress and errors are written to stderr, leaving stdout free for the video stream.
+ * With --watch, runs as a daemon converting files dropped into the given folders instead (see WatchDaemon).
+ */
+class CommandLine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit CommandLine(QObject *parent = nullptr);
+    ~CommandLine();
+
+    static bool isCommandLineMode(int argc, char *argv[]);
+
+    bool parse(const QStringList &arguments);
+    bool start();
+
+private:
+    TDoProcess *doProcessThread = nullptr;
+    WatchDaemon *watchDaemon = nullptr;
+    QStringList watchFolders;
+    int maxJobs = 1;
+    QString label;
+    int64_t progressMax = 0;
+    int lastPercent = -1;
+
+private slots:
+    void do_setProgressMax(int64_t num);
+    void do_setProgress(int64_t num);
+    void do_setLabel(QString str);
+    void do_completed(bool isError, QString errorStr);
+};
+
+#endif // COMMANDLINE_H
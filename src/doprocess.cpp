@@ -26,7 +26,14 @@
 
 #include "doprocess.h"
 
+#include "allocstats.h"
+#include "audioprocess.h"
+#include "avhandle.h"
+#include "codecsetup.h"
+#include "exportmanifest.h"
+#include "remap.h"
 #include "settings.h"
+#include "trace.h"
 
 #define __STDC_CONSTANT_MACROS
 #define __STDC_FORMAT_MACROS
@@ -43,43 +50,23 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
-// FFmpeg filter graph description
-static const char *filterGraphLarge =
-    "[in]pad=iw:ih:0:0:black[expanded];"
-    "[expanded]scale=6166:1080[scaled];"
-    "[scaled]split[scaled1][scaled2];"
-    "[scaled1]crop=3840:1080:0:0[left];"
-    "[scaled2]crop=3840:1080:2327:0[right];"
-    "[left][right]vstack=2[ready];"
-    "[ready]fps=24[out]";
-static const char *filterGraphMedium =
-    "[in]pad=iw:ih:0:0:black[expanded];"
-    "[expanded]scale=4632:1080[scaled];"
-    "[scaled]pad=6166:1080:767:0:black[padded];"
-    "[padded]split[padded1][padded2];"
-    "[padded1]crop=3840:1080:0:0[left];"
-    "[padded2]crop=3840:1080:2327:0[right];"
-    "[left][right]vstack=2[ready];"
-    "[ready]fps=24[out]";
-static const char *filterGraphSmall =
-    "[in]pad=iw:ih:0:0:black[expanded];"
-    "[expanded]scale=2830:1080[scaled];"
-    "[scaled]pad=6166:1080:1668:0:black[padded];"
-    "[padded]split[padded1][padded2];"
-    "[padded1]crop=3840:1080:0:0[left];"
-    "[padded2]crop=3840:1080:2327:0[right];"
-    "[left][right]vstack=2[ready];"
-    "[ready]fps=24[out]";
-
-template<typename T> int toUpperInt(T val)
+TDoProcess::TDoProcess(QObject *parent, const AVP::AVPSettings &jobSettings)
+    : jobSettings(jobSettings)
+{}
+
+TDoProcess::~TDoProcess()
 {
-    if((int)val % 2 == 1)
-        return (int)val + 1;
-    else
-        return (int)val;
+    // In case the thread was terminated while the audio worker was running
+    delete audioProcess;
 }
 
-TDoProcess::TDoProcess(QObject *parent) {}
+void TDoProcess::sampleResidentBytes(bool force)
+{
+    if(!force && residentSampleTimer.isValid() && residentSampleTimer.elapsed() < kResidentSampleMs)
+        return;
+    residentSampleTimer.start();
+    peakResidentBytes = qMax(peakResidentBytes, AVP::currentResidentBytes());
+}
 
 void TDoProcess::run()
 {
@@ -87,7 +74,7 @@ void TDoProcess::run()
     av_log_set_level(AV_LOG_QUIET);
 
     // Init variables
-    static int avError = 0;
+    int avError = 0;
     QString avErrorMsg;
 
     AVFormatContext *iVideoFmtCxt = NULL;
@@ -100,8 +87,6 @@ void TDoProcess::run()
     AVCodecContext *iVideoDecoderCxt = NULL;
     AVCodecContext *iAudioDecoderCxt = NULL;
 
-    const AVCodec *oVideoEncoder = NULL;
-    const AVCodec *oAudioEncoder = NULL;
     AVCodecContext *oVideoEncoderCxt = NULL;
     AVCodecContext *oAudioEncoderCxt = NULL;
 
@@ -113,47 +98,42 @@ void TDoProcess::run()
 
     AVPacket *packet = NULL;
 
-    char filterArgs[512] = {0};
-
     AVFrame *vFrameIn = NULL;
     AVFrame *vFrameFiltered = NULL;
-    AVFrame *vFrameOut = NULL;
+    AVP::FramePool vCanvasPool;
+    AVP::FramePool vFrameOutPool;
 
     AVFilterGraph *videoFilterGraph = NULL;
-    AVFilterInOut *videoFilterInput = NULL;
-    AVFilterInOut *videoFilterOutput = NULL;
-
-    AVFilterContext *videoFilterPadCxt = NULL;
-    AVFilterContext *videoFilterFpsCxt = NULL;
-
-    const AVFilter *videoFilterSrc = NULL;
     AVFilterContext *videoFilterSrcCxt = NULL;
-    const AVFilter *videoFilterSink = NULL;
     AVFilterContext *videoFilterSinkCxt = NULL;
 
     SwsContext *scale422Cxt = NULL;
 
-    AVFrame *aFrameIn = NULL;
-    AVFrame *aFrameFiltered = NULL;
-    AVFrame *aFrameOut = NULL;
+    const AVP::AVPLayout &layout = AVP::getLayout(jobSettings.size);
+    AVP::RemapTable foldTable;
 
-    AVFilterGraph *volumeFilterGraph = NULL;
+    QString oVideoPath = jobSettings.getOutputVideoFullPath();
+    QString oAudioPath = jobSettings.getOutputAudioFullPath();
 
-    const AVFilter *volumeFilter = NULL;
-    AVFilterContext *volumeFilterCxt = NULL;
+    QJsonObject videoFingerprint;
+    QJsonObject audioFingerprint;
+    bool needVideo = true;
+    bool needAudio = false;
 
-    const AVFilter *volumeFilterSrc = NULL;
-    AVFilterContext *volumeFilterSrcCxt = NULL;
-    const AVFilter *volumeFilterSink = NULL;
-    AVFilterContext *volumeFilterSinkCxt = NULL;
+    int64_t videoDurationMs = 0;
+    int64_t audioDurationMs = 0;
+    int64_t videoProgressMs = 0;
 
-    SwrContext *resamplerCxt = NULL;
+    int64_t traceTime = -1;
 
-    uint64_t audioPTSCounter = 0;
+    AVP::AllocSnapshot allocBegin = AVP::AllocStats::snapshot();
+    int64_t videoFrames = 0;
+
+    AVP::Trace::setThreadName("TDoProcess");
 
     // Open input file and find stream info
     iVideoFmtCxt = avformat_alloc_context();
-    avError = avformat_open_input(&iVideoFmtCxt, settings.inputVideoPath.toUtf8(), 0, 0);
+    avError = avformat_open_input(&iVideoFmtCxt, jobSettings.inputVideoPath.toUtf8(), 0, 0);
     if(avError < 0)
     {
         avErrorMsg = tr("加载输入文件失败：打开视频文件出错。");
@@ -175,31 +155,42 @@ void TDoProcess::run()
     }
     iAudioStreamID = av_find_best_stream(iVideoFmtCxt, AVMEDIA_TYPE_AUDIO, -1, -1, &iAudioDecoder, 0);
 
-    // Open decoder
-    iVideoDecoderCxt = avcodec_alloc_context3(iVideoDecoder);
-    avError = avcodec_parameters_to_context(iVideoDecoderCxt, iVideoFmtCxt->streams[iVideoStreamID]->codecpar);
-    if(avError < 0)
-    {
-        avErrorMsg = tr("加载输入文件失败：没有对应的视频解码器。");
-        goto end;
-    }
-    avError = avcodec_open2(iVideoDecoderCxt, iVideoDecoder, 0);
-    if(avError < 0)
+    // Only regenerate outputs whose inputs or settings changed since the last export
+    videoFingerprint = AVP::ExportManifest::videoFingerprint(jobSettings);
+    audioFingerprint = AVP::ExportManifest::audioFingerprint(jobSettings);
+    needVideo = !AVP::ExportManifest::isUpToDate(oVideoPath, videoFingerprint);
+    needAudio = iAudioStreamID != AVERROR_STREAM_NOT_FOUND && !AVP::ExportManifest::isUpToDate(oAudioPath, audioFingerprint);
+    if(!needVideo && !needAudio)
     {
-        avErrorMsg = tr("加载输入文件失败：无法打开视频解码器。");
+        avError = 0;
         goto end;
     }
 
-    if(iAudioStreamID != AVERROR_STREAM_NOT_FOUND)
+    // Size the audio queue and the frame pools to the memory budget
+    memoryPlan = AVP::planConversionMemory((int64_t)jobSettings.memoryBudgetMB << 20,
+                                           iVideoFmtCxt->streams[iVideoStreamID]->codecpar->width,
+                                           iVideoFmtCxt->streams[iVideoStreamID]->codecpar->height,
+                                           (AVPixelFormat)iVideoFmtCxt->streams[iVideoStreamID]->codecpar->format,
+                                           needAudio);
+    if(memoryPlan.canvasPoolFrames > 0)
+        vCanvasPool.setCapacity(memoryPlan.canvasPoolFrames);
+    if(memoryPlan.outputPoolFrames > 0)
+        vFrameOutPool.setCapacity(memoryPlan.outputPoolFrames);
+
+    // Open decoder
+    if(needVideo)
     {
-        iAudioDecoderCxt = avcodec_alloc_context3(iAudioDecoder);
-        avError = avcodec_parameters_to_context(iAudioDecoderCxt, iVideoFmtCxt->streams[iAudioStreamID]->codecpar);
+        avError = AVP::openDecoder(iVideoFmtCxt->streams[iVideoStreamID], iVideoDecoder, &iVideoDecoderCxt);
         if(avError < 0)
         {
-            avErrorMsg = tr("加载输入文件失败：没有对应的音频解码器。");
+            avErrorMsg = tr("加载输入文件失败：无法打开视频解码器。");
             goto end;
         }
-        avError = avcodec_open2(iAudioDecoderCxt, iAudioDecoder, 0);
+    }
+
+    if(needAudio)
+    {
+        avError = AVP::openDecoder(iVideoFmtCxt->streams[iAudioStreamID], iAudioDecoder, &iAudioDecoderCxt);
         if(avError < 0)
         {
             avErrorMsg = tr("加载输入文件失败：无法打开音频解码器。");
@@ -208,54 +199,49 @@ void TDoProcess::run()
     }
 
     // Init encoder
-    oVideoEncoder = avcodec_find_encoder(AV_CODEC_ID_MPEG2VIDEO);
-    oVideoEncoderCxt = avcodec_alloc_context3(oVideoEncoder);
-    oVideoEncoderCxt -> time_base = av_inv_q(settings.outputFrameRate);
-    oVideoEncoderCxt -> width = 3840;
-    oVideoEncoderCxt -> height = 2160;
-    oVideoEncoderCxt -> bit_rate = settings.outputVideoBitRate * 1000000;
-    oVideoEncoderCxt -> rc_max_rate = oVideoEncoderCxt->bit_rate;
-    oVideoEncoderCxt -> rc_min_rate = oVideoEncoderCxt->bit_rate;
-    oVideoEncoderCxt -> rc_buffer_size = oVideoEncoderCxt->bit_rate / 2;
-    oVideoEncoderCxt -> bit_rate_tolerance = 0;
-    oVideoEncoderCxt -> pix_fmt = AV_PIX_FMT_YUV422P;
-    oVideoEncoderCxt -> color_primaries = settings.outputColor.outputColorPrimary;
-    oVideoEncoderCxt -> colorspace = settings.outputColor.outputVideoColorSpace;
-    oVideoEncoderCxt -> color_trc = settings.outputColor.outputVideoColorTrac;
-    oVideoEncoderCxt -> profile = 0;
-    oVideoEncoderCxt -> max_b_frames = 0;
-    oVideoEncoderCxt -> framerate = settings.outputFrameRate;
-
-    if(iAudioStreamID != AVERROR_STREAM_NOT_FOUND)
+    if(needVideo)
     {
-        oAudioEncoder = avcodec_find_encoder(AV_CODEC_ID_PCM_S24LE);
-        oAudioEncoderCxt = avcodec_alloc_context3(oAudioEncoder);
-        oAudioEncoderCxt -> time_base = {1, iAudioDecoderCxt->sample_rate};
-        oAudioEncoderCxt -> ch_layout = iAudioDecoderCxt->ch_layout;
-        oAudioEncoderCxt -> sample_fmt = AV_SAMPLE_FMT_S32;
-        oAudioEncoderCxt -> sample_rate = iAudioDecoderCxt->sample_rate;
+        avError = AVP::setupMxlVideoEncoder(&oVideoEncoderCxt, jobSettings.outputVideoBitRate, jobSettings.outputFrameRate, jobSettings.outputColor.outputColorPrimary, jobSettings.outputColor.outputVideoColorTrac, jobSettings.outputColor.outputVideoColorSpace, jobSettings.outputEncoderSpeed);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入视频输出文件失败：无法打开视频编码器。");
+            goto end;
+        }
     }
 
-    // Create output format and stream
-    avError = avformat_alloc_output_context2(&oVideoFmtCxt, av_guess_format("mpeg2video", 0, 0), 0, QString(settings.outputFilePath + "/" + settings.getOutputVideoFinalName()).toUtf8());
-    if(avError < 0)
+    if(needAudio)
     {
-        avErrorMsg = tr("写入视频输出文件失败：无法创建输出上下文。");
-        goto end;
+        avError = AVP::setupWavAudioEncoder(&oAudioEncoderCxt, &iAudioDecoderCxt->ch_layout, iAudioDecoderCxt->sample_rate);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入音频输出文件失败：无法打开音频编码器。");
+            goto end;
+        }
     }
-    oVideoStream = avformat_new_stream(oVideoFmtCxt, 0);
-    avError = avcodec_parameters_from_context(oVideoStream->codecpar, oVideoEncoderCxt);
-    if(avError < 0)
+
+    // Create output format and stream
+    if(needVideo)
     {
-        avErrorMsg = tr("写入视频输出文件失败：无法解析输出上下文。");
-        goto end;
+        avError = avformat_alloc_output_context2(&oVideoFmtCxt, av_guess_format("mpeg2video", 0, 0), 0, oVideoPath.toUtf8());
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入视频输出文件失败：无法创建输出上下文。");
+            goto end;
+        }
+        oVideoStream = avformat_new_stream(oVideoFmtCxt, 0);
+        avError = avcodec_parameters_from_context(oVideoStream->codecpar, oVideoEncoderCxt);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入视频输出文件失败：无法解析输出上下文。");
+            goto end;
+        }
+        oVideoStream -> time_base = oVideoEncoderCxt->time_base;
+        oVideoStream -> r_frame_rate = jobSettings.outputFrameRate;
     }
-    oVideoStream -> time_base = oVideoEncoderCxt->time_base;
-    oVideoStream -> r_frame_rate = settings.outputFrameRate;
 
-    if(iAudioStreamID != AVERROR_STREAM_NOT_FOUND)
+    if(needAudio)
     {
-        avError = avformat_alloc_output_context2(&oAudioFmtCxt, 0, 0, QString(settings.outputFilePath + "/" + settings.getOutputAudioFinalName()).toUtf8());
+        avError = avformat_alloc_output_context2(&oAudioFmtCxt, av_guess_format("wav", 0, 0), 0, oAudioPath.toUtf8());
         if(avError < 0)
         {
             avErrorMsg = tr("写入音频输出文件失败：无法创建输出上下文。");
@@ -272,34 +258,39 @@ void TDoProcess::run()
     }
 
     // Open encoder/file and write file headers
-    avError = avcodec_open2(oVideoEncoderCxt, oVideoEncoder, 0);
-    if(avError < 0)
-    {
-        avErrorMsg = tr("写入视频输出文件失败：无法打开视频编码器。");
-        goto end;
-    }
-    avError = avio_open(&oVideoFmtCxt->pb, QString(settings.outputFilePath + "/" + settings.getOutputVideoFinalName()).toUtf8(), AVIO_FLAG_WRITE);
-    if(avError < 0)
-    {
-        avErrorMsg = tr("写入视频输出文件失败：无法打开视频输出I/O。");
-        goto end;
-    }
-    avError = avformat_write_header(oVideoFmtCxt, 0);
-    if(avError < 0)
+    if(needVideo)
     {
-        avErrorMsg = tr("写入视频输出文件失败：无法写入文件头。");
-        goto end;
+        avError = avcodec_open2(oVideoEncoderCxt, oVideoEncoderCxt->codec, 0);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入视频输出文件失败：无法打开视频编码器。");
+            goto end;
+        }
+        AVP::ExportManifest::forget(oVideoPath);
+        avError = avio_open(&oVideoFmtCxt->pb, oVideoPath.toUtf8(), AVIO_FLAG_WRITE);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入视频输出文件失败：无法打开视频输出I/O。");
+            goto end;
+        }
+        avError = avformat_write_header(oVideoFmtCxt, 0);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入视频输出文件失败：无法写入文件头。");
+            goto end;
+        }
     }
 
-    if(iAudioStreamID != AVERROR_STREAM_NOT_FOUND)
+    if(needAudio)
     {
-        avError = avcodec_open2(oAudioEncoderCxt, oAudioEncoder, 0);
+        avError = avcodec_open2(oAudioEncoderCxt, oAudioEncoderCxt->codec, 0);
         if(avError < 0)
         {
             avErrorMsg = tr("写入音频输出文件失败：无法打开音频编码器。");
             goto end;
         }
-        avError = avio_open(&oAudioFmtCxt->pb, QString(settings.outputFilePath + "/" + settings.getOutputAudioFinalName()).toUtf8(), AVIO_FLAG_WRITE);
+        AVP::ExportManifest::forget(oAudioPath);
+        avError = avio_open(&oAudioFmtCxt->pb, oAudioPath.toUtf8(), AVIO_FLAG_WRITE);
         if(avError < 0)
         {
             avErrorMsg = tr("写入音频输出文件失败：无法打开音频输出I/O。");
@@ -316,268 +307,165 @@ void TDoProcess::run()
     // Begin conversion
     packet = av_packet_alloc();
 
-    // Convert video
     vFrameIn = av_frame_alloc();
     vFrameFiltered = av_frame_alloc();
-    vFrameOut = av_frame_alloc();
-
-    emit setLabel(tr("转换视频中...") + settings.getOutputVideoFinalName());
-    emit setProgressMax(iVideoFmtCxt->streams[iVideoStreamID]->duration * av_q2d(iVideoFmtCxt->streams[iVideoStreamID]->time_base));
-
-    // Set video filter
-    videoFilterGraph = avfilter_graph_alloc();
-
-    videoFilterSrc = avfilter_get_by_name("buffer");
-    char videoFilterSrcArgs[512];
-    snprintf(videoFilterSrcArgs, sizeof(videoFilterSrcArgs), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d", iVideoDecoderCxt->width, iVideoDecoderCxt->height, iVideoDecoderCxt->pix_fmt, iVideoFmtCxt->streams[iVideoStreamID]->time_base.num, iVideoFmtCxt->streams[iVideoStreamID]->time_base.den, iVideoDecoderCxt->sample_aspect_ratio.num, iVideoDecoderCxt->sample_aspect_ratio.den);
-    avError = avfilter_graph_create_filter(&videoFilterSrcCxt, videoFilterSrc, "in", videoFilterSrcArgs, 0, videoFilterGraph);
-
-    videoFilterSink = avfilter_get_by_name("buffersink");
-    avError = avfilter_graph_create_filter(&videoFilterSinkCxt, videoFilterSink, "out", 0, 0, videoFilterGraph);
-
-    videoFilterInput = avfilter_inout_alloc();
-    videoFilterInput -> name = av_strdup("in");
-    videoFilterInput -> filter_ctx = videoFilterSrcCxt;
-    videoFilterInput -> pad_idx = 0;
-    videoFilterInput -> next = NULL;
-
-    videoFilterOutput = avfilter_inout_alloc();
-    videoFilterOutput -> name = av_strdup("out");
-    videoFilterOutput -> filter_ctx = videoFilterSinkCxt;
-    videoFilterOutput -> pad_idx = 0;
-    videoFilterOutput -> next = NULL;
-
-    switch(settings.size)
-    {
-    case AVP::kAVPLargeSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphLarge, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    case AVP::kAVPMediumSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphMedium, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    case AVP::kAVPSmallSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphSmall, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    }
-
-    videoFilterPadCxt = avfilter_graph_get_filter(videoFilterGraph, "Parsed_pad_0");
 
     /*
-     * Special note to this fix:
-     * Although most video tools will generate videos that has an even width/height, some of the videos may have an odd width/height.
-     * The "pad" filter receives an odd size and automatically rounds down to an even number. If the rounded size is smaller than the size of the input image, the filter system will throw an exception.
-     * So it is necessary to manually adjust the parameters of the incoming "pad" filter to accept even data with a larger size than the input content.
+     * Special note to this optimization:
+     * Audio is converted by TAudioProcess on its own thread while the video is being encoded.
+     * The demuxer below hands audio packets over to it, so the input is read only once and the wall-clock time is roughly max(video, audio).
+     * Progress of both streams is tracked in milliseconds and combined into one progress bar.
      */
-    avError = av_opt_set(videoFilterPadCxt, "width", QString::number(toUpperInt(iVideoDecoderCxt->width)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-    avError = av_opt_set(videoFilterPadCxt, "height", QString::number(toUpperInt(iVideoDecoderCxt->height)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-    if(iVideoDecoderCxt->width == settings.getWidth() && iVideoDecoderCxt->height == 1080)
-        settings.scalePicture = false;
+    if(needVideo && iVideoFmtCxt->streams[iVideoStreamID]->duration != AV_NOPTS_VALUE)
+        videoDurationMs = av_rescale_q(iVideoFmtCxt->streams[iVideoStreamID]->duration, iVideoFmtCxt->streams[iVideoStreamID]->time_base, {1, 1000});
+    if(needAudio)
+    {
+        if(iVideoFmtCxt->streams[iAudioStreamID]->duration != AV_NOPTS_VALUE)
+            audioDurationMs = av_rescale_q(iVideoFmtCxt->streams[iAudioStreamID]->duration, iVideoFmtCxt->streams[iAudioStreamID]->time_base, {1, 1000});
+        audioProcess = new TAudioProcess(nullptr, iAudioDecoderCxt, oAudioFmtCxt, iVideoFmtCxt->streams[iAudioStreamID]->time_base, jobSettings.outputVolume / 100.0, jobSettings.outputAudioDither, memoryPlan.audioQueuePackets, memoryPlan.audioPoolFrames);
+        audioProcess->start();
+    }
+    if(needVideo && needAudio)
+        emit setLabel(tr("转换视频与音频中...") + QFileInfo(oVideoPath).fileName());
+    else if(needVideo)
+        emit setLabel(tr("转换视频中...") + QFileInfo(oVideoPath).fileName());
+    else
+        emit setLabel(tr("视频未改变。转换音频中...") + QFileInfo(oAudioPath).fileName());
+    emit setProgressMax(videoDurationMs + audioDurationMs);
 
-    if(!settings.scalePicture)
+    if(needVideo)
     {
-        if((iVideoDecoderCxt->width / iVideoDecoderCxt->height) < (settings.getWidth() / 1080))
-        {
-            switch(settings.size)
-            {
-            case AVP::kAVPLargeSize:
-                avError = av_opt_set(videoFilterPadCxt, "width", QString::number(toUpperInt(iVideoDecoderCxt->height * 5.71)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "height", QString::number(toUpperInt(iVideoDecoderCxt->height)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "x", QString::number(toUpperInt(((iVideoDecoderCxt->height * 5.71) / 2) - (iVideoDecoderCxt->width / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            case AVP::kAVPMediumSize:
-                avError = av_opt_set(videoFilterPadCxt, "width", QString::number(toUpperInt(iVideoDecoderCxt->height * 4.29)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "height", QString::number(toUpperInt(iVideoDecoderCxt->height)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "x", QString::number(toUpperInt(((iVideoDecoderCxt->height * 4.29) / 2) - (iVideoDecoderCxt->width / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            case AVP::kAVPSmallSize:
-                avError = av_opt_set(videoFilterPadCxt, "width", QString::number(toUpperInt(iVideoDecoderCxt->height * 2.62)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "height", QString::number(toUpperInt(iVideoDecoderCxt->height)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "x", QString::number(toUpperInt(((iVideoDecoderCxt->height * 2.62) / 2) - (iVideoDecoderCxt->width / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            }
-        }
-        else if((iVideoDecoderCxt->width / iVideoDecoderCxt->height) > (settings.getWidth() / 1080))
+        // Set video filter
+        videoFilterGraph = avfilter_graph_alloc();
+        avError = AVP::createVideoFilterGraph(videoFilterGraph,
+                                              AVP::videoBufferArgs(iVideoDecoderCxt->width, iVideoDecoderCxt->height, iVideoDecoderCxt->pix_fmt, iVideoFmtCxt->streams[iVideoStreamID]->time_base, iVideoDecoderCxt->sample_aspect_ratio),
+                                              AVP::canvasGraph(jobSettings.size, iVideoDecoderCxt->width, iVideoDecoderCxt->height, jobSettings.scalePicture, jobSettings.outputFrameRate),
+                                              &videoFilterSrcCxt, &videoFilterSinkCxt);
+        if(avError < 0)
         {
-            switch(settings.size)
-            {
-            case AVP::kAVPLargeSize:
-                avError = av_opt_set(videoFilterPadCxt, "width", QString::number(toUpperInt(iVideoDecoderCxt->width)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "height", QString::number(toUpperInt(iVideoDecoderCxt->width * 0.175)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "y", QString::number(toUpperInt(((iVideoDecoderCxt->width * 0.175) / 2) - (iVideoDecoderCxt->height / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            case AVP::kAVPMediumSize:
-                avError = av_opt_set(videoFilterPadCxt, "width", QString::number(toUpperInt(iVideoDecoderCxt->width)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "height", QString::number(toUpperInt(iVideoDecoderCxt->width * 0.233)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "y", QString::number(toUpperInt(((iVideoDecoderCxt->width * 0.233) / 2) - (iVideoDecoderCxt->height / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            case AVP::kAVPSmallSize:
-                avError = av_opt_set(videoFilterPadCxt, "width", QString::number(toUpperInt(iVideoDecoderCxt->width)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "height", QString::number(toUpperInt(iVideoDecoderCxt->width * 0.382)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(videoFilterPadCxt, "y", QString::number(toUpperInt(((iVideoDecoderCxt->width * 0.382) / 2) - (iVideoDecoderCxt->height / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            }
+            avErrorMsg = tr("转换失败：不能创建滤镜链。");
+            goto end;
         }
-    }
-
-    if(settings.size == AVP::kAVPMediumSize || settings.size == AVP::kAVPMediumSize)
-        videoFilterFpsCxt = avfilter_graph_get_filter(videoFilterGraph, "Parsed_fps_7");
-    if(settings.size == AVP::kAVPLargeSize)
-        videoFilterFpsCxt = avfilter_graph_get_filter(videoFilterGraph, "Parsed_fps_6");
-    avError = av_opt_set(videoFilterFpsCxt, "fps", QString::number(settings.outputFrameRate.num).toUtf8() + "/" + QString::number(settings.outputFrameRate.den).toUtf8(), AV_OPT_SEARCH_CHILDREN);
 
-    avError = avfilter_graph_config(videoFilterGraph, 0);
-    if(avError < 0)
-    {
-        avErrorMsg = tr("转换失败：不能创建滤镜链。");
-        goto end;
+        // Set YUV422 rescaler and the fold into the MXL frame
+        scale422Cxt = sws_getContext(layout.canvasWidth, layout.height, iVideoDecoderCxt->pix_fmt, layout.canvasWidth, layout.height, AV_PIX_FMT_YUV422P, SWS_FAST_BILINEAR, 0, 0, 0);
+        foldTable = AVP::RemapTable::compileFold(layout, AV_PIX_FMT_YUV422P);
     }
 
-    // Set YUV422 rescaler
-    scale422Cxt = sws_getContext(3840, 2160, iVideoDecoderCxt->pix_fmt, 3840, 2160, AV_PIX_FMT_YUV422P, SWS_FAST_BILINEAR, 0, 0, 0);
-
+    traceTime = AVP::Trace::begin();
     while(av_read_frame(iVideoFmtCxt, packet) == 0)
     {
-        if(packet->stream_index == iVideoStreamID)
+        AVP::Trace::end("read", traceTime);
+
+        if(packet->stream_index == iVideoStreamID && needVideo)
         {
+            traceTime = AVP::Trace::begin();
             avError = avcodec_send_packet(iVideoDecoderCxt, packet);
+            AVP::Trace::end("decode", traceTime);
             while(true)
             {
+                traceTime = AVP::Trace::begin();
                 avError = avcodec_receive_frame(iVideoDecoderCxt, vFrameIn);
+                AVP::Trace::end("decode", traceTime);
                 if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
                     break;
 
-                emit setProgress(vFrameIn->pkt_dts * av_q2d(iVideoFmtCxt->streams[iVideoStreamID]->time_base));
+                if(vFrameIn->pkt_dts != AV_NOPTS_VALUE)
+                    videoProgressMs = av_rescale_q(vFrameIn->pkt_dts, iVideoFmtCxt->streams[iVideoStreamID]->time_base, {1, 1000});
+                emit setProgress(videoProgressMs + (audioProcess ? audioProcess->getProgress() : 0));
 
                 // Apply filter
+                traceTime = AVP::Trace::begin();
                 avError = av_buffersrc_add_frame(videoFilterSrcCxt, vFrameIn);
+                AVP::Trace::end("filter", traceTime);
                 while(true)
                 {
+                    traceTime = AVP::Trace::begin();
                     avError = av_buffersink_get_frame(videoFilterSinkCxt, vFrameFiltered);
+                    AVP::Trace::end("filter", traceTime);
                     if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
                         break;
 
-                    // Rescale to YUV422
-                    avError = sws_scale_frame(scale422Cxt, vFrameOut, vFrameFiltered);
+                    // Rescale the canvas to YUV422 into a recycled frame
+                    traceTime = AVP::Trace::begin();
+                    AVP::PooledFrame vCanvas = vCanvasPool.acquireVideo(AV_PIX_FMT_YUV422P, layout.canvasWidth, layout.height);
+                    avError = sws_scale_frame(scale422Cxt, vCanvas.get(), vFrameFiltered);
+                    AVP::Trace::end("convert", traceTime);
+
+                    // Fold the canvas into the MXL frame
+                    traceTime = AVP::Trace::begin();
+                    AVP::PooledFrame vFrameOut = vFrameOutPool.acquireVideo(AV_PIX_FMT_YUV422P, AVP::kAVPFrameWidth, AVP::kAVPFrameHeight);
+                    avError = foldTable.apply(vCanvas.get(), vFrameOut.get());
+                    AVP::Trace::end("remap", traceTime);
 
                     // Encode
-                    avError = avcodec_send_frame(oVideoEncoderCxt, vFrameOut);
+                    traceTime = AVP::Trace::begin();
+                    avError = avcodec_send_frame(oVideoEncoderCxt, vFrameOut.get());
                     avError = avcodec_receive_packet(oVideoEncoderCxt, packet);
+                    AVP::Trace::end("encode", traceTime);
                     av_packet_rescale_ts(packet, oVideoEncoderCxt->time_base, oVideoFmtCxt->streams[0]->time_base);
+                    traceTime = AVP::Trace::begin();
                     avError = av_interleaved_write_frame(oVideoFmtCxt, packet);
+                    AVP::Trace::end("write", traceTime);
+                    videoFrames ++;
+                    sampleResidentBytes();
 
                     // Unref frame
                     av_frame_unref(vFrameIn);
                     av_frame_unref(vFrameFiltered);
-                    av_frame_unref(vFrameOut);
                 }
             }
             // Unref packet
             av_packet_unref(packet);
         }
-    }
-
-    av_seek_frame(iVideoFmtCxt, iVideoStreamID, 0, AVSEEK_FLAG_BACKWARD);
-
-    // Convert audio
-    if(iAudioStreamID != AVERROR_STREAM_NOT_FOUND)
-    {
-        aFrameIn = av_frame_alloc();
-        aFrameFiltered = av_frame_alloc();
-        aFrameOut = av_frame_alloc();
-
-        emit setLabel(tr("转换音频中...") + settings.getOutputAudioFinalName());
-        emit setProgressMax(iVideoFmtCxt->streams[iAudioStreamID]->duration * av_q2d(iVideoFmtCxt->streams[iAudioStreamID]->time_base));
-
-        // Set volume filter
-        char chLayoutDescription[64];
-
-        volumeFilterGraph = avfilter_graph_alloc();
-
-        volumeFilterSrc = avfilter_get_by_name("abuffer");
-        volumeFilterSrcCxt = avfilter_graph_alloc_filter(volumeFilterGraph, volumeFilterSrc, "in");
-        avError = av_channel_layout_describe(&iAudioDecoderCxt->ch_layout, chLayoutDescription, sizeof(chLayoutDescription));
-        avError = av_opt_set(volumeFilterSrcCxt, "channel_layout", chLayoutDescription, AV_OPT_SEARCH_CHILDREN);
-        avError = av_opt_set(volumeFilterSrcCxt, "sample_fmt", av_get_sample_fmt_name(iAudioDecoderCxt->sample_fmt), AV_OPT_SEARCH_CHILDREN);
-        avError = av_opt_set_q(volumeFilterSrcCxt, "time_base", iAudioDecoderCxt->time_base, AV_OPT_SEARCH_CHILDREN);
-        avError = av_opt_set_int(volumeFilterSrcCxt, "sample_rate", iAudioDecoderCxt->sample_rate, AV_OPT_SEARCH_CHILDREN);
-        avError = avfilter_init_str(volumeFilterSrcCxt, 0);
-
-        volumeFilter = avfilter_get_by_name("volume");
-        volumeFilterCxt = avfilter_graph_alloc_filter(volumeFilterGraph, volumeFilter, "volume");
-        avError = av_opt_set(volumeFilterCxt, "volume", QString::number(settings.outputVolume / 100.0, 'f', 2).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-        avError = avfilter_init_str(volumeFilterCxt, 0);
-
-        volumeFilterSink = avfilter_get_by_name("abuffersink");
-        volumeFilterSinkCxt = avfilter_graph_alloc_filter(volumeFilterGraph, volumeFilterSink, "out");
-        avError = av_channel_layout_describe(&iAudioDecoderCxt->ch_layout, chLayoutDescription, sizeof(chLayoutDescription));
-        avError = av_opt_set(volumeFilterSinkCxt, "channel_layout", chLayoutDescription, AV_OPT_SEARCH_CHILDREN);
-        avError = av_opt_set(volumeFilterSinkCxt, "sample_fmt", av_get_sample_fmt_name(iAudioDecoderCxt->sample_fmt), AV_OPT_SEARCH_CHILDREN);
-        avError = av_opt_set_q(volumeFilterSinkCxt, "time_base", iAudioDecoderCxt->time_base, AV_OPT_SEARCH_CHILDREN);
-        avError = av_opt_set_int(volumeFilterSinkCxt, "sample_rate", iAudioDecoderCxt->sample_rate, AV_OPT_SEARCH_CHILDREN);
-        avError = avfilter_init_str(volumeFilterSinkCxt, 0);
-
-        avError = avfilter_link(volumeFilterSrcCxt, 0, volumeFilterCxt, 0);
-        avError = avfilter_link(volumeFilterCxt, 0, volumeFilterSinkCxt, 0);
-        avError = avfilter_graph_config(volumeFilterGraph, 0);
-
-        // Set resampler
-        avError = swr_alloc_set_opts2(&resamplerCxt, &iAudioDecoderCxt->ch_layout, AV_SAMPLE_FMT_S32, iAudioDecoderCxt->sample_rate, &iAudioDecoderCxt->ch_layout, iAudioDecoderCxt->sample_fmt, iAudioDecoderCxt->sample_rate, 0, 0);
-        avError = swr_init(resamplerCxt);
-
-        while(av_read_frame(iVideoFmtCxt, packet) == 0)
+        else if(packet->stream_index == iAudioStreamID && audioProcess)
         {
-            if(packet->stream_index == iAudioStreamID)
+            // Blocks while the audio worker is behind
+            traceTime = AVP::Trace::begin();
+            audioProcess->pushPacket(packet);
+            AVP::Trace::end("queue audio", traceTime);
+            // Audio only: no video frames move the progress bar
+            if(!needVideo)
             {
-                avError = avcodec_send_packet(iAudioDecoderCxt, packet);
-                while(true)
-                {
-                    avError = avcodec_receive_frame(iAudioDecoderCxt, aFrameIn);
-                    if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
-                        break;
-
-                    emit setProgress(aFrameIn->pkt_dts * av_q2d(iVideoFmtCxt->streams[iAudioStreamID]->time_base));
-
-                    // Copy frame settings
-                    aFrameOut -> ch_layout = aFrameIn -> ch_layout;
-                    aFrameOut -> sample_rate = aFrameIn -> sample_rate;
-                    aFrameOut -> format = AV_SAMPLE_FMT_S32;
-                    aFrameOut -> nb_samples = av_rescale_rnd(swr_get_delay(resamplerCxt, iAudioDecoderCxt->sample_rate) + aFrameIn->nb_samples, iAudioDecoderCxt->sample_rate, iAudioDecoderCxt->sample_rate, AV_ROUND_UP);
-
-                    // Apply volume filter
-                    avError = av_buffersrc_add_frame(volumeFilterSrcCxt, aFrameIn);
-                    avError = av_buffersink_get_frame(volumeFilterSinkCxt, aFrameFiltered);
-
-                    // Resample
-                    avError = swr_config_frame(resamplerCxt, aFrameOut, aFrameFiltered);
-                    avError = swr_convert_frame(resamplerCxt, aFrameOut, aFrameFiltered);
+                emit setProgress(audioProcess->getProgress());
+                sampleResidentBytes();
+            }
+        }
+        else
+            av_packet_unref(packet);
 
-                    aFrameOut -> pts = audioPTSCounter;
-                    audioPTSCounter += oAudioEncoderCxt->frame_size;
+        traceTime = AVP::Trace::begin();
+    }
 
-                    // Encode
-                    avError = avcodec_send_frame(oAudioEncoderCxt, aFrameOut);
-                    avError = avcodec_receive_packet(oAudioEncoderCxt, packet);
-                    avError = av_write_frame(oAudioFmtCxt, packet);
-
-                    // Unref frames
-                    av_frame_unref(aFrameIn);
-                    av_frame_unref(aFrameFiltered);
-                    av_frame_unref(aFrameOut);
-                }
-                // Unref packet
-                av_packet_unref(packet);
-            }
+    // Wait for audio
+    if(audioProcess)
+    {
+        emit setLabel(tr("转换音频中...") + QFileInfo(oAudioPath).fileName());
+        audioProcess->finish();
+        while(!audioProcess->wait(100))
+        {
+            emit setProgress(videoDurationMs + audioProcess->getProgress());
+            sampleResidentBytes();
+        }
+        if(audioProcess->getError() < 0)
+        {
+            avError = audioProcess->getError();
+            avErrorMsg = audioProcess->getErrorMsg();
+            goto end;
         }
     }
 
     // Write file tail
-    avError = av_write_trailer(oVideoFmtCxt);
-    if(avError < 0)
+    if(needVideo)
     {
-        avErrorMsg = tr("写入视频输出文件失败：无法写入文件尾。");
-        goto end;
+        avError = av_write_trailer(oVideoFmtCxt);
+        if(avError < 0)
+        {
+            avErrorMsg = tr("写入视频输出文件失败：无法写入文件尾。");
+            goto end;
+        }
     }
-    if(iAudioStreamID != AVERROR_STREAM_NOT_FOUND)
+    if(needAudio)
     {
         avError = av_write_trailer(oAudioFmtCxt);
         if(avError < 0)
@@ -590,14 +478,25 @@ void TDoProcess::run()
     // Close files
     avformat_close_input(&iVideoFmtCxt);
 
-    avio_close(oVideoFmtCxt->pb);
-    if(iAudioStreamID != AVERROR_STREAM_NOT_FOUND)
+    if(needVideo)
+        avio_close(oVideoFmtCxt->pb);
+    if(needAudio)
         avio_close(oAudioFmtCxt->pb);
 
+    // Record the settings that produced the outputs
+    if(needVideo)
+        AVP::ExportManifest::record(oVideoPath, videoFingerprint);
+    if(needAudio)
+        AVP::ExportManifest::record(oAudioPath, audioFingerprint);
+
     avError = 0;
 
 end:    // Jump flag for errors
 
+    // Stop audio worker before freeing the contexts it uses
+    delete audioProcess;
+    audioProcess = nullptr;
+
     // Free memory
     avformat_free_context(iVideoFmtCxt);
 
@@ -614,29 +513,21 @@ end:    // Jump flag for errors
 
     av_frame_free(&vFrameIn);
     av_frame_free(&vFrameFiltered);
-    av_frame_free(&vFrameOut);
-
-    avfilter_free(videoFilterSrcCxt);
-    avfilter_free(videoFilterSinkCxt);
-    avfilter_free(videoFilterPadCxt);
-    avfilter_free(videoFilterFpsCxt);
 
     avfilter_graph_free(&videoFilterGraph);
-    avfilter_inout_free(&videoFilterInput);
-    avfilter_inout_free(&videoFilterOutput);
 
     sws_freeContext(scale422Cxt);
 
-    av_frame_free(&aFrameIn);
-    av_frame_free(&aFrameFiltered);
-    av_frame_free(&aFrameOut);
-
-    avfilter_free(volumeFilterSrcCxt);
-    avfilter_free(volumeFilterSinkCxt);
-    avfilter_free(volumeFilterCxt);
-    avfilter_graph_free(&volumeFilterGraph);
+    sampleResidentBytes(true);
 
-    swr_free(&resamplerCxt);
+    // Allocation accounting of this job. Jobs running at the same time are counted together
+    if(AVP::AllocStats::isEnabled())
+    {
+        AVP::AllocSnapshot allocStats = AVP::AllocStats::diff(allocBegin, AVP::AllocStats::snapshot());
+        int64_t frames = qMax<int64_t>(videoFrames, 1);     // Audio only jobs report totals
+        allocsPerFrame = (double)AVP::AllocStats::totalCount(allocStats) / frames;
+        allocReport = QString::fromStdString(AVP::AllocStats::report(allocStats, frames));
+    }
 
     emit completed(avError, avErrorMsg);
 }
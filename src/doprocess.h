@@ -18,13 +18,29 @@
 #ifndef TDOPROCESS_H
 #define TDOPROCESS_H
 
+#include "audioprocess.h"
+#include "memorybudget.h"
+#include "settings.h"
+
+#include <QElapsedTimer>
 #include <QThread>
 
 class TDoProcess : public QThread
 {
     Q_OBJECT
 public:
-    explicit TDoProcess(QObject *parent = nullptr);
+    // Settings are copied, so several conversions may run at the same time
+    explicit TDoProcess(QObject *parent = nullptr, const AVP::AVPSettings &jobSettings = settings);
+    ~TDoProcess();
+
+    // Allocation accounting of the finished job, only filled while AllocStats is enabled
+    QString getAllocReport() const { return allocReport; }
+    double getAllocsPerFrame() const { return allocsPerFrame; }
+
+    // Memory plan of the job and the highest resident size of the process sampled while it ran.
+    // Jobs running at the same time share the process, so each one sees the others too
+    const AVP::MemoryPlan &getMemoryPlan() const { return memoryPlan; }
+    int64_t getPeakResidentBytes() const { return peakResidentBytes; }
 
 protected:
     void run();
@@ -34,6 +50,22 @@ signals:
     void setProgress(int64_t num);
     void setLabel(QString str);
     void completed(bool isError, QString errorStr);
+
+private:
+    AVP::AVPSettings jobSettings;
+    TAudioProcess *audioProcess = nullptr;
+
+    QString allocReport;
+    double allocsPerFrame = 0;
+
+    // Reading the resident size opens a file on Linux, so it is sampled at most every kResidentSampleMs
+    static const int kResidentSampleMs = 100;
+
+    AVP::MemoryPlan memoryPlan;
+    int64_t peakResidentBytes = 0;
+    QElapsedTimer residentSampleTimer;
+
+    void sampleResidentBytes(bool force = false);
 };
 
 #endif // TDOPROCESS_H
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "exportmanifest.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QMutex>
+#include <QMutexLocker>
+
+static const char *kManifestFileName = ".avpstudio-manifest.json";
+
+// Concurrent conversions may update the same manifest
+static QMutex manifestMutex;
+
+static QString engineVersion()
+{
+    return QString("%1.%2.%3").arg(PROJECT_VERSION_MAJOR).arg(PROJECT_VERSION_MINOR).arg(PROJECT_VERSION_PATCH);
+}
+
+// Edited layout descriptors keep their name, so the geometry is fingerprinted as well
+static QString layoutGeometry(const AVP::AVPLayout &layout)
+{
+    QString geometry = QString("%1x%2 %3@%4").arg(layout.canvasWidth).arg(layout.height).arg(layout.pictureWidth).arg(layout.pictureX);
+    for(const AVP::AVPRegion &region : layout.regions)
+        geometry += QString(" %1,%2,%3x%4>%5,%6").arg(region.srcX).arg(region.srcY).arg(region.width).arg(region.height).arg(region.dstX).arg(region.dstY);
+    return geometry;
+}
+
+static QJsonObject fileIdentity(const QString &path)
+{
+    QFileInfo info(path);
+    QJsonObject identity;
+    identity["path"] = info.absoluteFilePath();
+    identity["size"] = info.size();
+    identity["mtime"] = info.lastModified().toMSecsSinceEpoch();
+    return identity;
+}
+
+QJsonObject AVP::ExportManifest::videoFingerprint(AVPSettings &settings)
+{
+    QJsonObject fingerprint;
+    if(isPipePath(settings.inputVideoPath))
+        return fingerprint;
+    fingerprint["engine"] = engineVersion();
+    fingerprint["input"] = fileIdentity(settings.inputVideoPath);
+    fingerprint["size"] = settings.getSizeString();
+    fingerprint["layout"] = layoutGeometry(getLayout(settings.size));
+    fingerprint["bitrate"] = settings.outputVideoBitRate;
+    fingerprint["speed"] = getEncoderSpeedName(settings.outputEncoderSpeed);
+    fingerprint["framerate"] = QString("%1/%2").arg(settings.outputFrameRate.num).arg(settings.outputFrameRate.den);
+    fingerprint["colorPrimaries"] = (int)settings.outputColor.outputColorPrimary;
+    fingerprint["colorTransfer"] = (int)settings.outputColor.outputVideoColorTrac;
+    fingerprint["colorSpace"] = (int)settings.outputColor.outputVideoColorSpace;
+    fingerprint["scalePicture"] = settings.scalePicture;
+    return fingerprint;
+}
+
+QJsonObject AVP::ExportManifest::audioFingerprint(AVPSettings &settings)
+{
+    QJsonObject fingerprint;
+    if(isPipePath(settings.inputVideoPath))
+        return fingerprint;
+    fingerprint["engine"] = engineVersion();
+    fingerprint["input"] = fileIdentity(settings.inputVideoPath);
+    fingerprint["volume"] = settings.outputVolume;
+    fingerprint["dither"] = settings.outputAudioDither;
+    return fingerprint;
+}
+
+bool AVP::ExportManifest::isUpToDate(const QString &outputPath, const QJsonObject &fingerprint)
+{
+    QFileInfo outputInfo(outputPath);
+    if(fingerprint.isEmpty() || isPipePath(outputPath) || !outputInfo.exists())
+        return false;
+
+    QMutexLocker locker(&manifestMutex);
+    QJsonObject entry = load(manifestPath(outputPath)).value(outputInfo.fileName()).toObject();
+    if(entry.isEmpty())
+        return false;
+
+    return entry.value("fingerprint").toObject() == fingerprint
+           && entry.value("output").toObject() == fileIdentity(outputPath);
+}
+
+void AVP::ExportManifest::record(const QString &outputPath, const QJsonObject &fingerprint)
+{
+    if(fingerprint.isEmpty() || isPipePath(outputPath))
+        return;
+
+    QMutexLocker locker(&manifestMutex);
+    QString path = manifestPath(outputPath);
+    QJsonObject manifest = load(path);
+
+    QJsonObject entry;
+    entry["fingerprint"] = fingerprint;
+    entry["output"] = fileIdentity(outputPath);
+    manifest[QFileInfo(outputPath).fileName()] = entry;
+
+    save(path, manifest);
+}
+
+void AVP::ExportManifest::forget(const QString &outputPath)
+{
+    if(isPipePath(outputPath))
+        return;
+
+    QMutexLocker locker(&manifestMutex);
+    QString path = manifestPath(outputPath);
+    QJsonObject manifest = load(path);
+    if(manifest.contains(QFileInfo(outputPath).fileName()))
+    {
+        manifest.remove(QFileInfo(outputPath).fileName());
+        save(path, manifest);
+    }
+}
+
+QString AVP::ExportManifest::manifestPath(const QString &outputPath)
+{
+    return QFileInfo(outputPath).absoluteDir().filePath(kManifestFileName);
+}
+
+QJsonObject AVP::ExportManifest::load(const QString &manifestPath)
+{
+    QFile manifestFile(manifestPath);
+    if(!manifestFile.open(QFile::ReadOnly))
+        return QJsonObject();
+    QJsonDocument manifestDoc = QJsonDocument::fromJson(manifestFile.readAll());
+    manifestFile.close();
+    return manifestDoc.object();
+}
+
+void AVP::ExportManifest::save(const QString &manifestPath, const QJsonObject &manifest)
+{
+    QFile manifestFile(manifestPath);
+    if(!manifestFile.open(QFile::WriteOnly | QFile::Truncate))
+        return;
+    manifestFile.write(QJsonDocument(manifest).toJson());
+    manifestFile.close();
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef EXPORTMANIFEST_H
+#define EXPORTMANIFEST_H
+
+#include "settings.h"
+
+#include <QJsonObject>
+#include <QString>
+
+namespace AVP {
+
+/*
+ * Records which settings produced each output file.
+ * The manifest lives next to the outputs, so an export into the same folder can skip any output whose inputs and settings are unchanged.
+ * Entries also store the size and modification time of the output, so files edited or truncated afterwards are regenerated.
+ * Piped inputs and outputs are never tracked.
+ */
+class ExportManifest {
+public:
+    static QJsonObject videoFingerprint(AVPSettings &settings);
+    static QJsonObject audioFingerprint(AVPSettings &settings);
+
+    static bool isUpToDate(const QString &outputPath, const QJsonObject &fingerprint);
+    static void record(const QString &outputPath, const QJsonObject &fingerprint);
+    static void forget(const QString &outputPath);
+
+private:
+    static QString manifestPath(const QString &outputPath);
+    static QJsonObject load(const QString &manifestPath);
+    static void save(const QString &manifestPath, const QJsonObject &manifest);
+};
+
+}
+
+#endif // EXPORTMANIFEST_H
@@ -18,6 +18,7 @@
 #include "pageedit.h"
 #include "ui_pageedit.h"
 
+#include "exportmanifest.h"
 #include "settings.h"
 
 #include <QAudioOutput>
@@ -35,6 +36,11 @@ PageEdit::PageEdit(QWidget *parent)
     player->setAudioOutput(audioOutput);
     player->setVideoOutput(ui->widgetVideoPreview);
 
+    ui->comboBoxEncoderSpeed->addItem(tr("草稿（最快，用于审片）"), QVariant::fromValue((int)AVP::kEncoderDraft));
+    ui->comboBoxEncoderSpeed->addItem(tr("标准"), QVariant::fromValue((int)AVP::kEncoderStandard));
+    ui->comboBoxEncoderSpeed->addItem(tr("最佳（最慢，用于最终交付）"), QVariant::fromValue((int)AVP::kEncoderBest));
+    ui->comboBoxEncoderSpeed->setCurrentIndex(1);
+
     ui->comboBoxFrameRate->addItem("23.976fps", QVariant::fromValue(av_make_q(24000, 1001)));
     ui->comboBoxFrameRate->addItem("24fps", QVariant::fromValue(av_make_q(24, 1)));
     ui->comboBoxFrameRate->addItem("25fps", QVariant::fromValue(av_make_q(25, 1)));
@@ -84,6 +90,15 @@ void PageEdit::do_init()
         ui->widgetVideoPreview->setMinimumSize(685, 120);
         ui->widgetVideoPreview->setMaximumSize(685, 120);
         break;
+    default:
+    {
+        // Loaded layouts: full width, height from the aspect ratio
+        const AVP::AVPLayout &layout = AVP::getLayout(settings.size);
+        int previewHeight = 685 * layout.height / layout.width;
+        ui->widgetVideoPreview->setMinimumSize(685, previewHeight);
+        ui->widgetVideoPreview->setMaximumSize(685, previewHeight);
+        break;
+    }
     }
 
     player->setSource(QUrl::fromLocalFile(settings.inputVideoPath));
@@ -165,6 +180,7 @@ void PageEdit::on_checkBoxPadding_clicked(bool checked)
 void PageEdit::on_pushButtonOutput_clicked()
 {
     settings.outputVideoBitRate = ui->doubleSpinBoxVideoBitRate->value();
+    settings.outputEncoderSpeed = (AVP::EncoderSpeed)ui->comboBoxEncoderSpeed->currentData(Qt::UserRole).toInt();
     settings.outputFrameRate = ui->comboBoxFrameRate->currentData(Qt::UserRole).value<AVRational>();
     settings.outputColor = ui->comboBoxVideoColor->currentData(Qt::UserRole).value<AVP::ColorSettings>();
     settings.outputFileName = ui->lineEditFileName->text();
@@ -184,10 +200,13 @@ void PageEdit::on_pushButtonOutput_clicked()
     if(settings.outputFilePath == "")
         return;
 
-    if(QFileInfo::exists(settings.outputFilePath + "/" + settings.getOutputVideoFinalName()))
+    // Outputs produced by the same input and settings are reused, so no need to ask for them
+    QString videoPath = settings.outputFilePath + "/" + settings.getOutputVideoFinalName();
+    QString audioPath = settings.outputFilePath + "/" + settings.getOutputAudioFinalName();
+    if(QFileInfo::exists(videoPath) && !AVP::ExportManifest::isUpToDate(videoPath, AVP::ExportManifest::videoFingerprint(settings)))
         if(QMessageBox::question(this, tr("输出文件已存在"), tr("同名视频文件已存在。要覆盖吗？")) == QMessageBox::No)
             return;
-    if(QFileInfo::exists(settings.outputFilePath + "/" + settings.getOutputAudioFinalName()))
+    if(QFileInfo::exists(audioPath) && !AVP::ExportManifest::isUpToDate(audioPath, AVP::ExportManifest::audioFingerprint(settings)))
         if(QMessageBox::question(this, tr("输出文件已存在"), tr("同名音频文件已存在。要覆盖吗？")) == QMessageBox::No)
             return;
 
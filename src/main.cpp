@@ -17,17 +17,50 @@
  */
 
 #include "mainwindow/mainwindow.h"
+#include "commandline.h"
+#include "allocstats.h"
+#include "avplayout.h"
+#include "cpudispatch.h"
+#include "trace.h"
 
 #include <QApplication>
+#include <QCoreApplication>
 #include <QFile>
 #include <QLocale>
 #include <QTranslator>
 
 int main(int argc, char *argv[])
 {
+    // Timeline tracing, if AVP_TRACE is set
+    AVP::Trace::initFromEnvironment();
+
+    // Allocation accounting, if AVP_ALLOC_STATS is set
+    AVP::AllocStats::initFromEnvironment();
+
+    // Forced CPU level, if AVP_CPU_LEVEL is set
+    AVP::CpuDispatch::initFromEnvironment();
+
+    // Convert without GUI when a job is given on the command line
+    if(CommandLine::isCommandLineMode(argc, argv))
+    {
+        QCoreApplication a(argc, argv);
+        AVP::loadLayouts(QCoreApplication::applicationDirPath().toStdString());
+        CommandLine commandLine;
+        if(!commandLine.parse(a.arguments()))
+            return 1;
+        if(!commandLine.start())
+            return 1;
+        int ret = a.exec();
+        AVP::Trace::stop();
+        return ret;
+    }
+
     // Build application
     QApplication a(argc, argv);
 
+    // Layout descriptors next to the executable and in AVP_LAYOUT_PATH
+    AVP::loadLayouts(QCoreApplication::applicationDirPath().toStdString());
+
     // Set translator
     QTranslator translator;
     const QStringList uiLanguages = QLocale::system().uiLanguages();
@@ -49,5 +82,7 @@ int main(int argc, char *argv[])
     // Build and show MainWindow
     MainWindow w;
     w.show();
-    return a.exec();
+    int ret = a.exec();
+    AVP::Trace::stop();
+    return ret;
 }
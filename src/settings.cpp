@@ -22,81 +22,59 @@ AVP::AVPSettings settings;
 
 QString AVP::AVPSettings::getSizeString()
 {
-    switch(this->size) {
-    case kAVPSmallSize:
-        return "Small";
-    case kAVPMediumSize:
-        return "Medium";
-    case kAVPLargeSize:
-        return "Large";
-    default:
-        return "";
-    }
+    return QString::fromStdString(getLayout(size).name);
 }
 
 QString AVP::AVPSettings::getSizeResolution()
 {
-    switch(this->size) {
-    case kAVPSmallSize:
-        return "2830x1080";
-    case kAVPMediumSize:
-        return "4633x1080";
-    case kAVPLargeSize:
-        return "6167x1080";
-    default:
-        return "";
-    }
+    return QString::number(getLayout(size).width) + "x" + QString::number(getLayout(size).height);
 }
 
 QString AVP::AVPSettings::getRealSize()
 {
-    switch(this->size)
-    {
-    case kAVPSmallSize:
-        return "5.5Mx2.1M";
-    case kAVPMediumSize:
-        return "9Mx2.1M";
-    case kAVPLargeSize:
-        return "12Mx2.1M";
-    default:
-        return "";
-    }
+    return QString::fromStdString(getLayout(size).realSize);
 }
 
 int AVP::AVPSettings::getWidth()
 {
-    switch(this->size)
+    return getLayout(size).width;
+}
+
+bool AVP::AVPSettings::setSizeFromString(const QString &str)
+{
+    // Accepts both layout names and real corridor lengths, including loaded layouts
+    return findLayout(str.toStdString(), &size);
+}
+
+bool AVP::AVPSettings::setColorFromString(const QString &str)
+{
+    QString lower = str.toLower();
+    if(lower == "bt470")
     {
-    case kAVPSmallSize:
-        return 2830;
-    case kAVPMediumSize:
-        return 4633;
-    case kAVPLargeSize:
-        return 6167;
+        outputColor.outputColorPrimary = AVCOL_PRI_BT470M;
+        outputColor.outputVideoColorTrac = AVCOL_TRC_GAMMA22;
+        outputColor.outputVideoColorSpace = AVCOL_SPC_FCC;
     }
-    return 0;
+    else if(lower == "bt709")
+    {
+        outputColor.outputColorPrimary = AVCOL_PRI_BT709;
+        outputColor.outputVideoColorTrac = AVCOL_TRC_BT709;
+        outputColor.outputVideoColorSpace = AVCOL_SPC_BT709;
+    }
+    else
+        return false;
+    return true;
+}
+
+bool AVP::AVPSettings::setEncoderSpeedFromString(const QString &str)
+{
+    return findEncoderSpeed(str.toStdString(), &outputEncoderSpeed);
 }
 
 QString AVP::AVPSettings::getOutputVideoFinalName()
 {
     if(useDolbyNaming)
-    {
-        switch(size)
-        {
-        case kAVPSmallSize:
-            return "V2_" + outputFileName + "_video" + "_5m" + ".mxl";
-            break;
-        case kAVPMediumSize:
-            return "V2_" + outputFileName + "_video" + "_9m" + ".mxl";
-            break;
-        case kAVPLargeSize:
-            return "V2_" + outputFileName + "_video" + "_12m" + ".mxl";
-            break;
-        default:
-            return outputFileName + ".mxl";
-            break;
-        }
-    }
+        return "V2_" + outputFileName + "_video_" + QString::fromStdString(getLayout(size).dolbySuffix) + ".mxl";
     else
         return outputFileName + ".mxl";
 }
@@ -108,3 +86,22 @@ QString AVP::AVPSettings::getOutputAudioFinalName()
     else
         return outputFileName + ".wav";
 }
+
+QString AVP::AVPSettings::getOutputVideoFullPath()
+{
+    if(outputVideoPathOverride != "")
+        return outputVideoPathOverride;
+    return outputFilePath + "/" + getOutputVideoFinalName();
+}
+
+QString AVP::AVPSettings::getOutputAudioFullPath()
+{
+    if(outputAudioPathOverride != "")
+        return outputAudioPathOverride;
+    return outputFilePath + "/" + getOutputAudioFinalName();
+}
+
+bool AVP::isPipePath(const QString &path)
+{
+    return path.startsWith("pipe:");
+}
@@ -23,17 +23,14 @@ extern "C" {
 #include <libavutil/pixfmt.h>
 }
 
+#include "avplayout.h"
+#include "codecsetup.h"
+
 #include <QString>
 #include <QFileInfo>
 
 namespace AVP {
 
-enum AVPSize {
-    kAVPSmallSize,
-    kAVPMediumSize,
-    kAVPLargeSize
-};
-
 struct ColorSettings {
     AVColorPrimaries outputColorPrimary = AVCOL_PRI_BT470M;
     AVColorTransferCharacteristic outputVideoColorTrac = AVCOL_TRC_GAMMA22;
@@ -47,23 +44,38 @@ public:
     QString getSizeResolution();
     QString getRealSize();
     int getWidth();
+    bool setSizeFromString(const QString &str);
 
     QString inputVideoPath;
     QFileInfo inputVideoInfo;
 
     double outputVideoBitRate = 20.0;
+    EncoderSpeed outputEncoderSpeed = kEncoderStandard;
+    bool setEncoderSpeedFromString(const QString &str);
     AVRational outputFrameRate = av_make_q(24, 1);
     ColorSettings outputColor;
+    bool setColorFromString(const QString &str);
     QString outputFileName = "";
     bool useDolbyNaming = true;
     bool scalePicture = false;
     int outputVolume = 100;
+    bool outputAudioDither = false;
+    int memoryBudgetMB = 0;     // 0 for no budget
 
     QString getOutputVideoFinalName();
     QString getOutputAudioFinalName();
 
     QString outputFilePath;
+
+    // Explicit output locations (e.g. "pipe:1"), overriding outputFilePath and the final names
+    QString outputVideoPathOverride;
+    QString outputAudioPathOverride;
+    QString getOutputVideoFullPath();
+    QString getOutputAudioFullPath();
 };
+
+// FFmpeg "pipe:" URLs (stdin, stdout or any other file descriptor)
+bool isPipePath(const QString &path);
 }
 
 extern AVP::AVPSettings settings;
@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "watchdaemon.h"
+
+#include "allocstats.h"
+#include "exportmanifest.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QTextStream>
+
+extern "C" {
+#include <libavutil/parseutils.h>
+}
+
+static const char *kDoneFolderName = "done";
+static const char *kErrorFolderName = "error";
+// Outputs are written here and only moved to done/ once complete
+static const char *kWorkFolderName = "working";
+static const char *kSidecarSuffix = ".avp.json";
+static const char *kMetricsFileName = "avpstudio-jobs.log";
+
+// Interval to check whether dropped files are still growing
+static const int kSettleIntervalMs = 2000;
+
+static QTextStream &err()
+{
+    static QTextStream stream(stderr);
+    return stream;
+}
+
+// Move a file into a folder, replacing the file of the same name
+static bool moveInto(const QString &path, const QString &folder)
+{
+    if(!QFileInfo::exists(path))
+        return true;
+    QString target = QDir(folder).filePath(QFileInfo(path).fileName());
+    QFile::remove(target);
+    return QFile::rename(path, target);
+}
+
+// Files still being downloaded or copied under a temporary name, picked up again once renamed. Hidden files are not listed at all
+static bool isTemporaryFile(const QFileInfo &file)
+{
+    static const char *kTemporarySuffixes[] = {".part", ".partial", ".crdownload", ".download", ".tmp", "~"};
+    for(const char *suffix : kTemporarySuffixes)
+        if(file.fileName().endsWith(suffix, Qt::CaseInsensitive))
+            return true;
+    return false;
+}
+
+WatchDaemon::WatchDaemon(QObject *parent, const QStringList &folders, int maxJobs, const AVP::AVPSettings &defaultSettings)
+    : QObject{parent}
+    , folders(folders)
+    , maxJobs(qMax(1, maxJobs))
+    , defaultSettings(defaultSettings)
+{
+    connect(&watcher, SIGNAL(directoryChanged(QString)), this, SLOT(do_directoryChanged(QString)));
+    connect(&settleTimer, SIGNAL(timeout()), this, SLOT(do_checkPending()));
+}
+
+WatchDaemon::~WatchDaemon()
+{
+    for(Job *job : running)
+    {
+        job->thread->wait();
+        delete job->thread;
+        delete job;
+    }
+    qDeleteAll(queue);
+}
+
+bool WatchDaemon::start()
+{
+    for(const QString &folder : folders)
+    {
+        QDir dir(folder);
+        if(!dir.exists())
+        {
+            err() << tr("错误：监视目录不存在：") << folder << Qt::endl;
+            return false;
+        }
+        if(!dir.mkpath(kDoneFolderName) || !dir.mkpath(kErrorFolderName) || !dir.mkpath(kWorkFolderName))
+        {
+            err() << tr("错误：无法在监视目录中创建输出目录：") << folder << Qt::endl;
+            return false;
+        }
+        if(!watcher.addPath(dir.absolutePath()))
+        {
+            err() << tr("错误：无法监视目录：") << folder << Qt::endl;
+            return false;
+        }
+        err() << tr("监视中：") << dir.absolutePath() << Qt::endl;
+
+        // Pick up files dropped while not running
+        scanFolder(dir.absolutePath());
+    }
+
+    settleTimer.start(kSettleIntervalMs);
+    return true;
+}
+
+void WatchDaemon::scanFolder(const QString &folder)
+{
+    const QFileInfoList files = QDir(folder).entryInfoList(QDir::Files | QDir::Readable, QDir::Name);
+    for(const QFileInfo &file : files)
+    {
+        QString path = file.absoluteFilePath();
+        if(file.fileName().endsWith(kSidecarSuffix) || file.fileName() == kMetricsFileName || isTemporaryFile(file))
+            continue;
+        if(knownFiles.contains(path) || pendingSizes.contains(path))
+            continue;
+
+        // Size is checked again later, so files still being copied are not picked up
+        pendingSizes.insert(path, file.size());
+    }
+}
+
+bool WatchDaemon::loadJobSettings(Job *job, QString *errorMsg)
+{
+    QFileInfo inputInfo(job->inputPath);
+    AVP::AVPSettings &jobSettings = job->jobSettings;
+
+    jobSettings = defaultSettings;
+    jobSettings.inputVideoPath = job->inputPath;
+    jobSettings.inputVideoInfo = inputInfo;
+    jobSettings.outputFileName = inputInfo.completeBaseName();
+    jobSettings.outputFilePath = QDir(job->folder).filePath(kWorkFolderName);
+    jobSettings.outputVideoPathOverride = "";
+    jobSettings.outputAudioPathOverride = "";
+    // Concurrent jobs share the daemon-wide budget. A budget from the sidecar is the job's own
+    jobSettings.memoryBudgetMB = defaultSettings.memoryBudgetMB / maxJobs;
+
+    // Size from folder name, e.g. "AVP Large" or "corridor_12m"
+    const QStringList words = QFileInfo(job->folder).fileName().split(QRegularExpression("[^A-Za-z0-9]+"), Qt::SkipEmptyParts);
+    for(const QString &word : words)
+        if(jobSettings.setSizeFromString(word))
+            break;
+
+    // Sidecar overrides everything
+    QFile sidecarFile(job->inputPath + kSidecarSuffix);
+    if(!sidecarFile.exists())
+        return true;
+    if(!sidecarFile.open(QFile::ReadOnly))
+    {
+        *errorMsg = tr("无法读取设置文件。");
+        return false;
+    }
+    QJsonParseError parseError;
+    QJsonDocument sidecarDoc = QJsonDocument::fromJson(sidecarFile.readAll(), &parseError);
+    sidecarFile.close();
+    if(!sidecarDoc.isObject())
+    {
+        *errorMsg = tr("设置文件格式错误：") + parseError.errorString();
+        return false;
+    }
+
+    QJsonObject sidecar = sidecarDoc.object();
+    if(sidecar.contains("size") && !jobSettings.setSizeFromString(sidecar.value("size").toString()))
+    {
+        *errorMsg = tr("设置文件中的AVP尺寸无效。");
+        return false;
+    }
+    if(sidecar.contains("color") && !jobSettings.setColorFromString(sidecar.value("color").toString()))
+    {
+        *errorMsg = tr("设置文件中的色彩空间无效。");
+        return false;
+    }
+    if(sidecar.contains("speed") && !jobSettings.setEncoderSpeedFromString(sidecar.value("speed").toString()))
+    {
+        *errorMsg = tr("设置文件中的编码速度无效。");
+        return false;
+    }
+    if(sidecar.contains("framerate") && av_parse_video_rate(&jobSettings.outputFrameRate, sidecar.value("framerate").toVariant().toString().toUtf8()) < 0)
+    {
+        *errorMsg = tr("设置文件中的帧率无效。");
+        return false;
+    }
+    if(sidecar.contains("name"))
+        jobSettings.outputFileName = sidecar.value("name").toString();
+    jobSettings.outputVideoBitRate = sidecar.value("bitrate").toDouble(jobSettings.outputVideoBitRate);
+    jobSettings.outputVolume = sidecar.value("volume").toInt(jobSettings.outputVolume);
+    jobSettings.outputAudioDither = sidecar.value("dither").toBool(jobSettings.outputAudioDither);
+    jobSettings.scalePicture = sidecar.value("padding").toBool(jobSettings.scalePicture);
+    jobSettings.useDolbyNaming = sidecar.value("dolbyNaming").toBool(jobSettings.useDolbyNaming);
+    jobSettings.memoryBudgetMB = sidecar.value("memoryBudget").toInt(jobSettings.memoryBudgetMB);
+
+    return true;
+}
+
+void WatchDaemon::startJobs()
+{
+    while(running.size() < maxJobs && !queue.isEmpty())
+    {
+        Job *job = queue.dequeue();
+
+        QString errorMsg;
+        job->startTime = QDateTime::currentDateTime();
+        job->timer.start();
+        if(!loadJobSettings(job, &errorMsg))
+        {
+            finishJob(job, true, errorMsg);
+            continue;
+        }
+
+        err() << tr("开始转换：") << job->inputPath << " (" << job->jobSettings.getSizeString() << ")" << Qt::endl;
+
+        job->thread = new TDoProcess(nullptr, job->jobSettings);
+        connect(job->thread, SIGNAL(setProgressMax(int64_t)), this, SLOT(do_setProgressMax(int64_t)));
+        connect(job->thread, SIGNAL(completed(bool,QString)), this, SLOT(do_completed(bool,QString)));
+        running.append(job);
+        job->thread->start();
+    }
+}
+
+void WatchDaemon::finishJob(Job *job, bool isError, const QString &errorStr)
+{
+    QDir folder(job->folder);
+    QString sidecarPath = job->inputPath + kSidecarSuffix;
+    QString message = errorStr;
+
+    // Complete outputs leave working/ for done/, partial ones go to error/
+    if(job->thread && !isError && !moveOutputs(job, folder.filePath(kDoneFolderName)))
+    {
+        isError = true;
+        message = tr("无法将输出文件移动到完成目录。");
+    }
+    if(job->thread && isError)
+        moveOutputs(job, folder.filePath(kErrorFolderName));
+
+    writeMetrics(job, isError, message);
+
+    if(isError)
+    {
+        err() << tr("转换失败：") << job->inputPath << ": " << message << Qt::endl;
+
+        QString errorFolder = folder.filePath(kErrorFolderName);
+        moveInto(job->inputPath, errorFolder);
+        moveInto(sidecarPath, errorFolder);
+
+        QFile errorFile(QDir(errorFolder).filePath(QFileInfo(job->inputPath).fileName() + ".error.txt"));
+        if(errorFile.open(QFile::WriteOnly | QFile::Truncate))
+        {
+            errorFile.write(message.toUtf8());
+            errorFile.close();
+        }
+    }
+    else
+    {
+        err() << tr("转换完成：") << job->inputPath << Qt::endl;
+        moveInto(job->inputPath, folder.filePath(kDoneFolderName));
+        moveInto(sidecarPath, folder.filePath(kDoneFolderName));
+    }
+
+    knownFiles.remove(job->inputPath);
+    if(job->thread)
+    {
+        job->thread->wait();
+        job->thread->deleteLater();
+    }
+    delete job;
+}
+
+bool WatchDaemon::moveOutputs(Job *job, const QString &folder)
+{
+    bool isMoved = true;
+    const QString outputPaths[] = {job->jobSettings.getOutputVideoFullPath(), job->jobSettings.getOutputAudioFullPath()};
+    for(const QString &path : outputPaths)
+    {
+        // The manifest of working/ would only describe files that are gone
+        AVP::ExportManifest::forget(path);
+        isMoved = moveInto(path, folder) && isMoved;
+    }
+    // Metrics report the outputs where they ended up
+    if(isMoved)
+        job->jobSettings.outputFilePath = folder;
+    return isMoved;
+}
+
+void WatchDaemon::writeMetrics(Job *job, bool isError, const QString &errorStr)
+{
+    double wallSeconds = job->timer.elapsed() / 1000.0;
+    qint64 inputBytes = QFileInfo(job->inputPath).size();
+
+    QJsonObject metrics;
+    metrics["input"] = QFileInfo(job->inputPath).fileName();
+    metrics["inputBytes"] = inputBytes;
+    metrics["size"] = job->jobSettings.getSizeString();
+    metrics["start"] = job->startTime.toString(Qt::ISODate);
+    metrics["end"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    metrics["wallSeconds"] = wallSeconds;
+    metrics["streamSeconds"] = job->streamDurationMs / 1000.0;
+    metrics["inputMBps"] = wallSeconds > 0 ? inputBytes / 1048576.0 / wallSeconds : 0;
+    metrics["videoBytes"] = QFileInfo(job->jobSettings.getOutputVideoFullPath()).size();
+    metrics["audioBytes"] = QFileInfo(job->jobSettings.getOutputAudioFullPath()).size();
+    metrics["result"] = isError ? "error" : "done";
+    if(isError)
+        metrics["error"] = errorStr;
+    if(job->thread)
+    {
+        metrics["predictedPeakMB"] = (double)(job->thread->getMemoryPlan().predictedPeakBytes >> 20);
+        metrics["peakRssMB"] = (double)(job->thread->getPeakResidentBytes() >> 20);
+    }
+    if(AVP::AllocStats::isEnabled() && job->thread)
+        metrics["allocsPerFrame"] = job->thread->getAllocsPerFrame();
+
+    QFile metricsFile(QDir(job->folder).filePath(kMetricsFileName));
+    if(!metricsFile.open(QFile::WriteOnly | QFile::Append))
+        return;
+    metricsFile.write(QJsonDocument(metrics).toJson(QJsonDocument::Compact) + "\n");
+    metricsFile.close();
+}
+
+WatchDaemon::Job *WatchDaemon::findJob(QObject *thread)
+{
+    for(Job *job : running)
+        if(job->thread == thread)
+            return job;
+    return nullptr;
+}
+
+void WatchDaemon::do_directoryChanged(const QString &path)
+{
+    scanFolder(path);
+}
+
+void WatchDaemon::do_checkPending()
+{
+    for(auto it = pendingSizes.begin(); it != pendingSizes.end();)
+    {
+        QFileInfo file(it.key());
+        if(!file.exists())
+        {
+            it = pendingSizes.erase(it);
+            continue;
+        }
+
+        // Still growing
+        if(file.size() != it.value() || file.size() == 0)
+        {
+            it.value() = file.size();
+            ++it;
+            continue;
+        }
+
+        Job *job = new Job;
+        job->folder = file.absolutePath();
+        job->inputPath = it.key();
+        knownFiles.insert(job->inputPath);
+        queue.enqueue(job);
+        it = pendingSizes.erase(it);
+    }
+
+    startJobs();
+}
+
+void WatchDaemon::do_setProgressMax(int64_t num)
+{
+    Job *job = findJob(sender());
+    if(job)
+        job->streamDurationMs = num;
+}
+
+void WatchDaemon::do_completed(bool isError, QString errorStr)
+{
+    Job *job = findJob(sender());
+    if(!job)
+        return;
+
+    running.removeOne(job);
+    finishJob(job, isError, errorStr);
+    startJobs();
+}
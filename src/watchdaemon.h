@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef WATCHDAEMON_H
+#define WATCHDAEMON_H
+
+#include "doprocess.h"
+#include "settings.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QQueue>
+#include <QSet>
+#include <QTimer>
+
+/*
+ * Unattended conversion of files dropped into watched folders.
+ * Size and settings of each file are read from a "<file>.avp.json" sidecar, or from the folder name (e.g. "large", "12m").
+ * Outputs are written to "working/" and moved to "done/" with the finished input once complete.
+ * Failed inputs and their partial outputs go to "error/". Files with temporary names (e.g. ".part") are not picked up.
+ * Every job appends one line of metrics to "avpstudio-jobs.log" in the watched folder.
+ */
+class WatchDaemon : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WatchDaemon(QObject *parent, const QStringList &folders, int maxJobs, const AVP::AVPSettings &defaultSettings);
+    ~WatchDaemon();
+
+    bool start();
+
+private:
+    struct Job {
+        QString folder;
+        QString inputPath;
+        AVP::AVPSettings jobSettings;
+        TDoProcess *thread = nullptr;
+        QDateTime startTime;
+        QElapsedTimer timer;
+        int64_t streamDurationMs = 0;       // Total length of the streams to convert
+    };
+
+    QFileSystemWatcher watcher;
+    QTimer settleTimer;
+    QStringList folders;
+    int maxJobs;
+    AVP::AVPSettings defaultSettings;
+
+    QHash<QString, qint64> pendingSizes;    // Files that may still be being copied
+    QSet<QString> knownFiles;               // Queued or running
+    QQueue<Job*> queue;
+    QList<Job*> running;
+
+    void scanFolder(const QString &folder);
+    bool loadJobSettings(Job *job, QString *errorMsg);
+    void startJobs();
+    void finishJob(Job *job, bool isError, const QString &errorStr);
+    // Moves the outputs of a job out of working/, false if one could not be moved and stays there
+    bool moveOutputs(Job *job, const QString &folder);
+    void writeMetrics(Job *job, bool isError, const QString &errorStr);
+    Job *findJob(QObject *thread);
+
+private slots:
+    void do_directoryChanged(const QString &path);
+    void do_checkPending();
+    void do_setProgressMax(int64_t num);
+    void do_completed(bool isError, QString errorStr);
+};
+
+#endif // WATCHDAEMON_H
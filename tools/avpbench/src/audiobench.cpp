@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "audiobench.h"
+
+#include "audiomix.h"
+#include "audiopack.h"
+
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+
+#include <cmath>
+#include <vector>
+
+static const int kChannels = 8;
+static const int kSampleRate = 48000;
+static const int kFrameSamples = 1024;
+static const float kGain = 0.8f;
+
+/*
+ * Emulation of the old audio path:
+ * "volume" filter on planar float, swr_convert_frame() to interleaved S32, then the PCM_S24LE encoder repacking.
+ * Each step is a separate pass over every sample, like the original filter graph/resampler/encoder chain.
+ */
+static void legacyPath(const float * const *planes, int samples, std::vector<std::vector<float>> &gained, std::vector<int32_t> &s32, uint8_t *out)
+{
+    // Pass 1: volume filter
+    for(int c = 0; c < kChannels; c++)
+        for(int i = 0; i < samples; i++)
+            gained[c][i] = planes[c][i] * kGain;
+
+    // Pass 2: resample to interleaved S32
+    for(int i = 0; i < samples; i++)
+        for(int c = 0; c < kChannels; c++)
+        {
+            double val = std::lrint(gained[c][i] * 2147483648.0);
+            if(val > 2147483647.0)
+                val = 2147483647.0;
+            else if(val < -2147483648.0)
+                val = -2147483648.0;
+            s32[(size_t)i * kChannels + c] = (int32_t)val;
+        }
+
+    // Pass 3: PCM_S24LE encoder
+    for(size_t i = 0; i < (size_t)samples * kChannels; i++)
+    {
+        int32_t val = s32[i] >> 8;
+        out[i * 3] = (uint8_t)val;
+        out[i * 3 + 1] = (uint8_t)(val >> 8);
+        out[i * 3 + 2] = (uint8_t)(val >> 16);
+    }
+}
+
+template<typename Function> static double measure(int iterations, Function func)
+{
+    QElapsedTimer timer;
+    qint64 best = -1;
+    for(int i = 0; i < iterations; i++)
+    {
+        timer.start();
+        func();
+        qint64 elapsed = timer.nsecsElapsed();
+        if(best < 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best / 1e9;
+}
+
+BenchResults runAudioBenchmarks(int seconds, int iterations)
+{
+    BenchResults results;
+
+    const int totalSamples = seconds * kSampleRate;
+
+    // Synthetic 7.1 program: slightly over full scale to exercise clamping
+    std::vector<std::vector<float>> source(kChannels, std::vector<float>(totalSamples));
+    QRandomGenerator random(2024);
+    for(int c = 0; c < kChannels; c++)
+        for(int i = 0; i < totalSamples; i++)
+            source[c][i] = (float)(std::sin(i * (0.01 + c * 0.003)) * 1.1 + (random.generateDouble() - 0.5) * 0.01);
+
+    std::vector<std::vector<float>> gained(kChannels, std::vector<float>(kFrameSamples));
+    std::vector<int32_t> s32((size_t)kFrameSamples * kChannels);
+    std::vector<uint8_t> out((size_t)kFrameSamples * kChannels * 3);
+
+    // Walk the source frame by frame like the decoder loop does
+    auto runFrames = [&](auto process) {
+        const float *planes[kChannels];
+        for(int pos = 0; pos < totalSamples; pos += kFrameSamples)
+        {
+            int samples = qMin(kFrameSamples, totalSamples - pos);
+            for(int c = 0; c < kChannels; c++)
+                planes[c] = source[c].data() + pos;
+            process(planes, samples);
+        }
+    };
+
+    struct Kernel {
+        QString name;
+        AVP::PackS24Function function;
+        bool dither;
+    };
+    QList<Kernel> kernels;
+
+    // Every level the host supports, up to the forced one
+    const AVP::CpuLevel current = AVP::CpuDispatch::level();
+    for(int i = AVP::kCpuLevelScalar; i <= AVP::kCpuLevelNEON; i++)
+    {
+        AVP::CpuLevel level = (AVP::CpuLevel)i;
+        if(AVP::CpuDispatch::isSupported(level) && level <= current)
+            kernels.append({QString("audio/pack_s24/") + AVP::CpuDispatch::levelName(level), AVP::packS24Kernel(level), false});
+    }
+    kernels.append({QString("audio/pack_s24/") + AVP::CpuDispatch::levelName(current) + "_dither", AVP::packS24Kernel(current), true});
+
+    BenchResult legacy;
+    legacy.name = "audio/legacy_3pass";
+    legacy.unit = "Msamples/s";
+    legacy.rate = (double)totalSamples * kChannels / 1e6 / measure(iterations, [&]() {
+        runFrames([&](const float * const *planes, int samples) {
+            legacyPath(planes, samples, gained, s32, out.data());
+        });
+    });
+    results.append(legacy);
+
+    for(const Kernel &kernel : kernels)
+    {
+        AVP::DitherState dither;
+        BenchResult result;
+        result.name = kernel.name;
+        result.unit = legacy.unit;
+        result.rate = (double)totalSamples * kChannels / 1e6 / measure(iterations, [&]() {
+            runFrames([&](const float * const *planes, int samples) {
+                kernel.function(planes, kChannels, samples, kGain, kernel.dither ? &dither : NULL, out.data());
+            });
+        });
+        result.speedup = result.rate / legacy.rate;
+        results.append(result);
+    }
+
+    // MXLPlayer's 7.1 to stereo downmix, against the scalar kernel
+    static const float kDownmixMatrix[2 * kChannels] = {
+        0.29f, 0.0f, 0.21f, 0.0f, 0.21f, 0.0f, 0.21f, 0.0f,
+        0.0f, 0.29f, 0.21f, 0.0f, 0.0f, 0.21f, 0.0f, 0.21f
+    };
+    std::vector<float> mixed((size_t)kFrameSamples * 2);
+    double scalarRate = 0;
+    for(int i = AVP::kCpuLevelScalar; i <= AVP::kCpuLevelNEON; i++)
+    {
+        AVP::CpuLevel level = (AVP::CpuLevel)i;
+        AVP::DownmixFunction function = AVP::downmixKernel(level);
+        // SSSE3 and AVX-512 share the SSE2 and AVX2 kernels
+        if(!AVP::CpuDispatch::isSupported(level) || level > current || (level > AVP::kCpuLevelScalar && function == AVP::downmixKernel((AVP::CpuLevel)(i - 1))))
+            continue;
+        BenchResult result;
+        result.name = QString("audio/downmix_7.1_stereo/") + AVP::CpuDispatch::levelName(level);
+        result.unit = legacy.unit;
+        result.rate = (double)totalSamples * kChannels / 1e6 / measure(iterations, [&]() {
+            runFrames([&](const float * const *planes, int samples) {
+                function(planes, kChannels, samples, kDownmixMatrix, 2, mixed.data());
+            });
+        });
+        if(level == AVP::kCpuLevelScalar)
+            scalarRate = result.rate;
+        else
+            result.speedup = result.rate / scalarRate;
+        results.append(result);
+    }
+
+    return results;
+}
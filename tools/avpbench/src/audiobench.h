@@ -15,15 +15,12 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
-#ifndef AVPSETTINGS_H
-#define AVPSETTINGS_H
+#ifndef AUDIOBENCH_H
+#define AUDIOBENCH_H
 
-namespace AVP {
-enum AVPSize {
-    kAVPSmallSize,
-    kAVPMediumSize,
-    kAVPLargeSize
-};
-}
+#include "benchresult.h"
 
-#endif // AVPSETTINGS_H
+// Compare the legacy volume -> S32 -> PCM_S24LE passes against the single pass S24 pack kernels, and the downmix kernels against the scalar one.
+BenchResults runAudioBenchmarks(int seconds, int iterations);
+
+#endif // AUDIOBENCH_H
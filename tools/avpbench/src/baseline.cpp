@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "baseline.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+// Below these differences, allocations and memory are not considered regressed
+static const double kAllocsSlack = 0.5;
+static const double kPeakMBSlack = 1.0;
+
+static const BenchResult *findResult(const BenchResults &results, const QString &name)
+{
+    for(const BenchResult &result : results)
+        if(result.name == name)
+            return &result;
+    return nullptr;
+}
+
+static QString formatChange(const QString &name, const QString &metric, double base, double now)
+{
+    double percent = base != 0 ? (now - base) / base * 100 : 0;
+    return name.leftJustified(32) + metric.leftJustified(16) + QString::number(base, 'f', 2).rightJustified(12) + " -> " + QString::number(now, 'f', 2).rightJustified(12) + " (" + (percent >= 0 ? "+" : "") + QString::number(percent, 'f', 1) + "%)";
+}
+
+bool writeBaseline(const QString &path, const BenchResults &results)
+{
+    QJsonArray array;
+    for(const BenchResult &result : results)
+    {
+        QJsonObject object;
+        object["name"] = result.name;
+        object["rate"] = result.rate;
+        object["unit"] = result.unit;
+        if(result.allocsPerFrame >= 0)
+            object["allocsPerFrame"] = result.allocsPerFrame;
+        if(result.peakMB >= 0)
+            object["peakMB"] = result.peakMB;
+        array.append(object);
+    }
+
+    QFile file(path);
+    if(!file.open(QFile::WriteOnly | QFile::Truncate))
+        return false;
+    QJsonObject root;
+    root["results"] = array;
+    file.write(QJsonDocument(root).toJson());
+    return true;
+}
+
+bool readBaseline(const QString &path, BenchResults *results)
+{
+    QFile file(path);
+    if(!file.open(QFile::ReadOnly))
+        return false;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+    if(!doc.isObject())
+        return false;
+
+    results->clear();
+    for(const QJsonValue &value : doc.object().value("results").toArray())
+    {
+        QJsonObject object = value.toObject();
+        BenchResult result;
+        result.name = object.value("name").toString();
+        result.rate = object.value("rate").toDouble();
+        result.unit = object.value("unit").toString();
+        result.allocsPerFrame = object.value("allocsPerFrame").toDouble(-1);
+        result.peakMB = object.value("peakMB").toDouble(-1);
+        results->append(result);
+    }
+    return true;
+}
+
+QStringList compareBaseline(const BenchResults &baseline, const BenchResults &current, double tolerance, QStringList *notes)
+{
+    QStringList regressions;
+
+    for(const BenchResult &base : baseline)
+    {
+        const BenchResult *now = findResult(current, base.name);
+        if(!now)
+        {
+            notes->append(base.name + ": not run");
+            continue;
+        }
+
+        if(now->rate < base.rate * (1 - tolerance))
+            regressions.append(formatChange(base.name, now->unit, base.rate, now->rate));
+        if(base.allocsPerFrame >= 0 && now->allocsPerFrame >= 0 &&
+           now->allocsPerFrame > base.allocsPerFrame * (1 + tolerance) + kAllocsSlack)
+            regressions.append(formatChange(base.name, "allocs/frame", base.allocsPerFrame, now->allocsPerFrame));
+        if(base.peakMB >= 0 && now->peakMB >= 0 &&
+           now->peakMB > base.peakMB * (1 + tolerance) + kPeakMBSlack)
+            regressions.append(formatChange(base.name, "peak MB", base.peakMB, now->peakMB));
+    }
+
+    for(const BenchResult &now : current)
+        if(!findResult(baseline, now.name))
+            notes->append(now.name + ": not in baseline");
+
+    return regressions;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef BASELINE_H
+#define BASELINE_H
+
+#include "benchresult.h"
+
+#include <QStringList>
+
+/*
+ * Stored benchmark results, to gate changes against.
+ * A result regresses when its rate drops, or its allocations per frame or peak memory grow, by more than tolerance (e.g. 0.05 for 5%).
+ * Allocations and memory also get a small absolute slack, so noise around zero is not reported.
+ */
+bool writeBaseline(const QString &path, const BenchResults &results);
+bool readBaseline(const QString &path, BenchResults *results);
+
+// One line per regression, empty if none. Results missing from either side are listed in notes.
+QStringList compareBaseline(const BenchResults &baseline, const BenchResults &current, double tolerance, QStringList *notes);
+
+#endif // BASELINE_H
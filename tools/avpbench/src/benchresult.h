@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef BENCHRESULT_H
+#define BENCHRESULT_H
+
+#include <QList>
+#include <QString>
+
+struct BenchResult {
+    QString name;
+    double rate = 0;        // Work items processed per second
+    QString unit;
+    double speedup = 1.0;   // Relative to the reference implementation of the same group
+    double allocsPerFrame = -1;     // Negative when not measured
+    double peakMB = -1;             // Peak heap growth during the run, negative when not measured
+};
+
+typedef QList<BenchResult> BenchResults;
+
+#endif // BENCHRESULT_H
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "audiobench.h"
+#include "baseline.h"
+#include "videobench.h"
+
+#include "allocstats.h"
+#include "cpudispatch.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QTextStream>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("avpbench");
+    AVP::CpuDispatch::initFromEnvironment();
+
+    // Parse arguments
+    QCommandLineParser parser;
+    parser.setApplicationDescription("AVPStudio micro-benchmark runner");
+    parser.addHelpOption();
+    QCommandLineOption secondsOption("seconds", "Length of synthetic audio in seconds.", "seconds", "60");
+    QCommandLineOption framesOption("frames", "Number of synthetic video frames.", "count", "48");
+    QCommandLineOption iterationsOption("iterations", "Repeat each benchmark and keep the best run.", "count", "5");
+    QCommandLineOption cpuLevelOption("cpu-level", "Highest instruction set to benchmark: scalar, sse2, ssse3, avx2, avx512 or neon.", "level");
+    QCommandLineOption writeBaselineOption("write-baseline", "Store the results as a baseline file.", "path");
+    QCommandLineOption baselineOption("baseline", "Compare the results against a baseline file and fail on regressions.", "path");
+    QCommandLineOption toleranceOption("tolerance", "Allowed regression against the baseline in percent.", "percent", "5");
+    parser.addOptions({secondsOption, framesOption, iterationsOption, cpuLevelOption, writeBaselineOption, baselineOption, toleranceOption});
+    parser.process(a);
+
+    if(parser.isSet(cpuLevelOption) && !AVP::CpuDispatch::setLevel(parser.value(cpuLevelOption).toUtf8().constData()))
+    {
+        QTextStream(stderr) << "Unknown or unsupported CPU level: " << parser.value(cpuLevelOption) << Qt::endl;
+        return 1;
+    }
+
+    int seconds = qMax(1, parser.value(secondsOption).toInt());
+    int frames = qMax(1, parser.value(framesOption).toInt());
+    int iterations = qMax(1, parser.value(iterationsOption).toInt());
+    double tolerance = qMax(0.0, parser.value(toleranceOption).toDouble() / 100);
+
+    BenchResults baseline;
+    if(parser.isSet(baselineOption) && !readBaseline(parser.value(baselineOption), &baseline))
+    {
+        QTextStream(stderr) << "Cannot read baseline: " << parser.value(baselineOption) << Qt::endl;
+        return 1;
+    }
+
+    // Allocations per frame and peak memory of the video paths
+    AVP::AllocStats::start();
+
+    // Run benchmarks
+    QTextStream(stdout) << "CPU level: " << AVP::CpuDispatch::levelName(AVP::CpuDispatch::level()) << " (detected " << AVP::CpuDispatch::levelName(AVP::CpuDispatch::detectedLevel()) << ")" << Qt::endl;
+    BenchResults results;
+    results.append(runAudioBenchmarks(seconds, iterations));
+    results.append(runVideoBenchmarks(frames, iterations));
+
+    // Print results
+    QTextStream out(stdout);
+    for(const BenchResult &result : results)
+    {
+        out << result.name.leftJustified(32) << QString::number(result.rate, 'f', 2).rightJustified(12) << " " << result.unit.leftJustified(12) << "x" << QString::number(result.speedup, 'f', 2);
+        if(result.allocsPerFrame >= 0)
+            out << QString::number(result.allocsPerFrame, 'f', 2).rightJustified(10) << " allocs/frame";
+        if(result.peakMB >= 0)
+            out << QString::number(result.peakMB, 'f', 1).rightJustified(10) << " peak MB";
+        out << Qt::endl;
+    }
+
+    if(parser.isSet(writeBaselineOption) && !writeBaseline(parser.value(writeBaselineOption), results))
+    {
+        QTextStream(stderr) << "Cannot write baseline: " << parser.value(writeBaselineOption) << Qt::endl;
+        return 1;
+    }
+
+    // Regression gate
+    if(parser.isSet(baselineOption))
+    {
+        QStringList notes;
+        QStringList regressions = compareBaseline(baseline, results, tolerance, &notes);
+        for(const QString &note : notes)
+            out << "Note: " << note << Qt::endl;
+        if(!regressions.isEmpty())
+        {
+            out << Qt::endl << "Regressions beyond " << tolerance * 100 << "%:" << Qt::endl;
+            for(const QString &regression : regressions)
+                out << regression << Qt::endl;
+            return 1;
+        }
+        out << Qt::endl << "No regressions beyond " << tolerance * 100 << "%." << Qt::endl;
+    }
+
+    return 0;
+}
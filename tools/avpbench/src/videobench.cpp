@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "videobench.h"
+
+#include "allocstats.h"
+#include "avhandle.h"
+#include "codecsetup.h"
+#include "remap.h"
+#include "trace.h"
+
+#include <QElapsedTimer>
+
+extern "C" {
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+}
+
+#include <cmath>
+#include <functional>
+#include <vector>
+
+static const int kInputWidth = 1920;
+static const int kInputHeight = 1080;
+static const AVRational kFrameRate = {24, 1};
+
+// Moving gradient, so the encoder does not see static content
+static AVP::FramePtr makeSyntheticFrame(AVPixelFormat format, int width, int height, int index)
+{
+    AVP::FramePtr frame = AVP::makeFrame();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if(av_frame_get_buffer(frame.get(), 0) < 0)
+        return AVP::FramePtr();
+
+    for(int plane = 0; plane < 4 && frame->data[plane]; plane++)
+    {
+        // Chroma planes are subsampled, walking the line size is enough for a pattern
+        int planeHeight = plane == 0 ? height : AV_CEIL_RSHIFT(height, format == AV_PIX_FMT_YUV420P ? 1 : 0);
+        for(int y = 0; y < planeHeight; y++)
+        {
+            uint8_t *line = frame->data[plane] + (ptrdiff_t)y * frame->linesize[plane];
+            for(int x = 0; x < frame->linesize[plane]; x++)
+                line[x] = (uint8_t)(x + y * 2 + index * 4 + plane * 64);
+        }
+    }
+    return frame;
+}
+
+struct VideoWorkload {
+    int64_t frames = 0;
+    bool ok = true;
+};
+
+/*
+ * Runs frames through description, rescales each output to outFormat and optionally encodes it to MPEG-2.
+ * The remap table is applied before the rescale (unfold, as TDoExport) or after it (fold, as TDoProcess).
+ * Mirrors the per-frame loop of TDoProcess / TDoExport, including graph and codec setup.
+ */
+static VideoWorkload runVideoPath(const std::vector<AVP::FramePtr> &inputs, const std::string &description, const AVP::RemapTable &remap, bool remapFirst, AVPixelFormat outFormat, bool encode)
+{
+    VideoWorkload result;
+    const AVFrame *first = inputs.front().get();
+
+    AVP::FilterGraphPtr graph(avfilter_graph_alloc());
+    AVFilterContext *srcCxt = NULL;
+    AVFilterContext *sinkCxt = NULL;
+    if(AVP::createVideoFilterGraph(graph.get(), AVP::videoBufferArgs(first->width, first->height, first->format, av_inv_q(kFrameRate), {1, 1}), description, &srcCxt, &sinkCxt) < 0)
+    {
+        result.ok = false;
+        return result;
+    }
+
+    AVP::CodecContextPtr encoderCxt;
+    if(encode)
+    {
+        if(AVP::setupMxlVideoEncoder(encoderCxt.out(), 20.0, kFrameRate, AVCOL_PRI_BT709, AVCOL_TRC_BT709, AVCOL_SPC_BT709) < 0 ||
+           avcodec_open2(encoderCxt.get(), encoderCxt->codec, 0) < 0)
+        {
+            result.ok = false;
+            return result;
+        }
+    }
+
+    AVP::FramePool remapPool;
+    AVP::FramePool outPool;
+    AVP::FramePtr filtered = AVP::makeFrame();
+    AVP::PacketPtr packet = AVP::makePacket();
+    AVP::SwsContextPtr scaleCxt;
+
+    auto drainSink = [&]() {
+        while(av_buffersink_get_frame(sinkCxt, filtered.get()) >= 0)
+        {
+            AVP::PooledFrame outFrame;
+            if(remapFirst)
+            {
+                AVP::PooledFrame picture = remapPool.acquireVideo((AVPixelFormat)filtered->format, remap.getWidth(), remap.getHeight());
+                remap.apply(filtered.get(), picture.get());
+                if(!scaleCxt)
+                    scaleCxt.reset(sws_getContext(picture->width, picture->height, (AVPixelFormat)picture->format, picture->width, picture->height, outFormat, SWS_FAST_BILINEAR, 0, 0, 0));
+                outFrame = outPool.acquireVideo(outFormat, picture->width, picture->height);
+                sws_scale_frame(scaleCxt.get(), outFrame.get(), picture.get());
+            }
+            else
+            {
+                if(!scaleCxt)
+                    scaleCxt.reset(sws_getContext(filtered->width, filtered->height, (AVPixelFormat)filtered->format, filtered->width, filtered->height, outFormat, SWS_FAST_BILINEAR, 0, 0, 0));
+                AVP::PooledFrame canvas = remapPool.acquireVideo(outFormat, filtered->width, filtered->height);
+                sws_scale_frame(scaleCxt.get(), canvas.get(), filtered.get());
+                outFrame = outPool.acquireVideo(outFormat, remap.getWidth(), remap.getHeight());
+                remap.apply(canvas.get(), outFrame.get());
+            }
+            if(encode)
+            {
+                outFrame->pts = result.frames;
+                avcodec_send_frame(encoderCxt.get(), outFrame.get());
+                while(avcodec_receive_packet(encoderCxt.get(), packet.get()) >= 0)
+                    av_packet_unref(packet.get());
+            }
+            av_frame_unref(filtered.get());
+            result.frames++;
+        }
+    };
+
+    for(size_t i = 0; i < inputs.size(); i++)
+    {
+        AVP::FramePtr frame = AVP::makeFrame();
+        av_frame_ref(frame.get(), inputs[i].get());
+        frame->pts = i;
+        av_buffersrc_add_frame(srcCxt, frame.get());
+        drainSink();
+    }
+    av_buffersrc_add_frame(srcCxt, NULL);
+    drainSink();
+
+    if(encode)
+    {
+        avcodec_send_frame(encoderCxt.get(), NULL);
+        while(avcodec_receive_packet(encoderCxt.get(), packet.get()) >= 0)
+            av_packet_unref(packet.get());
+    }
+    return result;
+}
+
+// Remap alone, count times over the input frames in turn
+static VideoWorkload runRemap(const std::vector<AVP::FramePtr> &inputs, const AVP::RemapTable &remap, int count)
+{
+    VideoWorkload result;
+    AVP::FramePool outPool;
+    for(int i = 0; i < count; i++)
+    {
+        const AVFrame *input = inputs[i % inputs.size()].get();
+        AVP::PooledFrame outFrame = outPool.acquireVideo((AVPixelFormat)input->format, remap.getWidth(), remap.getHeight());
+        if(!outFrame || remap.apply(input, outFrame.get()) < 0)
+        {
+            result.ok = false;
+            return result;
+        }
+        result.frames++;
+    }
+    return result;
+}
+
+/*
+ * MPEG-2 encoding alone of 3840 x 2160 YUV422P frames at kEncodeBitRate.
+ * *psnr receives the PSNR of the reconstruction over all planes, the quality the speed tier buys at that bitrate.
+ */
+static const double kEncodeBitRate = 20.0;
+
+static VideoWorkload runEncode(const std::vector<AVP::FramePtr> &inputs, AVP::EncoderSpeed speed, double *psnr)
+{
+    VideoWorkload result;
+    AVP::CodecContextPtr encoderCxt;
+    if(AVP::setupMxlVideoEncoder(encoderCxt.out(), kEncodeBitRate, kFrameRate, AVCOL_PRI_BT709, AVCOL_TRC_BT709, AVCOL_SPC_BT709, speed) < 0)
+    {
+        result.ok = false;
+        return result;
+    }
+    encoderCxt->flags |= AV_CODEC_FLAG_PSNR;
+    if(avcodec_open2(encoderCxt.get(), encoderCxt->codec, 0) < 0)
+    {
+        result.ok = false;
+        return result;
+    }
+
+    AVP::PacketPtr packet = AVP::makePacket();
+    for(size_t i = 0; i <= inputs.size(); i++)
+    {
+        AVP::FramePtr frame;
+        if(i < inputs.size())
+        {
+            frame = AVP::makeFrame();
+            av_frame_ref(frame.get(), inputs[i].get());
+            frame->pts = i;
+        }
+        avcodec_send_frame(encoderCxt.get(), frame.get());
+        while(avcodec_receive_packet(encoderCxt.get(), packet.get()) >= 0)
+            av_packet_unref(packet.get());
+    }
+    result.frames = inputs.size();
+
+    // 4:2:2 has as many chroma samples as luma samples
+    double squaredError = (double)encoderCxt->error[0] + encoderCxt->error[1] + encoderCxt->error[2];
+    double samples = 2.0 * AVP::kAVPFrameWidth * AVP::kAVPFrameHeight * result.frames;
+    *psnr = squaredError > 0 ? 10 * log10(255.0 * 255.0 * samples / squaredError) : 99;
+    return result;
+}
+
+// Best of iterations, plus allocations per frame and peak heap growth of one run
+static BenchResult measureVideo(const QString &name, int iterations, const std::function<VideoWorkload()> &run)
+{
+    BenchResult result;
+    result.name = name;
+    result.unit = "frames/s";
+
+    QElapsedTimer timer;
+    qint64 best = -1;
+    int64_t frames = 0;
+    QByteArray stage = name.toUtf8();
+    for(int i = 0; i < iterations; i++)
+    {
+        AVP::AllocSnapshot before = AVP::AllocStats::snapshot();
+        int64_t liveBefore = AVP::AllocStats::liveBytes();
+        VideoWorkload workload;
+
+        timer.start();
+        {
+            AVP::TraceScope scope(stage.constData());
+            workload = run();
+        }
+        qint64 elapsed = timer.nsecsElapsed();
+        if(!workload.ok || workload.frames == 0)
+            return result;
+        if(best < 0 || elapsed < best)
+            best = elapsed;
+        frames = workload.frames;
+
+        // Counters of the first run include the one-time setup of FFmpeg tables, so the last run is kept
+        AVP::AllocSnapshot stats = AVP::AllocStats::diff(before, AVP::AllocStats::snapshot());
+        result.allocsPerFrame = (double)AVP::AllocStats::totalCount(stats) / workload.frames;
+        result.peakMB = 0;
+        for(const auto &stageStats : stats)
+            result.peakMB = qMax(result.peakMB, (stageStats.second.peakLiveBytes - liveBefore) / 1048576.0);
+    }
+    result.rate = frames / (best / 1e9);
+    return result;
+}
+
+BenchResults runVideoBenchmarks(int frames, int iterations)
+{
+    BenchResults results;
+
+    std::vector<AVP::FramePtr> sources;
+    std::vector<AVP::FramePtr> mxlFrames;
+    std::vector<AVP::FramePtr> images;
+    for(int i = 0; i < frames; i++)
+    {
+        sources.push_back(makeSyntheticFrame(AV_PIX_FMT_YUV420P, kInputWidth, kInputHeight, i));
+        mxlFrames.push_back(makeSyntheticFrame(AV_PIX_FMT_YUV422P, AVP::kAVPFrameWidth, AVP::kAVPFrameHeight, i));
+        if(!sources.back() || !mxlFrames.back())
+            return results;
+    }
+    images.push_back(makeSyntheticFrame(AV_PIX_FMT_RGB24, kInputWidth, kInputHeight, 0));
+    if(!images.back())
+        return results;
+
+    double standardRate = 0;
+    for(int i = 0; i < AVP::kEncoderSpeedCount; i++)
+    {
+        AVP::EncoderSpeed speed = (AVP::EncoderSpeed)i;
+        QString tier = AVP::getEncoderSpeedName(speed);
+        double psnr = 0;
+        BenchResult encode = measureVideo("encode/" + tier, iterations, [&]() {
+            return runEncode(mxlFrames, speed, &psnr);
+        });
+        results.append(encode);
+        if(encode.rate <= 0)
+            continue;
+        if(speed == AVP::kEncoderStandard)
+            standardRate = encode.rate;
+
+        BenchResult quality;
+        quality.name = "encode/" + tier + "/psnr";
+        quality.rate = psnr;
+        quality.unit = "dB";
+        results.append(quality);
+    }
+
+    // Speed of each tier relative to standard
+    for(BenchResult &result : results)
+        if(standardRate > 0 && result.unit == "frames/s")
+            result.speedup = result.rate / standardRate;
+
+    for(int i = AVP::kAVPSmallSize; i <= AVP::kAVPLargeSize; i++)
+    {
+        AVP::AVPSize size = (AVP::AVPSize)i;
+        const AVP::AVPLayout &layout = AVP::getLayout(size);
+        QString suffix = QString::fromStdString(layout.name).toLower();
+        AVP::RemapTable fold = AVP::RemapTable::compileFold(layout, AV_PIX_FMT_YUV422P);
+        AVP::RemapTable unfold = AVP::RemapTable::compileUnfold(layout, AV_PIX_FMT_YUV422P);
+
+        results.append(measureVideo("video/convert/" + suffix, iterations, [&]() {
+            return runVideoPath(sources, AVP::canvasGraph(size, kInputWidth, kInputHeight, false, kFrameRate), fold, false, AV_PIX_FMT_YUV422P, true);
+        }));
+        results.append(measureVideo("video/unfold/" + suffix, iterations, [&]() {
+            return runVideoPath(mxlFrames, "[in]null[out]", unfold, true, AV_PIX_FMT_YUV420P, false);
+        }));
+        results.append(measureVideo("video/organize/" + suffix, iterations, [&]() {
+            return runVideoPath(images, AVP::canvasGraph(size, kInputWidth, kInputHeight, false, {0, 0}), fold, false, AV_PIX_FMT_YUV422P, false);
+        }));
+
+        // Specialised kernels against the generic tables custom layouts use
+        std::vector<AVP::FramePtr> canvases;
+        canvases.push_back(makeSyntheticFrame(AV_PIX_FMT_YUV422P, layout.canvasWidth, layout.height, 0));
+        if(!canvases.back())
+            return results;
+        AVP::RemapTable genericFold = AVP::RemapTable::compileFold(layout, AV_PIX_FMT_YUV422P, false);
+        AVP::RemapTable genericUnfold = AVP::RemapTable::compileUnfold(layout, AV_PIX_FMT_YUV422P, false);
+        results.append(measureVideo("remap/fold/" + suffix, iterations, [&]() {
+            return runRemap(canvases, fold, frames);
+        }));
+        results.append(measureVideo("remap/fold_generic/" + suffix, iterations, [&]() {
+            return runRemap(canvases, genericFold, frames);
+        }));
+        results.append(measureVideo("remap/unfold/" + suffix, iterations, [&]() {
+            return runRemap(mxlFrames, unfold, frames);
+        }));
+        results.append(measureVideo("remap/unfold_generic/" + suffix, iterations, [&]() {
+            return runRemap(mxlFrames, genericUnfold, frames);
+        }));
+    }
+
+    return results;
+}
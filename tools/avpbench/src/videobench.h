@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef VIDEOBENCH_H
+#define VIDEOBENCH_H
+
+#include "benchresult.h"
+
+/*
+ * Video paths of AVPStudio and the tools on synthetic frames, for every AVP size:
+ * convert (remap -> YUV422 -> MPEG-2, AVPStudio), unfold (unfold -> YUV420, MXLPlayer export) and organize (still image remap, ImageOrganizer).
+ */
+BenchResults runVideoBenchmarks(int frames, int iterations);
+
+#endif // VIDEOBENCH_H
@@ -16,6 +16,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include "mainwindow.h"
+#include "avplayout.h"
 
 #include <QApplication>
 #include <QFile>
@@ -26,6 +27,9 @@ int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
+    // Layout descriptors next to the executable and in AVP_LAYOUT_PATH
+    AVP::loadLayouts(QCoreApplication::applicationDirPath().toStdString());
+
     QTranslator translator;
     const QStringList uiLanguages = QLocale::system().uiLanguages();
     for (const QString &locale : uiLanguages) {
@@ -18,6 +18,9 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
 
+#include "codecsetup.h"
+#include "remap.h"
+
 #define __STDC_CONSTANT_MACROS
 #define __STDC_FORMAT_MACROS
 
@@ -36,30 +39,7 @@ extern "C" {
 #include <QImage>
 #include <QMessageBox>
 #include <QPixmap>
-
-static const char *filterGraphLarge =
-    "[in]pad=iw:ih:0:0:black[expanded];"
-    "[expanded]scale=6166:1080[scaled];"
-    "[scaled]split[scaled1][scaled2];"
-    "[scaled1]crop=3840:1080:0:0[left];"
-    "[scaled2]crop=3840:1080:2327:0[right];"
-    "[left][right]vstack=2[out]";
-static const char *filterGraphMedium =
-    "[in]pad=iw:ih:0:0:black[expanded];"
-    "[expanded]scale=4632:1080[scaled];"
-    "[scaled]pad=6166:1080:767:0:black[padded];"
-    "[padded]split[padded1][padded2];"
-    "[padded1]crop=3840:1080:0:0[left];"
-    "[padded2]crop=3840:1080:2327:0[right];"
-    "[left][right]vstack=2[out]";
-static const char *filterGraphSmall =
-    "[in]pad=iw:ih:0:0:black[expanded];"
-    "[expanded]scale=2830:1080[scaled];"
-    "[scaled]pad=6166:1080:1668:0:black[padded];"
-    "[padded]split[padded1][padded2];"
-    "[padded1]crop=3840:1080:0:0[left];"
-    "[padded2]crop=3840:1080:2327:0[right];"
-    "[left][right]vstack=2[out]";
+#include <QRadioButton>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -67,6 +47,15 @@ MainWindow::MainWindow(QWidget *parent)
 {
     ui->setupUi(this);
 
+    // One more size button per loaded layout
+    for(int i = AVP::kAVPBuiltinLayouts; i < AVP::getLayoutCount(); i++)
+    {
+        AVP::AVPSize size = (AVP::AVPSize)i;
+        QRadioButton *radioButton = new QRadioButton(QString::fromStdString(AVP::getLayout(size).name), ui->groupBoxSizeSettings);
+        ui->horizontalLayout->addWidget(radioButton);
+        connect(radioButton, &QRadioButton::clicked, this, [this, size]() { selectLoadedLayout(size); });
+    }
+
     this->setWindowFlags(windowFlags()& ~Qt::WindowMaximizeButtonHint);
     this->setFixedSize(this->width(), this->height());
 }
@@ -83,7 +72,6 @@ void MainWindow::on_radioButtonSmallSize_clicked(bool checked)
     ui->labelImagePreview->setMaximumSize(700, 266);
     on_lineEditInPath_editingFinished();
     settings.size = AVP::kAVPSmallSize;
-    settings.width = 2830;
 }
 
 void MainWindow::on_radioButtonMediumSize_clicked(bool checked)
@@ -93,7 +81,6 @@ void MainWindow::on_radioButtonMediumSize_clicked(bool checked)
     ui->labelImagePreview->setMaximumSize(700, 161);
     on_lineEditInPath_editingFinished();
     settings.size = AVP::kAVPMediumSize;
-    settings.width = 4633;
 }
 
 
@@ -104,7 +91,18 @@ void MainWindow::on_radioButtonLargeSize_clicked(bool checked)
     ui->labelImagePreview->setMaximumSize(700, 122);
     on_lineEditInPath_editingFinished();
     settings.size = AVP::kAVPLargeSize;
-    settings.width = 6167;
+}
+
+
+void MainWindow::selectLoadedLayout(AVP::AVPSize size)
+{
+    const AVP::AVPLayout &layout = AVP::getLayout(size);
+    int previewHeight = 700 * layout.height / layout.width;
+    ui->labelSize->setText(tr("尺寸信息：%1 / 分辨率：%2 x %3").arg(QString::fromStdString(layout.realSize)).arg(layout.width).arg(layout.height));
+    ui->labelImagePreview->setMinimumSize(700, previewHeight);
+    ui->labelImagePreview->setMaximumSize(700, previewHeight);
+    on_lineEditInPath_editingFinished();
+    settings.size = size;
 }
 
 
@@ -176,30 +174,11 @@ void MainWindow::on_pushButtonConvert_clicked()
     if(settings.isDolbyNaming)
     {
         QFileInfo outputFileInfo(settings.fileOutputPath);
-        switch(settings.size)
-        {
-        case AVP::kAVPSmallSize:
-            settings.fileOutputPath = outputFileInfo.absolutePath() + "/V2_" + outputFileInfo.baseName() + "_video_5m." + outputFileInfo.suffix();
-            break;
-        case AVP::kAVPMediumSize:
-            settings.fileOutputPath = outputFileInfo.absolutePath() + "/V2_" + outputFileInfo.baseName() + "_video_9m." + outputFileInfo.suffix();
-            break;
-        case AVP::kAVPLargeSize:
-            settings.fileOutputPath = outputFileInfo.absolutePath() + "/V2_" + outputFileInfo.baseName() + "_video_12m." + outputFileInfo.suffix();
-            break;
-        }
+        settings.fileOutputPath = outputFileInfo.absolutePath() + "/V2_" + outputFileInfo.baseName() + "_video_" + QString::fromStdString(AVP::getLayout(settings.size).dolbySuffix) + "." + outputFileInfo.suffix();
     }
     doConversion();
 }
 
-template<typename T> int toUpperInt(T val)
-{
-    if((int)val % 2 == 1)
-        return (int)val + 1;
-    else
-        return (int)val;
-}
-
 void MainWindow::doConversion()
 {
     // FFmpeg init
@@ -225,21 +204,18 @@ void MainWindow::doConversion()
     AVPacket *packet = NULL;
     AVFrame *imageFrameIn = NULL;
     AVFrame *imageFrameFiltered = NULL;
+    AVFrame *imageFrameCanvas = NULL;
     AVFrame *imageFrameOut = NULL;
 
     AVFilterGraph *imageFilterGraph = NULL;
-    AVFilterInOut *imageFilterInput = NULL;
-    AVFilterInOut *imageFilterOutput = NULL;
-
-    AVFilterContext *imageFilterPadCxt = NULL;
-
-    const AVFilter *imageFilterSrc = NULL;
     AVFilterContext *imageFilterSrcCxt = NULL;
-    const AVFilter *imageFilterSink = NULL;
     AVFilterContext *imageFilterSinkCxt = NULL;
 
     SwsContext *scaleCxt = NULL;
 
+    const AVP::AVPLayout &layout = AVP::getLayout(settings.size);
+    AVP::RemapTable foldTable;
+
     // Open input file and find stream info
     iImageFmtCxt = avformat_alloc_context();
     avError = avformat_open_input(&iImageFmtCxt, settings.fileInputPath.toUtf8(), 0, 0);
@@ -264,14 +240,7 @@ void MainWindow::doConversion()
     }
 
     // Open decoder
-    iImageDecoderCxt = avcodec_alloc_context3(iImageDecoder);
-    avError = avcodec_parameters_to_context(iImageDecoderCxt, iImageFmtCxt->streams[iImageStreamID]->codecpar);
-    if(avError < 0)
-    {
-        QMessageBox::critical(this, tr("加载文件失败"), tr("没有对应的图片解码器。"));
-        goto end;
-    }
-    avError = avcodec_open2(iImageDecoderCxt, iImageDecoder, 0);
+    avError = AVP::openDecoder(iImageFmtCxt->streams[iImageStreamID], iImageDecoder, &iImageDecoderCxt);
     if(avError < 0)
     {
         QMessageBox::critical(this, tr("加载文件失败"), tr("无法打开图片解码器。"));
@@ -289,8 +258,8 @@ void MainWindow::doConversion()
         goto end;
     }
     oImageEncoderCxt = avcodec_alloc_context3(oImageEncoder);
-    oImageEncoderCxt -> width = 3840;
-    oImageEncoderCxt -> height = 2160;
+    oImageEncoderCxt -> width = AVP::kAVPFrameWidth;
+    oImageEncoderCxt -> height = AVP::kAVPFrameHeight;
     if(oImageFileInfo.suffix() == "jpg")
         oImageEncoderCxt -> pix_fmt = AV_PIX_FMT_YUVJ420P;
     else if(oImageFileInfo.suffix() == "png")
@@ -337,117 +306,34 @@ void MainWindow::doConversion()
 
     imageFrameIn = av_frame_alloc();
     imageFrameFiltered = av_frame_alloc();
+    imageFrameCanvas = av_frame_alloc();
     imageFrameOut = av_frame_alloc();
 
     // Set image filter
     imageFilterGraph = avfilter_graph_alloc();
-
-    imageFilterSrc = avfilter_get_by_name("buffer");
-    char imageFilterSrcArgs[512];
-    snprintf(imageFilterSrcArgs, sizeof(imageFilterSrcArgs), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d", iImageDecoderCxt->width, iImageDecoderCxt->height, iImageDecoderCxt->pix_fmt, iImageFmtCxt->streams[iImageStreamID]->time_base.num, iImageFmtCxt->streams[iImageStreamID]->time_base.den, iImageDecoderCxt->sample_aspect_ratio.num, iImageDecoderCxt->sample_aspect_ratio.den);
-    avError = avfilter_graph_create_filter(&imageFilterSrcCxt, imageFilterSrc, "in", imageFilterSrcArgs, 0, imageFilterGraph);
-
-    imageFilterSink = avfilter_get_by_name("buffersink");
-    avError = avfilter_graph_create_filter(&imageFilterSinkCxt, imageFilterSink, "out", 0, 0, imageFilterGraph);
-
-    imageFilterInput = avfilter_inout_alloc();
-    imageFilterInput -> name = av_strdup("in");
-    imageFilterInput -> filter_ctx = imageFilterSrcCxt;
-    imageFilterInput -> pad_idx = 0;
-    imageFilterInput -> next = NULL;
-
-    imageFilterOutput = avfilter_inout_alloc();
-    imageFilterOutput -> name = av_strdup("out");
-    imageFilterOutput -> filter_ctx = imageFilterSinkCxt;
-    imageFilterOutput -> pad_idx = 0;
-    imageFilterOutput -> next = NULL;
-
-    switch(settings.size)
-    {
-    case AVP::kAVPLargeSize:
-        avError = avfilter_graph_parse_ptr(imageFilterGraph, filterGraphLarge, &imageFilterOutput, &imageFilterInput, 0);
-        break;
-    case AVP::kAVPMediumSize:
-        avError = avfilter_graph_parse_ptr(imageFilterGraph, filterGraphMedium, &imageFilterOutput, &imageFilterInput, 0);
-        break;
-    case AVP::kAVPSmallSize:
-        avError = avfilter_graph_parse_ptr(imageFilterGraph, filterGraphSmall, &imageFilterOutput, &imageFilterInput, 0);
-        break;
-    }
-
-    imageFilterPadCxt = avfilter_graph_get_filter(imageFilterGraph, "Parsed_pad_0");
-
-    /*
-     * Special note to this fix:
-     * Unlike videos, images may have an odd width/height.
-     * The "pad" filter receives an odd size and automatically rounds down to an even number. If the rounded size is smaller than the size of the input image, the filter system will throw an exception.
-     * So it is necessary to manually adjust the parameters of the incoming "pad" filter to accept even data with a larger size than the input content.
-     */
-    avError = av_opt_set(imageFilterPadCxt, "width", QString::number(toUpperInt(iImageDecoderCxt->width)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-    avError = av_opt_set(imageFilterPadCxt, "height", QString::number(toUpperInt(iImageDecoderCxt->height)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-    if(iImageDecoderCxt->width == settings.width && iImageDecoderCxt->height == 1080)
-        settings.isExtended = false;
-
-
-    if(!settings.isExtended)
+    avError = AVP::createVideoFilterGraph(imageFilterGraph,
+                                          AVP::videoBufferArgs(iImageDecoderCxt->width, iImageDecoderCxt->height, iImageDecoderCxt->pix_fmt, iImageFmtCxt->streams[iImageStreamID]->time_base, iImageDecoderCxt->sample_aspect_ratio),
+                                          AVP::canvasGraph(settings.size, iImageDecoderCxt->width, iImageDecoderCxt->height, settings.isExtended, {0, 0}),
+                                          &imageFilterSrcCxt, &imageFilterSinkCxt);
+    if(avError < 0)
     {
-        if((iImageDecoderCxt->width / iImageDecoderCxt->height) < (settings.width / 1080))
-        {
-            switch(settings.size)
-            {
-            case AVP::kAVPLargeSize:
-                avError = av_opt_set(imageFilterPadCxt, "width", QString::number(toUpperInt(iImageDecoderCxt->height * 5.71)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "height", QString::number(toUpperInt(iImageDecoderCxt->height)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "x", QString::number(toUpperInt(((iImageDecoderCxt->height * 5.71) / 2) - (iImageDecoderCxt->width / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            case AVP::kAVPMediumSize:
-                avError = av_opt_set(imageFilterPadCxt, "width", QString::number(toUpperInt(iImageDecoderCxt->height * 4.29)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "height", QString::number(toUpperInt(iImageDecoderCxt->height)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "x", QString::number(toUpperInt(((iImageDecoderCxt->height * 4.29) / 2) - (iImageDecoderCxt->width / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            case AVP::kAVPSmallSize:
-                avError = av_opt_set(imageFilterPadCxt, "width", QString::number(toUpperInt(iImageDecoderCxt->height * 2.62)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "height", QString::number(toUpperInt(iImageDecoderCxt->height)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "x", QString::number(toUpperInt(((iImageDecoderCxt->height * 2.62) / 2) - (iImageDecoderCxt->width / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            }
-        }
-        else if((iImageDecoderCxt->width / iImageDecoderCxt->height) > (settings.width / 1080))
-        {
-            switch(settings.size)
-            {
-            case AVP::kAVPLargeSize:
-                avError = av_opt_set(imageFilterPadCxt, "width", QString::number(toUpperInt(iImageDecoderCxt->width)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "height", QString::number(toUpperInt(iImageDecoderCxt->width * 0.175)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "y", QString::number(toUpperInt(((iImageDecoderCxt->width * 0.175) / 2) - (iImageDecoderCxt->height / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            case AVP::kAVPMediumSize:
-                avError = av_opt_set(imageFilterPadCxt, "width", QString::number(toUpperInt(iImageDecoderCxt->width)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "height", QString::number(toUpperInt(iImageDecoderCxt->width * 0.233)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "y", QString::number(toUpperInt(((iImageDecoderCxt->width * 0.233) / 2) - (iImageDecoderCxt->height / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            case AVP::kAVPSmallSize:
-                avError = av_opt_set(imageFilterPadCxt, "width", QString::number(toUpperInt(iImageDecoderCxt->width)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "height", QString::number(toUpperInt(iImageDecoderCxt->width * 0.382)).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                avError = av_opt_set(imageFilterPadCxt, "y", QString::number(toUpperInt(((iImageDecoderCxt->width * 0.382) / 2) - (iImageDecoderCxt->height / 2))).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-                break;
-            }
-        }
+        QMessageBox::critical(this, tr("转换出错"), tr("不能创建滤镜链。\n尝试改变输入文件尺寸（保持宽度、高度均为偶数）\n或关闭“拉伸图片以填充”重试。"));
+        goto end;
     }
 
-    avError = avfilter_graph_config(imageFilterGraph, 0);
+    // Set YUV420/RGBA rescaler and the fold into the output image
+    scaleCxt = sws_getContext(layout.canvasWidth, layout.height, iImageDecoderCxt->pix_fmt, layout.canvasWidth, layout.height, oImageEncoderCxt->pix_fmt, SWS_FAST_BILINEAR, 0, 0, 0);
+    foldTable = AVP::RemapTable::compileFold(layout, oImageEncoderCxt->pix_fmt);
+    imageFrameOut -> format = oImageEncoderCxt->pix_fmt;
+    imageFrameOut -> width = AVP::kAVPFrameWidth;
+    imageFrameOut -> height = AVP::kAVPFrameHeight;
+    avError = av_frame_get_buffer(imageFrameOut, 0);
     if(avError < 0)
     {
-        QMessageBox::critical(this, tr("转换出错"), tr("不能创建滤镜链。\n尝试改变输入文件尺寸（保持宽度、高度均为偶数）\n或关闭“拉伸图片以填充”重试。"));
+        QMessageBox::critical(this, tr("转换出错"), tr("无法分配输出图片内存。"));
         goto end;
     }
 
-    // Set YUV420/RGBA rescaler
-    if(oImageFileInfo.suffix() == "jpg")
-        scaleCxt = sws_getContext(3840, 2160, iImageDecoderCxt->pix_fmt, 3840, 2160, AV_PIX_FMT_YUVJ420P, SWS_FAST_BILINEAR, 0, 0, 0);
-    else if(oImageFileInfo.suffix() == "png")
-        scaleCxt = sws_getContext(3840, 2160, iImageDecoderCxt->pix_fmt, 3840, 2160, AV_PIX_FMT_RGBA, SWS_FAST_BILINEAR, 0, 0, 0);
-
     // Decode input
     avError = av_read_frame(iImageFmtCxt, packet);
     avError = avcodec_send_packet(iImageDecoderCxt, packet);
@@ -457,8 +343,9 @@ void MainWindow::doConversion()
     avError = av_buffersrc_add_frame(imageFilterSrcCxt, imageFrameIn);
     avError = av_buffersink_get_frame(imageFilterSinkCxt, imageFrameFiltered);
 
-    // Rescale to YUV420/RGBA
-    avError = sws_scale_frame(scaleCxt, imageFrameOut, imageFrameFiltered);
+    // Rescale to YUV420/RGBA and fold the canvas
+    avError = sws_scale_frame(scaleCxt, imageFrameCanvas, imageFrameFiltered);
+    avError = foldTable.apply(imageFrameCanvas, imageFrameOut);
 
     // Encode
     avError = avcodec_send_frame(oImageEncoderCxt, imageFrameOut);
@@ -486,15 +373,10 @@ end:    // Jump flag for errors
     av_packet_free(&packet);
     av_frame_free(&imageFrameIn);
     av_frame_free(&imageFrameFiltered);
+    av_frame_free(&imageFrameCanvas);
     av_frame_free(&imageFrameOut);
 
-    avfilter_free(imageFilterPadCxt);
-    avfilter_free(imageFilterSrcCxt);
-    avfilter_free(imageFilterSinkCxt);
-
     avfilter_graph_free(&imageFilterGraph);
-    avfilter_inout_free(&imageFilterInput);
-    avfilter_inout_free(&imageFilterOutput);
 
     sws_freeContext(scaleCxt);
 }
@@ -18,6 +18,8 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include "avplayout.h"
+
 #include <QMainWindow>
 
 QT_BEGIN_NAMESPACE
@@ -26,14 +28,6 @@ class MainWindow;
 }
 QT_END_NAMESPACE
 
-namespace AVP {
-enum AVPSize {
-    kAVPSmallSize,
-    kAVPMediumSize,
-    kAVPLargeSize
-};
-}
-
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -66,11 +60,12 @@ private:
 
     void doConversion();
 
+    // Size selection of layouts loaded from descriptors
+    void selectLoadedLayout(AVP::AVPSize size);
+
     struct
     {
         AVP::AVPSize size = AVP::kAVPMediumSize;
-        int width = 4633;
-        int height = 1080;
         QString fileInputPath = "";
         QString fileOutputPath = "";
         bool isDolbyNaming = true;
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "audioring.h"
+
+#include <algorithm>
+#include <cstring>
+
+AudioRing::AudioRing()
+{
+    spaceAvailable = SDL_CreateSemaphore(0);
+}
+
+AudioRing::~AudioRing()
+{
+    SDL_DestroySemaphore(spaceAvailable);
+}
+
+void AudioRing::init(int frameBytes, int capacity)
+{
+    uint64_t size = 1;
+    while(size < (uint64_t)capacity)
+        size <<= 1;
+    this->frameBytes = frameBytes;
+    buffer.assign(size * frameBytes, 0);
+    mask = size - 1;
+}
+
+bool AudioRing::write(const uint8_t *data, int samples, int64_t firstSample)
+{
+    uint64_t write = writePosition.load(std::memory_order_relaxed);
+    const int64_t offset = firstSample - (int64_t)write;
+
+    while(samples > 0)
+    {
+        if(closed.load(std::memory_order_acquire) || woken.load(std::memory_order_acquire))
+            return false;
+
+        uint64_t space = mask + 1 - (write - readPosition.load(std::memory_order_acquire));
+        if(space == 0)
+        {
+            // Announce the wait before checking again, so a read in between either sees it or is seen
+            producerWaiting.store(true, std::memory_order_seq_cst);
+            if(mask + 1 - (write - readPosition.load(std::memory_order_seq_cst)) == 0 && !closed.load() && !woken.load())
+                SDL_SemWait(spaceAvailable);
+            producerWaiting.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Stamped again by every write, so a jump in the stream only skews the clock until the samples before it are played
+        sampleOffset.store(offset, std::memory_order_relaxed);
+
+        // Up to the end of the buffer, the rest in the next round
+        uint64_t index = write & mask;
+        int count = (int)std::min<uint64_t>({space, (uint64_t)samples, mask + 1 - index});
+        memcpy(buffer.data() + index * frameBytes, data, (size_t)count * frameBytes);
+        data += (size_t)count * frameBytes;
+        samples -= count;
+        write += count;
+        writePosition.store(write, std::memory_order_release);
+    }
+    return true;
+}
+
+void AudioRing::clearWake()
+{
+    woken.store(false, std::memory_order_release);
+}
+
+int AudioRing::read(uint8_t *data, int samples, int64_t *streamSample)
+{
+    uint64_t read = readPosition.load(std::memory_order_relaxed);
+    uint64_t write = writePosition.load(std::memory_order_acquire);
+    uint64_t discard = discardPosition.load(std::memory_order_acquire);
+    if(read < discard)
+        read = std::min(discard, write);
+    *streamSample = (int64_t)read + sampleOffset.load(std::memory_order_relaxed);
+
+    int total = (int)std::min<uint64_t>(write - read, (uint64_t)samples);
+    for(int done = 0; done < total; )
+    {
+        uint64_t index = read & mask;
+        int count = (int)std::min<uint64_t>(total - done, mask + 1 - index);
+        memcpy(data + (size_t)done * frameBytes, buffer.data() + index * frameBytes, (size_t)count * frameBytes);
+        done += count;
+        read += count;
+    }
+    readPosition.store(read, std::memory_order_seq_cst);
+
+    if(producerWaiting.exchange(false, std::memory_order_seq_cst))
+        SDL_SemPost(spaceAvailable);
+    return total;
+}
+
+void AudioRing::discard()
+{
+    uint64_t write = writePosition.load(std::memory_order_acquire);
+    uint64_t discard = discardPosition.load(std::memory_order_relaxed);
+    while(discard < write && !discardPosition.compare_exchange_weak(discard, write, std::memory_order_release, std::memory_order_relaxed))
+        ;
+}
+
+void AudioRing::wake()
+{
+    woken.store(true, std::memory_order_release);
+    SDL_SemPost(spaceAvailable);
+}
+
+void AudioRing::close()
+{
+    closed.store(true, std::memory_order_release);
+    SDL_SemPost(spaceAvailable);
+}
+
+int AudioRing::getFill() const
+{
+    uint64_t write = writePosition.load(std::memory_order_acquire);
+    uint64_t read = std::max(readPosition.load(std::memory_order_acquire), discardPosition.load(std::memory_order_acquire));
+    return write > read ? (int)(write - read) : 0;
+}
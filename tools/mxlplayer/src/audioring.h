@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef AUDIORING_H
+#define AUDIORING_H
+
+#include <SDL.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Single-producer/single-consumer ring of interleaved samples between the MXLPlayer audio decoder (producer) and the SDL audio callback (consumer).
+ * The consumer never blocks nor takes a lock: positions are atomics, and it only posts a semaphore when the producer sleeps on it.
+ * Positions count sample frames since the start and never wrap. Each position maps to a stream sample through an offset stamped by the producer.
+ * After a seek, everything written before it is skipped by the consumer (discard), which keeps both sides single-threaded on their index.
+ */
+class AudioRing {
+public:
+    AudioRing();
+    ~AudioRing();
+    AudioRing(const AudioRing &) = delete;
+    AudioRing &operator=(const AudioRing &) = delete;
+
+    // frameBytes: size of one sample of every channel. capacity (in samples) is rounded up to a power of two
+    void init(int frameBytes, int capacity);
+
+    // Producer. Blocks while full. firstSample: stream sample of data[0]. Returns false if woken by wake() or close() before all was written
+    bool write(const uint8_t *data, int samples, int64_t firstSample);
+    // Producer: after wake(), before write() is called again
+    void clearWake();
+
+    // Consumer, lock-free. Returns the samples read; *streamSample is the stream sample of the first one
+    int read(uint8_t *data, int samples, int64_t *streamSample);
+
+    // Any thread: the consumer skips everything written so far
+    void discard();
+    // Any thread: interrupts a blocked write (e.g. for a seek)
+    void wake();
+    // Any thread: write() returns false from now on
+    void close();
+
+    // Any thread: samples written and not yet read nor discarded, approximate while either side runs
+    int getFill() const;
+    int getCapacity() const { return (int)(mask + 1); }
+
+private:
+    std::vector<uint8_t> buffer;
+    uint64_t mask = 0;
+    int frameBytes = 0;
+
+    std::atomic<uint64_t> writePosition{0};     // Producer only writes
+    std::atomic<uint64_t> readPosition{0};      // Consumer only writes
+    std::atomic<uint64_t> discardPosition{0};   // Only grows
+    std::atomic<int64_t> sampleOffset{0};       // Stream sample minus position
+    std::atomic<bool> producerWaiting{false};
+    std::atomic<bool> woken{false};
+    std::atomic<bool> closed{false};
+    SDL_sem *spaceAvailable = NULL;
+};
+
+#endif // AUDIORING_H
@@ -17,9 +17,17 @@
  */
 #include "doexport.h"
 
+#include "allocstats.h"
+#include "avhandle.h"
+#include "codecsetup.h"
+#include "remap.h"
+#include "trace.h"
+
 #define __STDC_CONSTANT_MACROS
 #define __STDC_FORMAT_MACROS
 
+#include <cstdio>
+
 extern "C" {
 #include <libavutil/avutil.h>
 #include <libavutil/opt.h>
@@ -34,23 +42,6 @@ extern "C" {
 #include <libswresample/swresample.h>
 }
 
-// FFmpeg filter graph description
-static const char *filterGraphLarge =
-    "[in]split[in1][in2];"
-    "[in1]crop=3840:1080:0:0[left];"
-    "[in2]crop=2326:1080:1513:1080[right];"
-    "[left][right]hstack=2[out]";
-static const char *filterGraphMedium =
-    "[in]split[in1][in2];"
-    "[in1]crop=3073:1080:767:0[left];"
-    "[in2]crop=1559:1080:1513:1080[right];"
-    "[left][right]hstack=2[out]";
-static const char *filterGraphSmall =
-    "[in]split[in1][in2];"
-    "[in1]crop=2172:1080:1668:0[left];"
-    "[in2]crop=658:1080:1513:1080[right];"
-    "[left][right]hstack=2[out]";
-
 TDoExport::TDoExport(QObject *parent, QString mxlPath, QString wavPath, QString videoPath, AVP::AVPSize size)
     : QThread{parent}
 {
@@ -92,17 +83,10 @@ void TDoExport::run()
     AVPacket *packet = NULL;
 
     AVFrame *vFrameIn = NULL;
-    AVFrame *vFrameFiltered = NULL;
-    AVFrame *vFrameOut = NULL;
+    AVP::FramePool vPicturePool;
+    AVP::FramePool vFrameOutPool;
 
-    AVFilterGraph *videoFilterGraph = NULL;
-    AVFilterInOut *videoFilterInput = NULL;
-    AVFilterInOut *videoFilterOutput = NULL;
-
-    const AVFilter *videoFilterSrc = NULL;
-    AVFilterContext *videoFilterSrcCxt = NULL;
-    const AVFilter *videoFilterSink = NULL;
-    AVFilterContext *videoFilterSinkCxt = NULL;
+    AVP::RemapTable unfoldTable;
 
     SwsContext *scale420Cxt = NULL;
 
@@ -116,8 +100,16 @@ void TDoExport::run()
     AVAudioFifo *aFifo = NULL;
     uint8_t **aSamples = NULL;
     int aSamplesLineSize;
+    int aSamplesCapacity = 0;
+    AVP::FramePool aFrameOutPool;
     uint64_t audioPTSCounter = 0;
 
+    int64_t traceTime = -1;
+
+    AVP::AllocSnapshot allocBegin = AVP::AllocStats::snapshot();
+
+    AVP::Trace::setThreadName("TDoExport");
+
     // Open input file and find stream info
     iVideoFmtCxt = avformat_alloc_context();
     avError = avformat_open_input(&iVideoFmtCxt, mxlPath.toUtf8(), 0, 0);
@@ -167,14 +159,7 @@ void TDoExport::run()
     }
 
     // Open decoder
-    iVideoDecoderCxt = avcodec_alloc_context3(iVideoDecoder);
-    avError = avcodec_parameters_to_context(iVideoDecoderCxt, iVideoFmtCxt->streams[iVideoStreamID]->codecpar);
-    if(avError < 0)
-    {
-        emit showError(tr("打开MXL出错"), tr("无法加载解码器。"));
-        goto end;
-    }
-    avError = avcodec_open2(iVideoDecoderCxt, iVideoDecoder, 0);
+    avError = AVP::openDecoder(iVideoFmtCxt->streams[iVideoStreamID], iVideoDecoder, &iVideoDecoderCxt);
     if(avError < 0)
     {
         emit showError(tr("打开MXL出错"), tr("无法打开解码器。"));
@@ -183,14 +168,7 @@ void TDoExport::run()
 
     if(!wavPath.isEmpty())
     {
-        iAudioDecoderCxt = avcodec_alloc_context3(iAudioDecoder);
-        avError = avcodec_parameters_to_context(iAudioDecoderCxt, iAudioFmtCxt->streams[iAudioStreamID]->codecpar);
-        if(avError < 0)
-        {
-            emit showError(tr("打开WAV出错"), tr("无法加载解码器。"));
-            goto end;
-        }
-        avError = avcodec_open2(iAudioDecoderCxt, iAudioDecoder, 0);
+        avError = AVP::openDecoder(iAudioFmtCxt->streams[iAudioStreamID], iAudioDecoder, &iAudioDecoderCxt);
         if(avError < 0)
         {
             emit showError(tr("打开WAV出错"), tr("无法打开解码器。"));
@@ -199,7 +177,7 @@ void TDoExport::run()
     }
 
     // Check for video info
-    if(iVideoDecoderCxt->width != 3840 || iVideoDecoderCxt->height != 2160)
+    if(iVideoDecoderCxt->width != AVP::kAVPFrameWidth || iVideoDecoderCxt->height != AVP::kAVPFrameHeight)
     {
         emit showError(tr("打开MXL出错"), tr("不支持的视频尺寸。"));
         goto end;
@@ -210,19 +188,8 @@ void TDoExport::run()
     oVideoEncoderCxt = avcodec_alloc_context3(oVideoEncoder);
     av_opt_set(oVideoEncoderCxt->priv_data, "preset", "slow", 0);
     oVideoEncoderCxt -> time_base = av_inv_q(iVideoDecoderCxt->framerate);
-    switch(size)
-    {
-    case AVP::kAVPSmallSize:
-        oVideoEncoderCxt -> width = 2830;
-        break;
-    case AVP::kAVPMediumSize:
-        oVideoEncoderCxt -> width = 4632;
-        break;
-    case AVP::kAVPLargeSize:
-        oVideoEncoderCxt -> width = 6166;
-        break;
-    }
-    oVideoEncoderCxt -> height = 1080;
+    oVideoEncoderCxt -> width = AVP::getLayout(size).pictureWidth;
+    oVideoEncoderCxt -> height = AVP::getLayout(size).height;
     oVideoEncoderCxt -> pix_fmt = AV_PIX_FMT_YUV420P;
     oVideoEncoderCxt -> gop_size = 10;
     oVideoEncoderCxt -> max_b_frames = 4;
@@ -314,84 +281,63 @@ void TDoExport::run()
 
     // Convert video
     vFrameIn = av_frame_alloc();
-    vFrameFiltered = av_frame_alloc();
-    vFrameOut = av_frame_alloc();
 
     emit setProgressText(tr("转换视频中..."));
     emit setProgressMax(iVideoFmtCxt->streams[iVideoStreamID]->duration * av_q2d(iVideoFmtCxt->streams[iVideoStreamID]->time_base));
 
-    // Set video filter
-    videoFilterGraph = avfilter_graph_alloc();
-
-    videoFilterSrc = avfilter_get_by_name("buffer");
-    char videoFilterSrcArgs[512];
-    snprintf(videoFilterSrcArgs, sizeof(videoFilterSrcArgs), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d", iVideoDecoderCxt->width, iVideoDecoderCxt->height, iVideoDecoderCxt->pix_fmt, iVideoFmtCxt->streams[iVideoStreamID]->time_base.num, iVideoFmtCxt->streams[iVideoStreamID]->time_base.den, iVideoDecoderCxt->sample_aspect_ratio.num, iVideoDecoderCxt->sample_aspect_ratio.den);
-    avError = avfilter_graph_create_filter(&videoFilterSrcCxt, videoFilterSrc, "in", videoFilterSrcArgs, 0, videoFilterGraph);
-
-    videoFilterSink = avfilter_get_by_name("buffersink");
-    avError = avfilter_graph_create_filter(&videoFilterSinkCxt, videoFilterSink, "out", 0, 0, videoFilterGraph);
-
-    videoFilterInput = avfilter_inout_alloc();
-    videoFilterInput -> name = av_strdup("in");
-    videoFilterInput -> filter_ctx = videoFilterSrcCxt;
-    videoFilterInput -> pad_idx = 0;
-    videoFilterInput -> next = NULL;
-
-    videoFilterOutput = avfilter_inout_alloc();
-    videoFilterOutput -> name = av_strdup("out");
-    videoFilterOutput -> filter_ctx = videoFilterSinkCxt;
-    videoFilterOutput -> pad_idx = 0;
-    videoFilterOutput -> next = NULL;
-
-    switch(size)
-    {
-    case AVP::kAVPLargeSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphLarge, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    case AVP::kAVPMediumSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphMedium, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    case AVP::kAVPSmallSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphSmall, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    }
-
-    avError = avfilter_graph_config(videoFilterGraph, 0);
-    if(avError < 0)
+    // Set unfold table
+    unfoldTable = AVP::RemapTable::compileUnfold(AVP::getLayout(size), iVideoDecoderCxt->pix_fmt);
+    if(!unfoldTable.isValid())
     {
-        emit showError(tr("转换出错"), tr("不能创建滤镜链。"));
+        emit showError(tr("转换出错"), tr("不支持的MXL像素格式。"));
         goto end;
     }
 
     // Set YUV420 rescaler
-    scale420Cxt = sws_getContext(oVideoEncoderCxt -> width, 1080, iVideoDecoderCxt->pix_fmt, oVideoEncoderCxt -> width, 1080, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, 0, 0, 0);
+    scale420Cxt = sws_getContext(oVideoEncoderCxt -> width, oVideoEncoderCxt -> height, iVideoDecoderCxt->pix_fmt, oVideoEncoderCxt -> width, oVideoEncoderCxt -> height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, 0, 0, 0);
 
+    traceTime = AVP::Trace::begin();
     while(av_read_frame(iVideoFmtCxt, packet) == 0)
     {
+        AVP::Trace::end("read", traceTime);
+
         if(packet->stream_index == iVideoStreamID)
         {
+            traceTime = AVP::Trace::begin();
             avError = avcodec_send_packet(iVideoDecoderCxt, packet);
+            AVP::Trace::end("decode", traceTime);
             while(true)
             {
+                traceTime = AVP::Trace::begin();
                 avError = avcodec_receive_frame(iVideoDecoderCxt, vFrameIn);
+                AVP::Trace::end("decode", traceTime);
                 if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
                     break;
 
                 emit setProgress(vFrameIn->pkt_dts * av_q2d(iVideoFmtCxt->streams[iVideoStreamID]->time_base));
 
-                // Apply filter
-                avError = av_buffersrc_add_frame(videoFilterSrcCxt, vFrameIn);
-                avError = av_buffersink_get_frame(videoFilterSinkCxt, vFrameFiltered);
+                // Unfold the corridor picture
+                traceTime = AVP::Trace::begin();
+                AVP::PooledFrame vPicture = vPicturePool.acquireVideo(iVideoDecoderCxt->pix_fmt, unfoldTable.getWidth(), unfoldTable.getHeight());
+                avError = unfoldTable.apply(vFrameIn, vPicture.get());
+                AVP::Trace::end("remap", traceTime);
 
-                // Rescale to YUV420
-                avError = sws_scale_frame(scale420Cxt, vFrameOut, vFrameFiltered);
+                // Rescale to YUV420 into a recycled frame
+                traceTime = AVP::Trace::begin();
+                AVP::PooledFrame vFrameOut = vFrameOutPool.acquireVideo(AV_PIX_FMT_YUV420P, oVideoEncoderCxt->width, oVideoEncoderCxt->height);
+                avError = sws_scale_frame(scale420Cxt, vFrameOut.get(), vPicture.get());
+                AVP::Trace::end("convert", traceTime);
 
                 // Encode
                 vFrameOut -> pts = videoPTSCounter ++;
-                avError = avcodec_send_frame(oVideoEncoderCxt, vFrameOut);
+                traceTime = AVP::Trace::begin();
+                avError = avcodec_send_frame(oVideoEncoderCxt, vFrameOut.get());
+                AVP::Trace::end("encode", traceTime);
                 while(true)
                 {
+                    traceTime = AVP::Trace::begin();
                     avError = avcodec_receive_packet(oVideoEncoderCxt, packet);
+                    AVP::Trace::end("encode", traceTime);
                     if(avError)
                     {
                         av_packet_unref(packet);
@@ -399,17 +345,19 @@ void TDoExport::run()
                     }
                     av_packet_rescale_ts(packet, oVideoEncoderCxt->time_base, oVideoStream->time_base);
                     packet -> stream_index = 0;
+                    traceTime = AVP::Trace::begin();
                     avError = av_interleaved_write_frame(oVideoFmtCxt, packet);
+                    AVP::Trace::end("write", traceTime);
                 }
 
                 // Unref frames
                 av_frame_unref(vFrameIn);
-                av_frame_unref(vFrameFiltered);
-                av_frame_unref(vFrameOut);
             }
             // Unref packet
             av_packet_unref(packet);
         }
+
+        traceTime = AVP::Trace::begin();
     }
 
     // Flush buffer
@@ -449,53 +397,75 @@ void TDoExport::run()
          */
         aFifo = av_audio_fifo_alloc(AV_SAMPLE_FMT_FLTP, iAudioDecoderCxt->ch_layout.nb_channels, 1);
 
+        traceTime = AVP::Trace::begin();
         while(av_read_frame(iAudioFmtCxt, packet) == 0)
         {
+            AVP::Trace::end("audio read", traceTime);
+
             if(packet->stream_index == iAudioStreamID)
             {
+                traceTime = AVP::Trace::begin();
                 avError = avcodec_send_packet(iAudioDecoderCxt, packet);
+                AVP::Trace::end("audio decode", traceTime);
                 while(true)
                 {
+                    traceTime = AVP::Trace::begin();
                     avError = avcodec_receive_frame(iAudioDecoderCxt, aFrameIn);
+                    AVP::Trace::end("audio decode", traceTime);
                     if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
                         break;
 
                     emit setProgress(aFrameIn->pkt_dts * av_q2d(iAudioFmtCxt->streams[iAudioStreamID]->time_base));
 
                     // Resample
-                    avError = av_samples_alloc_array_and_samples(&aSamples, &aSamplesLineSize, iAudioDecoderCxt->ch_layout.nb_channels, aFrameIn->nb_samples, AV_SAMPLE_FMT_FLTP, 0);
+                    traceTime = AVP::Trace::begin();
+                    if(aFrameIn->nb_samples > aSamplesCapacity)
+                    {
+                        // Only grows, so steady state does not allocate
+                        if(aSamples)
+                            av_freep(&aSamples[0]);
+                        av_freep(&aSamples);
+                        avError = av_samples_alloc_array_and_samples(&aSamples, &aSamplesLineSize, iAudioDecoderCxt->ch_layout.nb_channels, aFrameIn->nb_samples, AV_SAMPLE_FMT_FLTP, 0);
+                        if(avError >= 0)
+                            AVP::AllocStats::addAllocation(avError);
+                        aSamplesCapacity = aFrameIn->nb_samples;
+                    }
                     avError = swr_convert(resamplerCxt, aSamples, aFrameIn->nb_samples, (const uint8_t**)aFrameIn->extended_data, aFrameIn->nb_samples);
 
                     // Organize FIFO
                     avError = av_audio_fifo_write(aFifo, (void **)aSamples, aFrameIn->nb_samples);
+                    AVP::Trace::end("audio resample", traceTime);
 
                     // Encode
                     while(av_audio_fifo_size(aFifo) >= oAudioEncoderCxt->frame_size)
                     {
-                        // Copy frame settings
-                        av_frame_unref(aFrameOut);
-                        aFrameOut -> ch_layout = aFrameIn -> ch_layout;
-                        aFrameOut -> sample_rate = aFrameIn -> sample_rate;
-                        aFrameOut -> format = AV_SAMPLE_FMT_FLTP;
-                        aFrameOut -> nb_samples = oAudioEncoderCxt->frame_size;
-                        aFrameOut -> pts = audioPTSCounter;
-                        audioPTSCounter += aFrameOut->nb_samples;
-                        avError = av_frame_get_buffer(aFrameOut, 0);
+                        // Get a recycled frame
+                        AVP::PooledFrame aFrameEncode = aFrameOutPool.acquireAudio(AV_SAMPLE_FMT_FLTP, &aFrameIn->ch_layout, aFrameIn->sample_rate, oAudioEncoderCxt->frame_size);
+                        aFrameEncode -> pts = audioPTSCounter;
+                        audioPTSCounter += aFrameEncode->nb_samples;
 
                         // Encoding
-                        avError = av_audio_fifo_read(aFifo, (void **)aFrameOut->data, oAudioEncoderCxt->frame_size);
-                        avError = avcodec_send_frame(oAudioEncoderCxt, aFrameOut);
+                        traceTime = AVP::Trace::begin();
+                        avError = av_audio_fifo_read(aFifo, (void **)aFrameEncode->data, oAudioEncoderCxt->frame_size);
+                        avError = avcodec_send_frame(oAudioEncoderCxt, aFrameEncode.get());
+                        AVP::Trace::end("audio encode", traceTime);
                         while(true)
                         {
+                            traceTime = AVP::Trace::begin();
                             avError = avcodec_receive_packet(oAudioEncoderCxt, packet);
+                            AVP::Trace::end("audio encode", traceTime);
                             if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
                                 break;
                             packet -> stream_index = 1;
+                            traceTime = AVP::Trace::begin();
                             avError = av_write_frame(oVideoFmtCxt, packet);
+                            AVP::Trace::end("audio write", traceTime);
                         }
                     }
                 }
             }
+
+            traceTime = AVP::Trace::begin();
         }
 
         // Flush buffer
@@ -555,15 +525,7 @@ end:    // Jump flag for errors
     av_packet_free(&packet);
 
     av_frame_free(&vFrameIn);
-    av_frame_free(&vFrameFiltered);
-    av_frame_free(&vFrameOut);
 
-    avfilter_free(videoFilterSrcCxt);
-    avfilter_free(videoFilterSinkCxt);
-
-    avfilter_graph_free(&videoFilterGraph);
-    avfilter_inout_free(&videoFilterInput);
-    avfilter_inout_free(&videoFilterOutput);
 
     sws_freeContext(scale420Cxt);
 
@@ -575,9 +537,16 @@ end:    // Jump flag for errors
         swr_free(&resamplerCxt);
 
         av_audio_fifo_free(aFifo);
-        av_freep(aSamples);
+        if(aSamples)
+            av_freep(&aSamples[0]);
+        av_freep(&aSamples);
     }
 
+    // Allocation accounting of this export, per video frame
+    if(AVP::AllocStats::isEnabled())
+        fprintf(stderr, "Allocations of %s:\n%s", videoPath.toLocal8Bit().constData(),
+                AVP::AllocStats::report(AVP::AllocStats::diff(allocBegin, AVP::AllocStats::snapshot()), videoPTSCounter).c_str());
+
     if(avError == 0)
         emit completed();
 }
@@ -18,7 +18,7 @@
 #ifndef TDOEXPORT_H
 #define TDOEXPORT_H
 
-#include "avpsettings.h"
+#include "avplayout.h"
 
 #include <QThread>
 
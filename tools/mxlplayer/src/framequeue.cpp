@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "framequeue.h"
+
+bool FrameQueue::push(DecodedFrame &&frame, uint64_t generation)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [&]() { return closed || generation != this->generation || frames.size() < capacity; });
+    if(closed)
+        return false;
+    if(generation == this->generation)
+        frames.push_back(std::move(frame));
+    return true;
+}
+
+bool FrameQueue::takeSeek(int64_t *position, int *flags, uint64_t *generation)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    *generation = this->generation;
+    if(!seekPending)
+        return false;
+    seekPending = false;
+    *position = seekPosition;
+    *flags = seekFlags;
+    return true;
+}
+
+uint64_t FrameQueue::getGeneration()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return generation;
+}
+
+bool FrameQueue::isClosed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return closed;
+}
+
+DecodedFrame *FrameQueue::peek()
+{
+    // Only the consumer removes frames, and push_back does not move the existing ones of a deque
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames.empty() ? nullptr : &frames.front();
+}
+
+void FrameQueue::pop()
+{
+    DecodedFrame frame;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(frames.empty())
+            return;
+        frame = std::move(frames.front());
+        frames.pop_front();
+    }
+    // The picture goes back to its pool outside the lock
+    notFull.notify_one();
+}
+
+void FrameQueue::requestSeek(int64_t position, int flags)
+{
+    std::deque<DecodedFrame> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropped.swap(frames);
+        generation ++;
+        seekPending = true;
+        seekPosition = position;
+        seekFlags = flags;
+    }
+    notFull.notify_all();
+}
+
+size_t FrameQueue::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames.size();
+}
+
+void FrameQueue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+    }
+    notFull.notify_all();
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef FRAMEQUEUE_H
+#define FRAMEQUEUE_H
+
+#include "avhandle.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// A decoded MXL frame ready to be uploaded, in 8-bit planar YUV 4:2:0 or 4:2:2
+struct DecodedFrame {
+    AVP::PooledFrame frame;
+    int64_t pts = 0;            // Video stream time base and counted on through the loops, AV_NOPTS_VALUE when unknown
+    int64_t dts = 0;            // For the position bar
+};
+
+/*
+ * Bounded queue between the MXLPlayer decode thread (producer) and the render thread (consumer).
+ * The producer sleeps while the queue is full, the consumer never blocks.
+ * Seeks are requested by the consumer and carried out by the producer. Frames decoded before the request are discarded by their generation.
+ */
+class FrameQueue {
+public:
+    explicit FrameQueue(size_t capacity) : capacity(capacity) {}
+
+    // Producer. Blocks while full. Returns false once closed; a frame of an old generation is dropped
+    bool push(DecodedFrame &&frame, uint64_t generation);
+    // Producer: takes a pending seek, returns the generation the following frames belong to
+    bool takeSeek(int64_t *position, int *flags, uint64_t *generation);
+    uint64_t getGeneration();
+    bool isClosed();
+
+    // Consumer: the oldest frame or nullptr. Stays valid until pop() or requestSeek()
+    DecodedFrame *peek();
+    void pop();
+    // Consumer: drops queued frames and asks the producer to seek (position in the video stream time base)
+    void requestSeek(int64_t position, int flags);
+    size_t size();
+    size_t getCapacity() const { return capacity; }
+
+    // Wakes the producer for good
+    void close();
+
+private:
+    const size_t capacity;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::deque<DecodedFrame> frames;
+    uint64_t generation = 0;
+    bool closed = false;
+
+    bool seekPending = false;
+    int64_t seekPosition = 0;
+    int seekFlags = 0;
+};
+
+#endif // FRAMEQUEUE_H
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "framescheduler.h"
+
+extern "C" {
+#include <libavutil/mathematics.h>
+}
+
+FrameScheduler::Clock::duration FrameScheduler::frameTime(int64_t index) const
+{
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(av_rescale_q(index, av_inv_q(frameRate), {1, 1000000000})));
+}
+
+void FrameScheduler::setFrameRate(AVRational rate)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if(rate.num > 0 && rate.den > 0)
+        frameRate = rate;
+    frameIndex = 0;
+    origin = Clock::now();
+}
+
+bool FrameScheduler::waitNextFrame()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stopped)
+    {
+        if(paused)
+        {
+            stateChanged.wait(lock);
+            continue;
+        }
+
+        Clock::time_point now = Clock::now();
+        Clock::time_point due = origin + frameTime(frameIndex);
+        if(now < due)
+        {
+            // Woken early by pause(), restart() or stop(), so the state is checked again
+            stateChanged.wait_until(lock, due);
+            continue;
+        }
+        if(now - due > frameTime(kMaxLateFrames))
+        {
+            origin = now;
+            frameIndex = 0;
+        }
+        frameIndex ++;
+        return true;
+    }
+    return false;
+}
+
+bool FrameScheduler::waitPlaying()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    stateChanged.wait(lock, [this]() { return stopped || !paused; });
+    return !stopped;
+}
+
+void FrameScheduler::play()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!paused)
+            return;
+        paused = false;
+        // Paused time is not caught up
+        origin = Clock::now() - frameTime(frameIndex);
+    }
+    stateChanged.notify_all();
+}
+
+void FrameScheduler::pause()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        paused = true;
+    }
+    stateChanged.notify_all();
+}
+
+void FrameScheduler::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    stateChanged.notify_all();
+}
+
+void FrameScheduler::restart()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        frameIndex = 0;
+        origin = Clock::now();
+    }
+    stateChanged.notify_all();
+}
+
+bool FrameScheduler::isPaused()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return paused;
+}
+
+void AudioClock::reset()
+{
+    valid.store(false, std::memory_order_release);
+}
+
+void AudioClock::update(double position, double maxInterpolation)
+{
+    uint32_t current = sequence.load(std::memory_order_relaxed);
+    sequence.store(current + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    basePosition.store(position, std::memory_order_relaxed);
+    this->maxInterpolation.store(maxInterpolation, std::memory_order_relaxed);
+    baseTime.store(FrameScheduler::Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    sequence.store(current + 2, std::memory_order_release);
+
+    pauseTime.store(0, std::memory_order_relaxed);
+    valid.store(true, std::memory_order_release);
+}
+
+void AudioClock::pause()
+{
+    FrameScheduler::Clock::rep expected = 0;
+    pauseTime.compare_exchange_strong(expected, FrameScheduler::Clock::now().time_since_epoch().count());
+}
+
+bool AudioClock::get(double *position)
+{
+    if(!valid.load(std::memory_order_acquire))
+        return false;
+
+    uint32_t begin = 0;
+    double position0 = 0;
+    double interpolation = 0;
+    FrameScheduler::Clock::rep time0 = 0;
+    do
+    {
+        begin = sequence.load(std::memory_order_acquire);
+        position0 = basePosition.load(std::memory_order_relaxed);
+        interpolation = maxInterpolation.load(std::memory_order_relaxed);
+        time0 = baseTime.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while((begin & 1) || begin != sequence.load(std::memory_order_relaxed));
+
+    // While paused the clock stands at the pause
+    FrameScheduler::Clock::rep now = pauseTime.load(std::memory_order_relaxed);
+    if(now == 0)
+        now = FrameScheduler::Clock::now().time_since_epoch().count();
+    double elapsed = std::chrono::duration<double>(FrameScheduler::Clock::duration(now - time0)).count();
+    *position = position0 + (elapsed < 0 ? 0 : elapsed < interpolation ? elapsed : interpolation);
+    return true;
+}
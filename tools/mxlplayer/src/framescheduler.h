@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Presentation clock of MXLPlayer.
+ * Frame n is due at origin + n / frameRate on the steady clock, so fractional rates (e.g. 24000/1001) do not drift.
+ * Waiting threads sleep on a condition variable, both until the next frame is due and while paused.
+ */
+class FrameScheduler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    void setFrameRate(AVRational rate);
+
+    // Blocks until the next frame is due. Returns false once stopped
+    bool waitNextFrame();
+    // Blocks while paused. Returns false once stopped
+    bool waitPlaying();
+
+    // Starts paused
+    void play();
+    void pause();
+    // Wakes all waiting threads for good
+    void stop();
+    // After a seek: the next frame is due now
+    void restart();
+
+    bool isPaused();
+
+private:
+    // Frames this late are not caught up, the timeline restarts instead (e.g. after the window was dragged)
+    static const int kMaxLateFrames = 24;
+
+    std::mutex mutex;
+    std::condition_variable stateChanged;
+    bool paused = true;
+    bool stopped = false;
+
+    AVRational frameRate = {24, 1};
+    int64_t frameIndex = 0;
+    Clock::time_point origin;
+
+    Clock::duration frameTime(int64_t index) const;
+};
+
+/*
+ * Master clock of MXLPlayer when a WAV is loaded: the stream position of the audio being heard.
+ * Set from the SDL audio callback with the samples it actually consumed, and interpolated on the steady clock between callbacks.
+ * Lock-free, so the callback never waits: update() is only called by the callback and publishes its values through a sequence counter.
+ */
+class AudioClock {
+public:
+    // After a seek or loop: nothing of the new position has been played yet
+    void reset();
+    // position: stream time in seconds of the audio heard now. maxInterpolation: at most this far ahead of the last update
+    void update(double position, double maxInterpolation);
+    void pause();
+
+    // False until the first update after a reset
+    bool get(double *position);
+
+private:
+    std::atomic<bool> valid{false};
+    std::atomic<FrameScheduler::Clock::rep> pauseTime{0};   // 0 while playing
+
+    // Odd while update() writes the values below
+    std::atomic<uint32_t> sequence{0};
+    std::atomic<double> basePosition{0};
+    std::atomic<double> maxInterpolation{0};
+    std::atomic<FrameScheduler::Clock::rep> baseTime{0};
+};
+
+#endif // FRAMESCHEDULER_H
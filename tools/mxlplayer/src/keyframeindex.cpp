@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "keyframeindex.h"
+
+#include <algorithm>
+#include <fstream>
+
+// MPEG-2 start codes (00 00 01 xx)
+static const int kPictureStartCode = 0x00;
+static const int kSequenceHeaderCode = 0xB3;
+static const int kGroupStartCode = 0xB8;
+static const int kIntraPicture = 1;
+
+bool KeyframeIndex::open(const std::string &mxlPath, const std::function<bool()> &cancelled)
+{
+    std::filesystem::path path = std::filesystem::u8path(mxlPath);
+    std::filesystem::path sidecarPath = path;
+    sidecarPath += ".avpidx";
+    std::error_code errorCode;
+
+    fileSize = std::filesystem::file_size(path, errorCode);
+    if(errorCode)
+        return false;
+    fileTime = std::filesystem::last_write_time(path, errorCode).time_since_epoch().count();
+    if(errorCode)
+        return false;
+
+    if(load(sidecarPath))
+        return true;
+    if(!scan(path, cancelled))
+        return false;
+    // A read-only folder only costs the next scan
+    save(sidecarPath);
+    return true;
+}
+
+const Keyframe *KeyframeIndex::find(int64_t frame) const
+{
+    auto next = std::upper_bound(keyframes.begin(), keyframes.end(), frame, [](int64_t frame, const Keyframe &keyframe) { return frame < keyframe.frame; });
+    if(next == keyframes.begin())
+        return nullptr;
+    return &*(next - 1);
+}
+
+bool KeyframeIndex::load(const std::filesystem::path &sidecarPath)
+{
+    std::ifstream stream(sidecarPath);
+    std::string key;
+    int version = 0;
+    uint64_t size = 0;
+    int64_t time = 0;
+    int64_t frames = 0;
+    std::vector<Keyframe> result;
+
+    if(!(stream >> key >> version) || key != "version" || version != kVersion)
+        return false;
+    if(!(stream >> key >> size) || key != "size" || size != fileSize)
+        return false;
+    if(!(stream >> key >> time) || key != "mtime" || time != fileTime)
+        return false;
+    if(!(stream >> key >> frames) || key != "frames")
+        return false;
+
+    Keyframe keyframe;
+    while(stream >> key >> keyframe.offset >> keyframe.frame)
+    {
+        if(key != "key")
+            return false;
+        result.push_back(keyframe);
+    }
+    if(!stream.eof() || result.empty())
+        return false;
+
+    keyframes = std::move(result);
+    frameCount = frames;
+    return true;
+}
+
+bool KeyframeIndex::save(const std::filesystem::path &sidecarPath) const
+{
+    std::ofstream stream(sidecarPath);
+    if(!stream)
+        return false;
+    stream << "version " << kVersion << "\n"
+           << "size " << fileSize << "\n"
+           << "mtime " << fileTime << "\n"
+           << "frames " << frameCount << "\n";
+    for(const Keyframe &keyframe : keyframes)
+        stream << "key " << keyframe.offset << " " << keyframe.frame << "\n";
+    return (bool)stream;
+}
+
+/*
+ * Special note to this optimization:
+ * Seeking used to rely on the demuxer, which has no index for a raw stream and landed on whatever picture the estimate reached.
+ * The scan only looks at start codes and the two bytes after each picture start code (temporal reference and picture type),
+ * so it runs at the speed of reading the file and the result is cached for the next time.
+ */
+bool KeyframeIndex::scan(const std::filesystem::path &mxlPath, const std::function<bool()> &cancelled)
+{
+    std::ifstream stream(mxlPath, std::ios::binary);
+    if(!stream)
+        return false;
+
+    std::vector<uint8_t> buffer(kScanChunkSize);
+    std::vector<Keyframe> result;
+    uint32_t code = 0xFFFFFFFF;     // Last four bytes read
+    int64_t position = 0;           // Of the next byte
+    int64_t unitStart = -1;         // First header since the last picture, -1 if none
+    int64_t gopStart = -1;          // Decode index of the first picture of the GOP, -1 before the first GOP header
+    int64_t pictures = 0;           // Decode index of the next picture
+    int64_t pictureStart = -1;      // Of a picture header whose next two bytes are still being read
+    int headerBytes = 0;
+    uint8_t header[2] = {0};
+
+    while(stream)
+    {
+        if(cancelled())
+            return false;
+        stream.read((char*)buffer.data(), buffer.size());
+        std::streamsize length = stream.gcount();
+        for(std::streamsize i = 0; i < length; i++, position++)
+        {
+            uint8_t byte = buffer[i];
+            if(pictureStart >= 0)
+            {
+                header[headerBytes++] = byte;
+                if(headerBytes == 2)
+                {
+                    int temporalReference = (header[0] << 2) | (header[1] >> 6);
+                    int pictureType = (header[1] >> 3) & 0x07;
+                    if(pictureType == kIntraPicture && unitStart >= 0)
+                        result.push_back({unitStart, gopStart >= 0 ? gopStart + temporalReference : pictures});
+                    unitStart = -1;
+                    pictureStart = -1;
+                    pictures++;
+                }
+            }
+
+            code = (code << 8) | byte;
+            if((code & 0xFFFFFF00) != 0x00000100)
+                continue;
+            int64_t codeStart = position - 3;
+            switch(byte)
+            {
+            case kSequenceHeaderCode:
+                if(unitStart < 0)
+                    unitStart = codeStart;
+                break;
+            case kGroupStartCode:
+                if(unitStart < 0)
+                    unitStart = codeStart;
+                gopStart = pictures;
+                break;
+            case kPictureStartCode:
+                pictureStart = codeStart;
+                headerBytes = 0;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    if(result.empty())
+        return false;
+    keyframes = std::move(result);
+    frameCount = pictures;
+    return true;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef KEYFRAMEINDEX_H
+#define KEYFRAMEINDEX_H
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A point where decoding can start: the headers in front of an I picture
+struct Keyframe {
+    int64_t offset;     // Byte offset of the sequence or GOP header
+    int64_t frame;      // Display index of the I picture
+};
+
+/*
+ * Keyframe index of an MXL, which is a raw MPEG-2 video elementary stream without an index of its own.
+ * Built by one pass over the start codes (sequence, GOP and picture headers), nothing is decoded.
+ * The index is cached in a sidecar next to the MXL ("<name>.avpidx"), valid while the MXL keeps its size and modification time.
+ * Only frame pictures are expected, which is what AVPStudio writes.
+ */
+class KeyframeIndex {
+public:
+    // Loads the sidecar of mxlPath (UTF-8) or, if it is missing or stale, scans the MXL and writes a new one. Returns false if cancelled or unreadable
+    bool open(const std::string &mxlPath, const std::function<bool()> &cancelled);
+
+    // The last keyframe at or before frame, nullptr if there is none
+    const Keyframe *find(int64_t frame) const;
+    int64_t getFrameCount() const { return frameCount; }
+    bool isEmpty() const { return keyframes.empty(); }
+
+private:
+    static const int kVersion = 1;
+    static const size_t kScanChunkSize = 4 << 20;
+
+    std::vector<Keyframe> keyframes;
+    int64_t frameCount = 0;
+    uint64_t fileSize = 0;
+    int64_t fileTime = 0;
+
+    bool load(const std::filesystem::path &sidecarPath);
+    bool save(const std::filesystem::path &sidecarPath) const;
+    bool scan(const std::filesystem::path &mxlPath, const std::function<bool()> &cancelled);
+};
+
+#endif // KEYFRAMEINDEX_H
@@ -16,6 +16,10 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include "mainwindow.h"
+#include "allocstats.h"
+#include "avplayout.h"
+#include "cpudispatch.h"
+#include "trace.h"
 
 #include <QApplication>
 #include <QFile>
@@ -26,6 +30,18 @@ int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
+    // Timeline tracing, if AVP_TRACE is set
+    AVP::Trace::initFromEnvironment();
+
+    // Allocation accounting, if AVP_ALLOC_STATS is set
+    AVP::AllocStats::initFromEnvironment();
+
+    // Forced CPU level, if AVP_CPU_LEVEL is set
+    AVP::CpuDispatch::initFromEnvironment();
+
+    // Layout descriptors next to the executable and in AVP_LAYOUT_PATH
+    AVP::loadLayouts(QCoreApplication::applicationDirPath().toStdString());
+
     QTranslator translator;
     const QStringList uiLanguages = QLocale::system().uiLanguages();
     for (const QString &locale : uiLanguages) {
@@ -53,5 +69,7 @@ int main(int argc, char *argv[])
     }
 
     w.show();
-    return a.exec();
+    int ret = a.exec();
+    AVP::Trace::stop();
+    return ret;
 }
@@ -31,6 +31,15 @@ MainWindow::MainWindow(QWidget *parent)
 {
     ui->setupUi(this);
 
+    // One more size button per loaded layout
+    for(int i = AVP::kAVPBuiltinLayouts; i < AVP::getLayoutCount(); i++)
+    {
+        const AVP::AVPLayout &layout = AVP::getLayout((AVP::AVPSize)i);
+        QRadioButton *radioButton = new QRadioButton(QString::fromStdString(layout.realSize.empty() ? layout.name : layout.name + " - " + layout.realSize), ui->groupBox);
+        ui->horizontalLayout->addWidget(radioButton);
+        loadedLayoutButtons.append(radioButton);
+    }
+
     this->setWindowFlags(windowFlags()& ~Qt::WindowMaximizeButtonHint);
     this->setFixedSize(this->width(), this->height());
 }
@@ -120,6 +129,9 @@ AVP::AVPSize MainWindow::getSize()
         return AVP::kAVPMediumSize;
     else if(ui->radioButtonLarge->isChecked())
         return AVP::kAVPLargeSize;
+    for(int i = 0; i < loadedLayoutButtons.size(); i++)
+        if(loadedLayoutButtons[i]->isChecked())
+            return (AVP::AVPSize)(AVP::kAVPBuiltinLayouts + i);
     return AVP::kAVPMediumSize;
 }
 
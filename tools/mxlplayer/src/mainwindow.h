@@ -18,9 +18,11 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <QList>
 #include <QMainWindow>
 #include <QProgressBar>
 #include <QProgressDialog>
+#include <QRadioButton>
 
 #include "doexport.h"
 
@@ -63,6 +65,9 @@ private:
     QProgressBar *progressDialogBar;
     QProgressDialog *progressDialog;
 
+    // Size buttons of layouts loaded from descriptors, in layout order
+    QList<QRadioButton*> loadedLayoutButtons;
+
     AVP::AVPSize getSize();
 };
 #endif // MAINWINDOW_H
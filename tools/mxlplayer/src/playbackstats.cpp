@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "playbackstats.h"
+
+#include <cstdlib>
+
+void StageTimer::add(std::chrono::steady_clock::duration elapsed)
+{
+    int64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    totalMicroseconds.fetch_add(microseconds, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    int64_t maximum = maxMicroseconds.load(std::memory_order_relaxed);
+    while(microseconds > maximum && !maxMicroseconds.compare_exchange_weak(maximum, microseconds, std::memory_order_relaxed))
+        ;
+}
+
+void StageTimer::take(double *averageMs, double *maxMs)
+{
+    int64_t frames = count.exchange(0, std::memory_order_relaxed);
+    int64_t total = totalMicroseconds.exchange(0, std::memory_order_relaxed);
+    int64_t maximum = maxMicroseconds.exchange(0, std::memory_order_relaxed);
+    *averageMs = frames > 0 ? total / 1000.0 / frames : 0;
+    *maxMs = maximum / 1000.0;
+}
+
+PlaybackStatsLog::~PlaybackStatsLog()
+{
+    close();
+}
+
+bool PlaybackStatsLog::openFromEnvironment()
+{
+    const char *path = getenv("AVP_PLAYBACK_STATS");
+    if(!path || !*path)
+        return true;
+    return open(path);
+}
+
+bool PlaybackStatsLog::open(const char *outputPath)
+{
+    close();
+    file = fopen(outputPath, "w");
+    if(!file)
+        return false;
+    start = std::chrono::steady_clock::now();
+    fputs("time_s,decode_ms,decode_max_ms,convert_ms,convert_max_ms,upload_ms,upload_max_ms,present_ms,present_max_ms,"
+          "frame_queue,frame_queue_size,audio_buffer_samples,audio_buffer_capacity,audio_buffer_ms,dropped_frames,repeated_frames,drift_ms\n", file);
+    return true;
+}
+
+void PlaybackStatsLog::write(const PlaybackStats &stats)
+{
+    if(!file)
+        return;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(file, "%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d,%d,%d,%d,%.1f,%lld,%lld,%.1f\n",
+            seconds, stats.decodeMs, stats.decodeMaxMs, stats.convertMs, stats.convertMaxMs, stats.uploadMs, stats.uploadMaxMs, stats.presentMs, stats.presentMaxMs,
+            stats.frameQueueDepth, stats.frameQueueSize, stats.audioBufferSamples, stats.audioBufferCapacity, stats.audioBufferMs,
+            (long long)stats.droppedFrames, (long long)stats.repeatedFrames, stats.driftMs);
+    // Rows are few, and the log should survive the player being killed during a stutter
+    fflush(file);
+}
+
+void PlaybackStatsLog::close()
+{
+    if(file)
+        fclose(file);
+    file = nullptr;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2024 Steven Song (izwb003)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef PLAYBACKSTATS_H
+#define PLAYBACKSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// Durations of one playback stage, added by the thread running it and taken by the render thread for each report
+class StageTimer {
+public:
+    void add(std::chrono::steady_clock::duration elapsed);
+    // Average and longest duration (ms) since the previous take, 0 if the stage did not run.
+    // Not a snapshot: a duration added during the take may count in the next one
+    void take(double *averageMs, double *maxMs);
+
+private:
+    std::atomic<int64_t> totalMicroseconds{0};
+    std::atomic<int64_t> count{0};
+    std::atomic<int64_t> maxMicroseconds{0};
+};
+
+// Reported by MXLPlayer about twice a second. Stage times are per frame, over the time since the previous report
+struct PlaybackStats {
+    double decodeMs = 0;            // Reading and decoding
+    double decodeMaxMs = 0;
+    double convertMs = 0;           // Only decoder formats other than 8-bit 4:2:0 and 4:2:2 are converted
+    double convertMaxMs = 0;
+    double uploadMs = 0;
+    double uploadMaxMs = 0;
+    double presentMs = 0;           // Copies of the layout regions and the buffer swap
+    double presentMaxMs = 0;
+    int frameQueueDepth = 0;
+    int frameQueueSize = 0;
+    int audioBufferSamples = 0;     // Decoded ahead of the audio callback
+    int audioBufferCapacity = 0;
+    double audioBufferMs = 0;
+    int64_t droppedFrames = 0;      // Since the start
+    int64_t repeatedFrames = 0;
+    double driftMs = 0;             // Video minus audio clock at the last synchronized frame, 0 without audio
+};
+
+// CSV log of PlaybackStats, one row per report. Enabled by the AVP_PLAYBACK_STATS environment variable holding the output path
+class PlaybackStatsLog {
+public:
+    PlaybackStatsLog() = default;
+    ~PlaybackStatsLog();
+    PlaybackStatsLog(const PlaybackStatsLog &) = delete;
+    PlaybackStatsLog &operator=(const PlaybackStatsLog &) = delete;
+
+    // Opens the path of AVP_PLAYBACK_STATS if it is set. False only if it is set and cannot be written
+    bool openFromEnvironment();
+    bool open(const char *outputPath);
+    bool isOpen() const { return file != nullptr; }
+    void write(const PlaybackStats &stats);
+    void close();
+
+private:
+    FILE *file = nullptr;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // PLAYBACKSTATS_H
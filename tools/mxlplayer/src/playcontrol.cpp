@@ -36,11 +36,18 @@ PlayControl::PlayControl(QWidget *parent, QString mxlPath, QString wavPath, AVP:
 
     setMouseTracking(true);
     ui->labelIcon->installEventFilter(this);
+    ui->labelStats->hide();
 
+    if(!statsLog.openFromEnvironment())
+        QMessageBox::warning(this, tr("警告"), tr("无法写入播放统计日志：") + QString::fromLocal8Bit(qgetenv("AVP_PLAYBACK_STATS")));
+
+    qRegisterMetaType<PlaybackStats>("PlaybackStats");
     videoPlayer = new TPlayVideo(this, mxlPath, wavPath, size);
     connect(videoPlayer, SIGNAL(showError(QString)), this, SLOT(do_showError(QString)));
     connect(videoPlayer, SIGNAL(setPositionBarMax(int,double)), this, SLOT(do_setPositionBarMax(int,double)));
     connect(videoPlayer, SIGNAL(setPosition(int)), this, SLOT(do_setPosition(int)));
+    connect(videoPlayer, SIGNAL(playbackStats(PlaybackStats)), this, SLOT(do_playbackStats(PlaybackStats)));
+    connect(videoPlayer, SIGNAL(selfTestResult(bool,double,double,int)), this, SLOT(do_selfTestResult(bool,double,double,int)));
     connect(videoPlayer, SIGNAL(sdlQuit()), this, SLOT(on_toolButtonBack_clicked()));
     connect(this, SIGNAL(play()), videoPlayer, SLOT(do_play()));
     connect(this, SIGNAL(pause()), videoPlayer, SLOT(do_pause()));
@@ -81,6 +88,34 @@ void PlayControl::do_setPosition(int val)
     ui->labelPlayTime->setText(time.toString("mm:ss"));
 }
 
+void PlayControl::do_playbackStats(PlaybackStats stats)
+{
+    statsLog.write(stats);
+    if(ui->labelStats->isHidden())
+        return;
+
+    QString text = selfTestReport.isEmpty() ? "" : selfTestReport + "\n";
+    text += tr("解码：%1 ms（最长 %2 ms）  转换：%3 ms（最长 %4 ms）\n上传：%5 ms（最长 %6 ms）  呈现：%7 ms（最长 %8 ms）\n")
+                .arg(stats.decodeMs, 0, 'f', 2).arg(stats.decodeMaxMs, 0, 'f', 2)
+                .arg(stats.convertMs, 0, 'f', 2).arg(stats.convertMaxMs, 0, 'f', 2)
+                .arg(stats.uploadMs, 0, 'f', 2).arg(stats.uploadMaxMs, 0, 'f', 2)
+                .arg(stats.presentMs, 0, 'f', 2).arg(stats.presentMaxMs, 0, 'f', 2);
+    text += tr("帧队列：%1/%2  音频缓冲：%3 ms（%4/%5 采样）\n")
+                .arg(stats.frameQueueDepth).arg(stats.frameQueueSize)
+                .arg(stats.audioBufferMs, 0, 'f', 1).arg(stats.audioBufferSamples).arg(stats.audioBufferCapacity);
+    text += tr("丢弃帧：%1  重复帧：%2  音画偏差：%3 ms")
+                .arg(stats.droppedFrames).arg(stats.repeatedFrames).arg(stats.driftMs, 0, 'f', 1);
+    ui->labelStats->setText(text);
+}
+
+void PlayControl::do_selfTestResult(bool realTime, double decodeFps, double frameRate, int threadCount)
+{
+    selfTestReport = tr("解码速度：%1 帧/秒（%2 线程），视频帧率：%3 帧/秒").arg(decodeFps, 0, 'f', 1).arg(threadCount).arg(frameRate, 0, 'f', 2);
+    ui->labelPlayTime->setToolTip(selfTestReport);
+    if(!realTime)
+        QMessageBox::warning(this, tr("警告"), tr("此设备的解码速度不足以实时播放此MXL，播放时将丢弃帧。\n") + selfTestReport);
+}
+
 void PlayControl::mousePressEvent(QMouseEvent *event)
 {
     if(isDragging)
@@ -165,3 +200,14 @@ void PlayControl::on_horizontalSliderPosition_sliderReleased()
 {
     emit updatePosition(ui->horizontalSliderPosition->value());
 }
+
+
+void PlayControl::on_toolButtonStats_clicked(bool checked)
+{
+    // The panel opens above the controls, which stay where they are
+    int bottom = geometry().bottom();
+    ui->labelStats->setVisible(checked);
+    ui->toolButtonStats->setIcon(QIcon(checked ? ":/images/images/down.png" : ":/images/images/up.png"));
+    resize(width(), sizeHint().height());
+    move(x(), bottom - height() + 1);
+}
@@ -20,7 +20,7 @@
 
 #include "mainwindow.h"
 #include "playvideo.h"
-#include "avpsettings.h"
+#include "avplayout.h"
 
 #include <QWidget>
 #include <QMouseEvent>
@@ -63,6 +63,10 @@ private:
 
     int muteVolume = 0;
 
+    QString selfTestReport = "";
+
+    PlaybackStatsLog statsLog;
+
     TPlayVideo *videoPlayer = NULL;
 
 private slots:
@@ -75,6 +79,10 @@ private slots:
 
     void do_setPosition(int val);
 
+    void do_playbackStats(PlaybackStats stats);
+
+    void do_selfTestResult(bool realTime, double decodeFps, double frameRate, int threadCount);
+
     void on_toolButtonBack_clicked();
 
     void on_toolButtonMute_clicked(bool checked);
@@ -85,6 +93,8 @@ private slots:
 
     void on_horizontalSliderPosition_sliderReleased();
 
+    void on_toolButtonStats_clicked(bool checked);
+
 protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
@@ -17,6 +17,10 @@
  */
 #include "playvideo.h"
 
+#include "audiomix.h"
+#include "codecsetup.h"
+#include "trace.h"
+
 #include <SDL.h>
 
 #define __STDC_CONSTANT_MACROS
@@ -24,13 +28,10 @@
 
 extern "C" {
 #include <libavutil/avutil.h>
-#include <libavutil/audio_fifo.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/mathematics.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
-#include <libavfilter/avfilter.h>
-#include <libavfilter/buffersrc.h>
-#include <libavfilter/buffersink.h>
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
 }
@@ -39,57 +40,37 @@ extern "C" {
 #define SDL_CUSTOM_POSITION_UPDATE_EVENT (SDL_USEREVENT + 2)
 #define SDL_CUSTOM_QUIT_EVENT (SDL_USEREVENT + 4)
 
-#define MAX_AUDIO_FRAME_SIZE 192000 // 1 second of 48khz 32bit audio
-
 TPlayVideo *player = NULL;
 
 /*
- * Flag to control the behavior of the SDL refresher.
- * case 0: Play normally.
- * case 1: Paused.
- * case 2: Quit.
+ * Special note to this fix:
+ * The refresher used to spin on a flag while paused and SDL_Delay a truncated 1000 / fps while playing, which pinned one core and let 23.976 fps drift.
+ * It now sleeps in FrameScheduler until each frame's presentation time on the steady clock.
  */
-static int refresherFlag = 1;
-SDL_mutex *refresherFlagMutex = NULL;
-
-// FFmpeg filter graph description
-static const char *filterGraphLarge =
-    "[in]split[in1][in2];"
-    "[in1]crop=3840:1080:0:0[left];"
-    "[in2]crop=2326:1080:1513:1080[right];"
-    "[left][right]hstack=2[out]";
-static const char *filterGraphMedium =
-    "[in]split[in1][in2];"
-    "[in1]crop=3073:1080:767:0[left];"
-    "[in2]crop=1559:1080:1513:1080[right];"
-    "[left][right]hstack=2[out]";
-static const char *filterGraphSmall =
-    "[in]split[in1][in2];"
-    "[in1]crop=2172:1080:1668:0[left];"
-    "[in2]crop=658:1080:1513:1080[right];"
-    "[left][right]hstack=2[out]";
-
 static int SDLRefresher(void *opaque)
 {
+    FrameScheduler *scheduler = (FrameScheduler*)opaque;
     SDL_Event refreshEvent;
     refreshEvent.type = SDL_CUSTOM_REFRESH_EVENT;
-    while(true)
+    while(scheduler->waitNextFrame())
     {
-        SDL_LockMutex(refresherFlagMutex);
-        if(refresherFlag == 0)
-        {
+        // A frame still waiting for the decoder is not queued twice, so a slow decode does not build a backlog
+        if(SDL_PeepEvents(0, 0, SDL_PEEKEVENT, SDL_CUSTOM_REFRESH_EVENT, SDL_CUSTOM_REFRESH_EVENT) == 0)
             SDL_PushEvent(&refreshEvent);
-            SDL_Delay(*(int*)opaque);
-        }
-        else if(refresherFlag == 1)
-            continue;
-        else if(refresherFlag == 2)
-            break;
-        SDL_UnlockMutex(refresherFlagMutex);
     }
     return 0;
 }
 
+static int SDLVideoDecoder(void *opaque)
+{
+    return player->SDLVideoDecoderInternal(opaque);
+}
+
+static int SDLIndexer(void *opaque)
+{
+    return player->SDLIndexerInternal(opaque);
+}
+
 static int SDLAudioDecoder(void *opaque)
 {
     return player->SDLAudioDecoderInternal(opaque);
@@ -107,19 +88,8 @@ TPlayVideo::TPlayVideo(QObject *parent, QString mxlPath, QString wavPath, AVP::A
     this->wavPath = wavPath;
     this->size = size;
 
-    AVPHeight = 1080;
-    switch(size)
-    {
-    case AVP::kAVPLargeSize:
-        AVPWidth = 6166;
-        break;
-    case AVP::kAVPMediumSize:
-        AVPWidth = 4632;
-        break;
-    case AVP::kAVPSmallSize:
-        AVPWidth = 2830;
-        break;
-    }
+    AVPWidth = AVP::getLayout(size).pictureWidth;
+    AVPHeight = AVP::getLayout(size).height;
 
     player = this;
 }
@@ -173,7 +143,7 @@ int TPlayVideo::init()
         return -1;
     }
 
-    if(videoFmtCxt->streams[videoStreamID]->codecpar->width != 3840 || videoFmtCxt->streams[videoStreamID]->codecpar->height !=2160)
+    if(videoFmtCxt->streams[videoStreamID]->codecpar->width != AVP::kAVPFrameWidth || videoFmtCxt->streams[videoStreamID]->codecpar->height != AVP::kAVPFrameHeight)
     {
         emit showError(tr("打开MXL失败：不正确的视频尺寸。"));
         cleanup();
@@ -191,16 +161,8 @@ int TPlayVideo::init()
         }
     }
 
-    // Open decoder
-    videoDecoderCxt = avcodec_alloc_context3(videoDecoder);
-    avError = avcodec_parameters_to_context(videoDecoderCxt, videoFmtCxt->streams[videoStreamID]->codecpar);
-    if(avError < 0)
-    {
-        emit showError(tr("打开MXL失败：不能找到解码器。"));
-        cleanup();
-        return avError;
-    }
-    avError = avcodec_open2(videoDecoderCxt, videoDecoder, 0);
+    // Open decoder, one slice thread per core
+    avError = AVP::openDecoder(videoFmtCxt->streams[videoStreamID], videoDecoder, &videoDecoderCxt, qBound(1, QThread::idealThreadCount(), kMaxDecoderThreads));
     if(avError < 0)
     {
         emit showError(tr("打开MXL失败：不能打开解码器。"));
@@ -208,17 +170,14 @@ int TPlayVideo::init()
         return avError;
     }
 
+    // Frame timing of the raw stream
+    AVRational frameRate = av_guess_frame_rate(videoFmtCxt, videoFmtCxt->streams[videoStreamID], 0);
+    if(frameRate.num > 0 && frameRate.den > 0)
+        frameDuration = av_inv_q(frameRate);
+
     if(!wavPath.isEmpty())
     {
-        audioDecoderCxt = avcodec_alloc_context3(audioDecoder);
-        avError = avcodec_parameters_to_context(audioDecoderCxt, audioFmtCxt->streams[audioStreamID]->codecpar);
-        if(avError < 0)
-        {
-            emit showError(tr("打开WAV失败：不能找到解码器。"));
-            cleanup();
-            return avError;
-        }
-        avError = avcodec_open2(audioDecoderCxt, audioDecoder, 0);
+        avError = AVP::openDecoder(audioFmtCxt->streams[audioStreamID], audioDecoder, &audioDecoderCxt);
         if(avError < 0)
         {
             emit showError(tr("打开WAV失败：不能打开解码器。"));
@@ -227,68 +186,19 @@ int TPlayVideo::init()
         }
     }
 
-    // Init filter
-    videoFilterGraph = avfilter_graph_alloc();
-
-    videoFilterSrc = avfilter_get_by_name("buffer");
-    char videoFilterSrcArgs[512];
-    snprintf(videoFilterSrcArgs, sizeof(videoFilterSrcArgs), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d", videoDecoderCxt->width, videoDecoderCxt->height, AV_PIX_FMT_YUV420P, videoFmtCxt->streams[videoStreamID]->time_base.num, videoFmtCxt->streams[videoStreamID]->time_base.den, videoDecoderCxt->sample_aspect_ratio.num, videoDecoderCxt->sample_aspect_ratio.den);
-    avError = avfilter_graph_create_filter(&videoFilterSrcCxt, videoFilterSrc, "in", videoFilterSrcArgs, 0, videoFilterGraph);
-
-    videoFilterSink = avfilter_get_by_name("buffersink");
-    avError = avfilter_graph_create_filter(&videoFilterSinkCxt, videoFilterSink, "out", 0, 0, videoFilterGraph);
-
-    videoFilterInput = avfilter_inout_alloc();
-    videoFilterInput -> name = av_strdup("in");
-    videoFilterInput -> filter_ctx = videoFilterSrcCxt;
-    videoFilterInput -> pad_idx = 0;
-    videoFilterInput -> next = NULL;
-
-    videoFilterOutput = avfilter_inout_alloc();
-    videoFilterOutput -> name = av_strdup("out");
-    videoFilterOutput -> filter_ctx = videoFilterSinkCxt;
-    videoFilterOutput -> pad_idx = 0;
-    videoFilterOutput -> next = NULL;
-
-    switch(size)
-    {
-    case AVP::kAVPLargeSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphLarge, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    case AVP::kAVPMediumSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphMedium, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    case AVP::kAVPSmallSize:
-        avError = avfilter_graph_parse_ptr(videoFilterGraph, filterGraphSmall, &videoFilterOutput, &videoFilterInput, 0);
-        break;
-    }
-
-    avError = avfilter_graph_config(videoFilterGraph, 0);
-
-    // Init scaler
-    scalerCxt = sws_getContext(videoDecoderCxt->width, videoDecoderCxt->height, videoDecoderCxt->pix_fmt, videoDecoderCxt->width, videoDecoderCxt->height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, 0, 0, 0);
-
-    // Init resampler
-    if(!wavPath.isEmpty())
-    {
-        avError = swr_alloc_set_opts2(&resamplerCxt, &audioDecoderCxt->ch_layout, AV_SAMPLE_FMT_S16, 44100, &audioDecoderCxt->ch_layout, audioDecoderCxt->sample_fmt, audioDecoderCxt->sample_rate, 0, 0);
-        avError = swr_init(resamplerCxt);
-    }
+    // Init unfold rectangles
+    initPresentRects(AVP::getLayout(size));
 
     // Allocate memory
     vPacket = av_packet_alloc();
     aPacket = av_packet_alloc();
     frameIn = av_frame_alloc();
-    frameScaled = av_frame_alloc();
-    frameFiltered = av_frame_alloc();
     frame = av_frame_alloc();
 
-    if(!wavPath.isEmpty())
-    {
-        iAudioBuffer = (uint8_t*)av_malloc(MAX_AUDIO_FRAME_SIZE * 2);
-        oAudioBuffer = (uint8_t*)av_malloc(MAX_AUDIO_FRAME_SIZE * 2);
-        audioQueue = av_audio_fifo_alloc(AV_SAMPLE_FMT_S16, audioDecoderCxt->ch_layout.nb_channels, 4096);
-    }
+    // Check the decoding speed
+    runSelfTest();
+
+    audioSeekSignal = SDL_CreateSemaphore(0);
 
     // Init SDL
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER);
@@ -296,25 +206,19 @@ int TPlayVideo::init()
     SDL_GetDesktopDisplayMode(0, &display);
     window = SDL_CreateWindow("AVPStudio - MXLPlayer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, display.w, (int)((double)AVPHeight * ((double)display.w / (double)AVPWidth)), 0);
     renderer = SDL_CreateRenderer(window, -1, 0);
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, AVPWidth, AVPHeight);
+    SDL_RenderSetLogicalSize(renderer, AVPWidth, AVPHeight);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, AVP::kAVPFrameWidth, AVP::kAVPFrameHeight);
 
+    // Open audio device and the conversion to its format
     if(!wavPath.isEmpty())
     {
-        wantedSpec.freq = 44100;
-        wantedSpec.format = AUDIO_S16;
-        wantedSpec.channels = audioDecoderCxt->ch_layout.nb_channels;
-        wantedSpec.silence = 0;
-        wantedSpec.samples = 1024;
-        wantedSpec.callback = SDLFillAudio;
-        wantedSpec.userdata = audioDecoderCxt;
-
-        if(SDL_OpenAudio(&wantedSpec, 0) < 0)
+        avError = openAudio();
+        if(avError < 0)
         {
             emit showError(tr("无法打开音频设备。"));
             cleanup();
-            return -1;
+            return avError;
         }
-        SDL_PauseAudio(1);
     }
 
     // Set info
@@ -325,7 +229,9 @@ int TPlayVideo::init()
 
 void TPlayVideo::cleanup()
 {
-    SDL_CloseAudio();
+    if(audioDevice)
+        SDL_CloseAudioDevice(audioDevice);
+    audioDevice = 0;
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -338,30 +244,17 @@ void TPlayVideo::cleanup()
     avcodec_free_context(&videoDecoderCxt);
     avcodec_free_context(&audioDecoderCxt);
 
-    avfilter_free(videoFilterSrcCxt);
-    avfilter_free(videoFilterSinkCxt);
-
-    avfilter_graph_free(&videoFilterGraph);
-    avfilter_inout_free(&videoFilterInput);
-    avfilter_inout_free(&videoFilterOutput);
-
     sws_freeContext(scalerCxt);
     swr_free(&resamplerCxt);
 
     av_packet_free(&vPacket);
     av_packet_free(&aPacket);
     av_frame_free(&frameIn);
-    av_frame_free(&frameFiltered);
-    av_frame_free(&frameScaled);
     av_frame_free(&frame);
 
-    av_free(iAudioBuffer);
     av_free(oAudioBuffer);
 
-    av_audio_fifo_free(audioQueue);
-    SDL_DestroyMutex(audioQueueMutex);
-    SDL_DestroyMutex(volumeMutex);
-    SDL_DestroyMutex(refresherFlagMutex);
+    SDL_DestroySemaphore(audioSeekSignal);
 }
 
 void TPlayVideo::notifyQuit()
@@ -371,44 +264,119 @@ void TPlayVideo::notifyQuit()
     SDL_PushEvent(&quitEvent);
 }
 
+/*
+ * Special note to this optimization:
+ * The decoder used to poll a mutex-protected AVAudioFifo with SDL_Delay(1) when it was full, and the callback took two mutexes per buffer.
+ * The queue is now a lock-free ring: the decoder sleeps on a semaphore while it is full, and the callback only reads atomics (the audio clock and volume included).
+ * Seeks are carried out here instead of on the render thread, so the WAV demuxer and decoder are only used by this thread.
+ *
+ * Special note to this fix:
+ * At the end of the MXL the render thread used to seek both files back to the start, so the first GOP was read and decoded again while the picture waited and the audio device was paused.
+ * Now neither decoder stops at the end: the video decoder goes on with the first frames of the next pass while the last ones are still queued, and this thread goes on with the first samples of the WAV.
+ * Timestamps of both keep counting through the loops, so the clock and the scheduler run across the loop point as across any other frame.
+ * The loop is as long as the video: a longer WAV is cut and a shorter one padded with silence, as PandorasBox plays them.
+ */
 int TPlayVideo::SDLAudioDecoderInternal(void *opaque)
 {
     static int avError = 0;
+    int64_t traceTime = -1;
+    int64_t frameSample = 0;
+    int64_t nextSample = 0;             // In the WAV
+    int64_t loopStartSample = 0;        // Where this iteration of the WAV starts in the audio clock
+    bool decodedSinceStart = false;
+    const AVRational videoTimeBase = videoFmtCxt->streams[videoStreamID]->time_base;
+    const AVRational sampleTimeBase = {1, audioSpec.freq};
 
-    while(true)
+    AVP::Trace::setThreadName("SDLAudioDecoder");
+
+    while(scheduler.waitPlaying())
     {
-        SDL_LockMutex(refresherFlagMutex);
-        if(refresherFlag != 0)
-            continue;
-        SDL_UnlockMutex(refresherFlagMutex);
+        if(audioSeekPending.exchange(false))
+        {
+            av_seek_frame(audioFmtCxt, audioStreamID, audioSeekPosition.load(), audioSeekFlags.load());
+            avcodec_flush_buffers(audioDecoderCxt);
+            audioQueue.clearWake();
+            // Also what was queued while this thread finished the frame before the seek
+            audioQueue.discard();
+            nextSample = av_rescale_q(audioSeekPosition.load(), audioFmtCxt->streams[audioStreamID]->time_base, sampleTimeBase);
+            loopStartSample = 0;
+            decodedSinceStart = false;
+        }
+
+        // The video decides the length of the loop, 0 until it is known
+        int64_t loopSamples = av_rescale_q(loopDuration.load(), videoTimeBase, sampleTimeBase);
 
+        traceTime = AVP::Trace::begin();
         if(av_read_frame(audioFmtCxt, aPacket) == 0)
         {
+            AVP::Trace::end("audio read", traceTime);
+
             if(aPacket->stream_index == audioStreamID)
             {
+                traceTime = AVP::Trace::begin();
                 avError = avcodec_send_packet(audioDecoderCxt, aPacket);
+                AVP::Trace::end("audio decode", traceTime);
                 while(true)
                 {
+                    traceTime = AVP::Trace::begin();
                     avError = avcodec_receive_frame(audioDecoderCxt, frame);
+                    AVP::Trace::end("audio decode", traceTime);
                     if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
                         break;
 
-                    iAudioBufferSampleCount = swr_convert(resamplerCxt, &iAudioBuffer, MAX_AUDIO_FRAME_SIZE, (const uint8_t**)frame->data, frame->nb_samples);
-
-                    iAudioBufferSize = av_samples_get_buffer_size(0, frame->ch_layout.nb_channels, iAudioBufferSampleCount, AV_SAMPLE_FMT_S16, 1);
-
-                    while(iAudioBufferSampleCount > av_audio_fifo_space(audioQueue));
-                    SDL_LockMutex(audioQueueMutex);
-                    avError = av_audio_fifo_write(audioQueue, (void**)&iAudioBuffer, iAudioBufferSampleCount);
-                    SDL_UnlockMutex(audioQueueMutex);
+                    frameSample = frame->best_effort_timestamp == AV_NOPTS_VALUE ? nextSample : av_rescale_q(frame->best_effort_timestamp, audioFmtCxt->streams[audioStreamID]->time_base, sampleTimeBase);
 
+                    const float *samples = NULL;
+                    int sampleCount = convertAudioFrame(frame, &samples);
                     av_frame_unref(frame);
+                    if(sampleCount <= 0)
+                        continue;
+                    decodedSinceStart = true;
+
+                    // A WAV longer than the video is cut where the video loops
+                    bool loopEnd = loopSamples > 0 && frameSample + sampleCount >= loopSamples;
+                    if(loopEnd)
+                        sampleCount = (int)qMax<int64_t>(loopSamples - frameSample, 0);
+                    nextSample = frameSample + sampleCount;
+
+                    // Sleeps while the queue is full. Interrupted by a seek (the rest of the frame is stale) or by quitting
+                    traceTime = AVP::Trace::begin();
+                    bool written = audioQueue.write((const uint8_t*)samples, sampleCount, loopStartSample + frameSample);
+                    AVP::Trace::end("audio queue", traceTime);
+
+                    if(!written)
+                        break;
+                    if(loopEnd)
+                    {
+                        restartAudioLoop();
+                        loopStartSample += loopSamples;
+                        nextSample = 0;
+                        decodedSinceStart = false;
+                        break;
+                    }
                 }
                 av_packet_unref(aPacket);
             }
         }
+        else if(!decodedSinceStart && loopSamples <= 0)
+        {
+            // Nothing to loop yet (or a seek past the end of the WAV): sleeps until the next seek
+            SDL_SemWait(audioSeekSignal);
+        }
         else
-            SDL_PauseAudio(1);
+        {
+            // A WAV shorter than the video is padded with silence up to the loop
+            if(loopSamples > nextSample && !writeAudioSilence(loopSamples - nextSample, loopStartSample + nextSample))
+            {
+                // Interrupted by a seek or quitting, both post the signal after they are published
+                SDL_SemWait(audioSeekSignal);
+                continue;
+            }
+            restartAudioLoop();
+            loopStartSample += qMax(loopSamples, nextSample);
+            nextSample = 0;
+            decodedSinceStart = false;
+        }
     }
 
     return 0;
@@ -416,18 +384,140 @@ int TPlayVideo::SDLAudioDecoderInternal(void *opaque)
 
 void TPlayVideo::SDLFillAudioInternal(void *data, uint8_t *stream, int length)
 {
+    AVP_TRACE_SCOPE("audio callback");
+    int64_t heardSample = 0;
     SDL_memset(stream, 0, length);
-    SDL_LockMutex(audioQueueMutex);
-    oAudioBufferSampleCount = av_audio_fifo_read(audioQueue, (void**)&oAudioBuffer, length / (audioDecoderCxt->ch_layout.nb_channels * 2));
-    SDL_UnlockMutex(audioQueueMutex);
+    oAudioBufferSampleCount = audioQueue.read(oAudioBuffer, qMin(length, oAudioBufferSize) / (audioSpec.channels * (int)sizeof(float)), &heardSample);
+    // This buffer starts after the one the device is playing now
+    heardSample -= audioSpec.samples;
     if(oAudioBufferSampleCount <= 0)
+    {
+        // Out of audio (end of the WAV or an underrun): video follows the scheduler until samples arrive again
+        audioClock.reset();
         return;
-    oAudioBufferSize = av_samples_get_buffer_size(0, audioDecoderCxt->ch_layout.nb_channels, oAudioBufferSampleCount, AV_SAMPLE_FMT_S16, 1);
-    if(oAudioBufferSize <= 0)
-        return;
-    SDL_LockMutex(volumeMutex);
-    SDL_MixAudio(stream, oAudioBuffer, oAudioBufferSize, volume);
-    SDL_UnlockMutex(volumeMutex);
+    }
+    audioClock.update((double)heardSample / audioSpec.freq, 2.0 * audioSpec.samples / audioSpec.freq);
+    SDL_MixAudioFormat(stream, oAudioBuffer, AUDIO_F32SYS, oAudioBufferSampleCount * audioSpec.channels * sizeof(float), volume.load(std::memory_order_relaxed));
+}
+
+/*
+ * Special note to this optimization:
+ * The WAV used to be resampled to 44.1 kHz 16-bit for a device opened with SDL_OpenAudio, whatever the device could play.
+ * The device is now opened in the WAV's rate and channel count as float, and SDL may change the rate, channels and buffer size to what the hardware uses.
+ * The resampler only runs when the rate differs; otherwise swresample converts the sample format (or is skipped for float WAVs).
+ * When the device has other channels than the WAV (e.g. 7.1 on stereo speakers), the downmix matrix of swresample is applied by the SIMD downmix kernel.
+ */
+int TPlayVideo::openAudio()
+{
+    static const uint64_t kSDLChannelMasks[] = {0, AV_CH_LAYOUT_MONO, AV_CH_LAYOUT_STEREO, AV_CH_LAYOUT_2POINT1, AV_CH_LAYOUT_QUAD, AV_CH_LAYOUT_QUAD | AV_CH_LOW_FREQUENCY, AV_CH_LAYOUT_5POINT1, AV_CH_LAYOUT_6POINT1, AV_CH_LAYOUT_7POINT1};
+    int avError = 0;
+    bool ok = false;
+    int bufferSamples = qEnvironmentVariableIntValue("AVP_AUDIO_BUFFER", &ok);
+    SDL_AudioSpec wantedSpec;
+    AVChannelLayout sourceLayout;
+    AVChannelLayout deviceLayout;
+
+    // Buffer size: a power of two, small for low latency, large for slow machines
+    if(!ok)
+        bufferSamples = kDefaultAudioBufferSamples;
+    bufferSamples = qBound(kMinAudioBufferSamples, bufferSamples, kMaxAudioBufferSamples);
+    while(bufferSamples & (bufferSamples - 1))
+        bufferSamples += bufferSamples & -bufferSamples;
+
+    SDL_zero(wantedSpec);
+    wantedSpec.freq = audioDecoderCxt->sample_rate;
+    wantedSpec.format = AUDIO_F32SYS;
+    wantedSpec.channels = qBound(1, audioDecoderCxt->ch_layout.nb_channels, 8);
+    wantedSpec.samples = bufferSamples;
+    wantedSpec.callback = SDLFillAudio;
+    wantedSpec.userdata = audioDecoderCxt;
+    audioDevice = SDL_OpenAudioDevice(NULL, 0, &wantedSpec, &audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if(!audioDevice || audioSpec.channels < 1 || audioSpec.channels > 8)
+        return -1;
+
+    // Resampler only for another rate, format conversion only for another format
+    AVSampleFormat resampledFormat = audioDecoderCxt->ch_layout.nb_channels == audioSpec.channels ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_FLTP;
+    if(audioSpec.freq != audioDecoderCxt->sample_rate || audioDecoderCxt->sample_fmt != resampledFormat)
+    {
+        avError = swr_alloc_set_opts2(&resamplerCxt, &audioDecoderCxt->ch_layout, resampledFormat, audioSpec.freq, &audioDecoderCxt->ch_layout, audioDecoderCxt->sample_fmt, audioDecoderCxt->sample_rate, 0, 0);
+        if(avError >= 0)
+            avError = swr_init(resamplerCxt);
+        if(avError < 0)
+            return avError;
+    }
+
+    // Downmix matrix, from the WAV layout (the default one for its channel count if unknown) to SDL's channel order
+    if(resampledFormat == AV_SAMPLE_FMT_FLTP)
+    {
+        int inChannels = audioDecoderCxt->ch_layout.nb_channels;
+        std::vector<double> matrix((size_t)audioSpec.channels * inChannels);
+        if(audioDecoderCxt->ch_layout.order == AV_CHANNEL_ORDER_NATIVE)
+            av_channel_layout_copy(&sourceLayout, &audioDecoderCxt->ch_layout);
+        else
+            av_channel_layout_default(&sourceLayout, inChannels);
+        av_channel_layout_from_mask(&deviceLayout, kSDLChannelMasks[audioSpec.channels]);
+        avError = swr_build_matrix2(&sourceLayout, &deviceLayout, M_SQRT1_2, M_SQRT1_2, 0, 1, 1, matrix.data(), inChannels, AV_MATRIX_ENCODING_NONE, NULL);
+        av_channel_layout_uninit(&sourceLayout);
+        av_channel_layout_uninit(&deviceLayout);
+        if(avError < 0)
+            return avError;
+        mixMatrix.assign(matrix.begin(), matrix.end());
+    }
+
+    oAudioBufferSize = audioSpec.size;
+    oAudioBuffer = (uint8_t*)av_malloc(oAudioBufferSize);
+    if(!oAudioBuffer)
+        return AVERROR(ENOMEM);
+    // The device opens paused
+    audioQueue.init(audioSpec.channels * sizeof(float), qMax(kAudioQueueSamples, 2 * (int)audioSpec.samples));
+    return 0;
+}
+
+int TPlayVideo::convertAudioFrame(AVFrame *frame, const float **samples)
+{
+    const int inChannels = frame->ch_layout.nb_channels;
+    const float *planes[AV_NUM_DATA_POINTERS];
+    int sampleCount = frame->nb_samples;
+    int64_t traceTime = -1;
+
+    if(inChannels > AV_NUM_DATA_POINTERS)
+        return -1;
+    for(int c = 0; c < inChannels; c++)
+        planes[c] = (const float*)frame->extended_data[mixMatrix.empty() ? 0 : c];
+
+    if(resamplerCxt)
+    {
+        traceTime = AVP::Trace::begin();
+        int capacity = swr_get_out_samples(resamplerCxt, frame->nb_samples);
+        if(capacity <= 0)
+            return capacity;
+        if(audioConverted.size() < (size_t)capacity * inChannels)
+            audioConverted.resize((size_t)capacity * inChannels);
+        uint8_t *out[AV_NUM_DATA_POINTERS];
+        for(int c = 0; c < inChannels; c++)
+        {
+            out[c] = (uint8_t*)(audioConverted.data() + (mixMatrix.empty() ? 0 : (size_t)c * capacity));
+            planes[c] = (const float*)out[c];
+        }
+        sampleCount = swr_convert(resamplerCxt, out, capacity, (const uint8_t**)frame->extended_data, frame->nb_samples);
+        AVP::Trace::end("audio resample", traceTime);
+        if(sampleCount <= 0)
+            return sampleCount;
+    }
+
+    if(mixMatrix.empty())
+    {
+        *samples = planes[0];
+        return sampleCount;
+    }
+
+    traceTime = AVP::Trace::begin();
+    if(audioMixed.size() < (size_t)sampleCount * audioSpec.channels)
+        audioMixed.resize((size_t)sampleCount * audioSpec.channels);
+    AVP::downmix(planes, inChannels, sampleCount, mixMatrix.data(), audioSpec.channels, audioMixed.data());
+    AVP::Trace::end("audio downmix", traceTime);
+    *samples = audioMixed.data();
+    return sampleCount;
 }
 
 void TPlayVideo::do_updatePosition(int val)
@@ -440,106 +530,438 @@ void TPlayVideo::do_updatePosition(int val)
 
 void TPlayVideo::do_play()
 {
-    SDL_LockMutex(refresherFlagMutex);
-    refresherFlag = 0;
-    SDL_LockMutex(refresherFlagMutex);
+    scheduler.play();
     if(!wavPath.isEmpty())
-        SDL_PauseAudio(0);
+        SDL_PauseAudioDevice(audioDevice, 0);
 }
 
 void TPlayVideo::do_pause()
 {
-    SDL_LockMutex(refresherFlagMutex);
-    refresherFlag = 1;
-    SDL_LockMutex(refresherFlagMutex);
+    scheduler.pause();
+    // Device first: a callback after the clock is frozen would start it again
     if(!wavPath.isEmpty())
-        SDL_PauseAudio(1);
+        SDL_PauseAudioDevice(audioDevice, 1);
+    audioClock.pause();
 }
 
 void TPlayVideo::do_volumeChanged(int val)
 {
-    SDL_LockMutex(volumeMutex);
-    volume = val;
-    SDL_UnlockMutex(volumeMutex);
+    volume.store(val, std::memory_order_relaxed);
 }
 
+/*
+ * Special note to this fix:
+ * Video used to be paced only by its own timer while audio ran from an independent FIFO, so any decode hiccup left a permanent offset.
+ * With a WAV loaded, the audio clock is the master: a frame later than the threshold is dropped from the queue, an earlier one keeps the previous picture on screen for another refresh.
+ * Without audio (or before the first audio after a seek) frames follow the scheduler.
+ *
+ * Special note to this optimization:
+ * Reading and decoding run in SDLVideoDecoder, which keeps frameQueue filled ahead of presentation.
+ * This thread only uploads and presents, so a slow 3840 x 2160 frame no longer delays presentation or event handling.
+ */
 void TPlayVideo::run()
 {
-    static int avError = 0;
-    int frameDuration = (int) 1000 / av_q2d(videoDecoderCxt->framerate);
-    threadRefresh = SDL_CreateThread(SDLRefresher, 0, &frameDuration);
+    AVP::Trace::setThreadName("TPlayVideo");
+    scheduler.setFrameRate(av_inv_q(frameDuration));
+    double syncThreshold = qBound(kMinSyncThreshold, av_q2d(frameDuration), kMaxSyncThreshold);
+    double timeBase = av_q2d(videoFmtCxt->streams[videoStreamID]->time_base);
+    threadIndex = SDL_CreateThread(SDLIndexer, 0, 0);
+    threadDecodeVideo = SDL_CreateThread(SDLVideoDecoder, 0, 0);
+    threadRefresh = SDL_CreateThread(SDLRefresher, 0, &scheduler);
     if(!wavPath.isEmpty())
         threadDecodeAudio = SDL_CreateThread(SDLAudioDecoder, 0, 0);
 
-    while(true)
+    // Sleeps until the refresher, a seek or a quit posts an event
+    while(SDL_WaitEvent(&eventSDL))
     {
-        while(SDL_PollEvent(&eventSDL))
+        if(eventSDL.type == SDL_CUSTOM_REFRESH_EVENT)
         {
-            if(eventSDL.type == SDL_CUSTOM_REFRESH_EVENT)
+            for(int dropped = 0; ; dropped++)
             {
-                if(av_read_frame(videoFmtCxt, vPacket) == 0)
+                // Decoder behind: the previous picture stays
+                DecodedFrame *next = frameQueue.peek();
+                if(!next)
                 {
-                    if(vPacket->stream_index == videoStreamID)
-                    {
-                        avError = avcodec_send_packet(videoDecoderCxt, vPacket);
-                        while(true)
-                        {
-                            avError = avcodec_receive_frame(videoDecoderCxt, frameIn);
-                            if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
-                                break;
-
-                            emit setPosition(frameIn->pkt_dts);
-
-                            sws_scale_frame(scalerCxt, frameScaled, frameIn);
-
-                            avError = av_buffersrc_add_frame(videoFilterSrcCxt, frameScaled);
-                            avError = av_buffersink_get_frame(videoFilterSinkCxt, frameFiltered);
-
-                            SDL_UpdateYUVTexture(texture, 0, frameFiltered->data[0], frameFiltered->linesize[0], frameFiltered->data[1], frameFiltered->linesize[1], frameFiltered->data[2], frameFiltered->linesize[2]);
-                            SDL_RenderClear(renderer);
-                            SDL_RenderCopy(renderer, texture, 0, 0);
-                            SDL_RenderPresent(renderer);
-
-                            av_frame_unref(frameIn);
-                            av_frame_unref(frameScaled);
-                            av_frame_unref(frameFiltered);
-                        }
-                        av_packet_unref(vPacket);
-                    }
+                    repeatedFrames ++;
+                    break;
                 }
-                else
+
+                double audioTime = 0;
+                if(wavPath.isEmpty() || next->pts == AV_NOPTS_VALUE || !audioClock.get(&audioTime))
                 {
-                    av_seek_frame(videoFmtCxt, videoStreamID, 0, AVSEEK_FLAG_BACKWARD);
-                    if(!wavPath.isEmpty())
-                    {
-                        av_seek_frame(audioFmtCxt, audioStreamID, 0, AVSEEK_FLAG_BACKWARD);
-                        SDL_PauseAudio(0);
-                    }
+                    presentFrame(next);
+                    break;
                 }
-            }
-            else if(eventSDL.type == SDL_CUSTOM_POSITION_UPDATE_EVENT)
-            {
-                av_seek_frame(videoFmtCxt, videoStreamID, newPosition, AVSEEK_FLAG_ANY);
-                if(!wavPath.isEmpty())
+
+                double drift = next->pts * timeBase - audioTime;
+                syncDrift = drift;
+                if(drift > syncThreshold)
                 {
-                    av_seek_frame(audioFmtCxt, audioStreamID, av_rescale_q(newPosition, videoFmtCxt->streams[videoStreamID]->time_base, audioFmtCxt->streams[audioStreamID]->time_base), AVSEEK_FLAG_ANY);
-                    SDL_LockMutex(audioQueueMutex);
-                    av_audio_fifo_reset(audioQueue);
-                    SDL_UnlockMutex(audioQueueMutex);
+                    // Early: the previous picture stays for this refresh
+                    repeatedFrames ++;
+                    break;
                 }
+                if(drift < -syncThreshold && dropped < kMaxDroppedFrames)
+                {
+                    droppedFrames ++;
+                    frameQueue.pop();
+                    continue;
+                }
+                presentFrame(next);
+                break;
             }
-            else if(eventSDL.type == SDL_CUSTOM_QUIT_EVENT)
-            {
-                SDL_LockMutex(refresherFlagMutex);
-                refresherFlag = 2;
-                SDL_UnlockMutex(refresherFlagMutex);
-                cleanup();
-                return;
-            }
-            else if(eventSDL.type == SDL_QUIT)
+            reportStats();
+        }
+        else if(eventSDL.type == SDL_CUSTOM_POSITION_UPDATE_EVENT)
+        {
+            scheduler.restart();
+            syncDrift = 0;
+            frameQueue.requestSeek(newPosition, AVSEEK_FLAG_BACKWARD);
+            if(!wavPath.isEmpty())
+                seekAudio(newPosition, AVSEEK_FLAG_ANY);
+        }
+        else if(eventSDL.type == SDL_CUSTOM_QUIT_EVENT)
+        {
+            scheduler.stop();
+            frameQueue.close();
+            audioQueue.close();
+            SDL_SemPost(audioSeekSignal);
+            SDL_WaitThread(threadRefresh, 0);
+            SDL_WaitThread(threadIndex, 0);
+            SDL_WaitThread(threadDecodeVideo, 0);
+            SDL_WaitThread(threadDecodeAudio, 0);
+            cleanup();
+            return;
+        }
+        else if(eventSDL.type == SDL_QUIT)
+        {
+            emit sdlQuit();
+        }
+    }
+}
+
+int TPlayVideo::SDLVideoDecoderInternal(void *opaque)
+{
+    int avError = 0;
+    int64_t traceTime = -1;
+    int64_t seekPosition = 0;
+    int seekFlags = 0;
+    uint64_t generation = 0;
+    bool decodedSinceStart = false;
+    const AVRational timeBase = videoFmtCxt->streams[videoStreamID]->time_base;
+    int64_t nextFrame = -1;                 // Display index of the next frame after a keyframe seek, -1 to keep the demuxer's timestamps
+    int64_t skipBefore = AV_NOPTS_VALUE;    // Frames before the seek position are decoded and dropped
+    int64_t loopBase = 0;                   // Added to the pts of this iteration, so that it continues from the previous one
+    int64_t lastPts = AV_NOPTS_VALUE;
+
+    AVP::Trace::setThreadName("SDLVideoDecoder");
+
+    while(!frameQueue.isClosed())
+    {
+        if(frameQueue.takeSeek(&seekPosition, &seekFlags, &generation))
+        {
+            nextFrame = seekVideo(seekPosition, seekFlags);
+            skipBefore = seekPosition;
+            loopBase = 0;
+        }
+
+        FrameScheduler::Clock::time_point decodeStart = FrameScheduler::Clock::now();
+        avError = decodeVideoFrame();
+        if(avError >= 0)
+            decodeTimer.add(FrameScheduler::Clock::now() - decodeStart);
+        if(avError == AVERROR_EOF)
+        {
+            // A file without a single decodable frame would loop forever
+            if(!decodedSinceStart)
+                break;
+            // The decoder is drained, the last picture of this pass is already queued.
+            // Without the index, the first end of the file gives the length of the loop
+            int64_t duration = 0;
+            if(lastPts != AV_NOPTS_VALUE)
+                loopDuration.compare_exchange_strong(duration, lastPts + av_rescale_q(1, frameDuration, timeBase));
+            loopBase += loopDuration.load();
+            av_seek_frame(videoFmtCxt, videoStreamID, 0, AVSEEK_FLAG_BACKWARD);
+            avcodec_flush_buffers(videoDecoderCxt);
+            nextFrame = -1;
+            skipBefore = AV_NOPTS_VALUE;
+            continue;
+        }
+        if(avError < 0)
+            continue;
+        decodedSinceStart = true;
+
+        // After a byte seek the demuxer no longer knows the timestamps, the index does
+        if(nextFrame >= 0)
+        {
+            frameIn->best_effort_timestamp = av_rescale_q(nextFrame, frameDuration, timeBase);
+            frameIn->pkt_dts = frameIn->best_effort_timestamp;
+            nextFrame++;
+        }
+        if(skipBefore != AV_NOPTS_VALUE)
+        {
+            if(frameIn->best_effort_timestamp != AV_NOPTS_VALUE && frameIn->best_effort_timestamp < skipBefore)
             {
-                emit sdlQuit();
+                av_frame_unref(frameIn);
+                continue;
             }
+            skipBefore = AV_NOPTS_VALUE;
+        }
+
+        // The position bar shows the place in the file, the clock runs on through the loops
+        DecodedFrame decoded;
+        lastPts = frameIn->best_effort_timestamp;
+        decoded.pts = lastPts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : lastPts + loopBase;
+        decoded.dts = frameIn->pkt_dts;
+
+        if(getChromaRowStep((AVPixelFormat)frameIn->format) > 0)
+        {
+            decoded.frame = framePool.acquire();
+            av_frame_move_ref(decoded.frame.get(), frameIn);
+        }
+        else
+        {
+            // Other decoder formats are converted to 4:2:0 first
+            traceTime = AVP::Trace::begin();
+            FrameScheduler::Clock::time_point convertStart = FrameScheduler::Clock::now();
+            scalerCxt = sws_getCachedContext(scalerCxt, frameIn->width, frameIn->height, (AVPixelFormat)frameIn->format, frameIn->width, frameIn->height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, 0, 0, 0);
+            decoded.frame = scaledFramePool.acquireVideo(AV_PIX_FMT_YUV420P, frameIn->width, frameIn->height);
+            sws_scale_frame(scalerCxt, decoded.frame.get(), frameIn);
+            av_frame_unref(frameIn);
+            convertTimer.add(FrameScheduler::Clock::now() - convertStart);
+            AVP::Trace::end("convert", traceTime);
+        }
+
+        traceTime = AVP::Trace::begin();
+        bool open = frameQueue.push(std::move(decoded), generation);
+        AVP::Trace::end("queue", traceTime);
+        if(!open)
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Special note to this optimization:
+ * A 3840 x 2160 4:2:2 MPEG-2 frame takes longer than a frame period to decode on one core of a laptop, so the decoder used to fall behind whatever the scheduler did.
+ * The decoder now runs one slice thread per core (FFmpeg's MPEG-2 decoder has slice threads but no frame threads, so this is the only threading that applies).
+ * Before playback, the first frames are decoded once to measure whether this machine keeps up with the frame rate, and the result is reported to the control panel.
+ */
+void TPlayVideo::runSelfTest()
+{
+    double fps = av_q2d(av_inv_q(frameDuration));
+    int frames = 0;
+    double elapsed = 0;
+
+    // The first frame also starts the decoder threads, so it is not timed
+    if(decodeVideoFrame() >= 0)
+    {
+        av_frame_unref(frameIn);
+        FrameScheduler::Clock::time_point start = FrameScheduler::Clock::now();
+        while(frames < kSelfTestFrames && elapsed < kSelfTestSeconds)
+        {
+            if(decodeVideoFrame() < 0)
+                break;
+            av_frame_unref(frameIn);
+            frames++;
+            elapsed = std::chrono::duration<double>(FrameScheduler::Clock::now() - start).count();
+        }
+    }
+
+    av_seek_frame(videoFmtCxt, videoStreamID, 0, AVSEEK_FLAG_BACKWARD);
+    avcodec_flush_buffers(videoDecoderCxt);
+
+    // Too short to measure
+    if(frames == 0 || elapsed <= 0)
+        return;
+    double decodeFps = frames / elapsed;
+    emit selfTestResult(decodeFps >= fps * kSelfTestMargin, decodeFps, fps, videoDecoderCxt->thread_count);
+}
+
+/*
+ * Special note to this fix:
+ * Seeks used to ask the demuxer for AVSEEK_FLAG_ANY, which in a raw MPEG-2 stream lands on any picture and showed broken frames until the next I picture.
+ * With the keyframe index, the decoder starts at the headers of the last I picture at or before the position and decodes forward to it.
+ * Until the index is ready (the first scan of a long MXL takes a moment), the demuxer seeks backward instead.
+ */
+int64_t TPlayVideo::seekVideo(int64_t position, int flags)
+{
+    const Keyframe *keyframe = NULL;
+    if(keyframeIndexReady.load(std::memory_order_acquire))
+        keyframe = keyframeIndex.find(av_rescale_q(position, videoFmtCxt->streams[videoStreamID]->time_base, frameDuration));
+
+    avcodec_flush_buffers(videoDecoderCxt);
+    if(keyframe && av_seek_frame(videoFmtCxt, videoStreamID, keyframe->offset, AVSEEK_FLAG_BYTE) >= 0)
+        return keyframe->frame;
+    av_seek_frame(videoFmtCxt, videoStreamID, position, flags);
+    return -1;
+}
+
+int TPlayVideo::SDLIndexerInternal(void *opaque)
+{
+    AVP::Trace::setThreadName("SDLIndexer");
+    int64_t traceTime = AVP::Trace::begin();
+    bool ok = keyframeIndex.open(mxlPath.toStdString(), [this]() { return frameQueue.isClosed(); });
+    AVP::Trace::end("index", traceTime);
+    if(ok)
+    {
+        int64_t duration = 0;
+        loopDuration.compare_exchange_strong(duration, av_rescale_q(keyframeIndex.getFrameCount(), frameDuration, videoFmtCxt->streams[videoStreamID]->time_base));
+        keyframeIndexReady.store(true, std::memory_order_release);
+    }
+    return 0;
+}
+
+int TPlayVideo::decodeVideoFrame()
+{
+    int avError = 0;
+    int64_t traceTime = -1;
+    while(true)
+    {
+        traceTime = AVP::Trace::begin();
+        avError = avcodec_receive_frame(videoDecoderCxt, frameIn);
+        AVP::Trace::end("decode", traceTime);
+        if(avError != AVERROR(EAGAIN))
+            return avError;
+
+        traceTime = AVP::Trace::begin();
+        avError = av_read_frame(videoFmtCxt, vPacket);
+        AVP::Trace::end("read", traceTime);
+        if(avError < 0)
+        {
+            // The MPEG-2 decoder holds the last reference picture back by one, it only comes out of a drain.
+            // A drained decoder returns AVERROR_EOF until it is flushed
+            if(avcodec_send_packet(videoDecoderCxt, NULL) < 0)
+                return AVERROR_EOF;
+            continue;
+        }
+
+        if(vPacket->stream_index == videoStreamID)
+        {
+            traceTime = AVP::Trace::begin();
+            avcodec_send_packet(videoDecoderCxt, vPacket);
+            AVP::Trace::end("decode", traceTime);
         }
+        av_packet_unref(vPacket);
+    }
+}
+
+/*
+ * Special note to this optimization:
+ * Playback used to convert every 3840 x 2160 frame with swscale and copy it into an unfolded picture before the upload.
+ * The decoded frame is now uploaded once, and the renderer draws each region of the layout from the texture to its place in the picture.
+ * 4:2:2 frames are uploaded to the 4:2:0 texture by skipping every other chroma row through the pitch, which is enough for a preview.
+ */
+int TPlayVideo::getChromaRowStep(AVPixelFormat format)
+{
+    if(format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P)
+        return 1;
+    if(format == AV_PIX_FMT_YUV422P || format == AV_PIX_FMT_YUVJ422P)
+        return 2;
+    return 0;
+}
+
+void TPlayVideo::initPresentRects(const AVP::AVPLayout &layout)
+{
+    presentRects.clear();
+    // Where regions overlap on the canvas the first one wins, so it is drawn last
+    for(auto region = layout.regions.rbegin(); region != layout.regions.rend(); ++region)
+    {
+        // Clip to the picture, the part of the canvas that is shown
+        int left = qMax(region->srcX, layout.pictureX);
+        int right = qMin(region->srcX + region->width, layout.pictureX + layout.pictureWidth);
+        int top = qMax(region->srcY, 0);
+        int bottom = qMin(region->srcY + region->height, layout.height);
+        if(left >= right || top >= bottom)
+            continue;
+
+        PresentRect rect;
+        rect.frame = {region->dstX + left - region->srcX, region->dstY + top - region->srcY, right - left, bottom - top};
+        rect.picture = {left - layout.pictureX, top, right - left, bottom - top};
+        presentRects.push_back(rect);
+    }
+}
+
+void TPlayVideo::presentFrame(DecodedFrame *decoded)
+{
+    int64_t traceTime = -1;
+    const AVFrame *frame = decoded->frame.get();
+    int chromaRowStep = getChromaRowStep((AVPixelFormat)frame->format);
+    emit setPosition(decoded->dts);
+
+    traceTime = AVP::Trace::begin();
+    FrameScheduler::Clock::time_point start = FrameScheduler::Clock::now();
+    SDL_UpdateYUVTexture(texture, 0, frame->data[0], frame->linesize[0], frame->data[1], frame->linesize[1] * chromaRowStep, frame->data[2], frame->linesize[2] * chromaRowStep);
+    FrameScheduler::Clock::time_point uploaded = FrameScheduler::Clock::now();
+    uploadTimer.add(uploaded - start);
+    AVP::Trace::end("upload", traceTime);
+
+    traceTime = AVP::Trace::begin();
+    SDL_RenderClear(renderer);
+    for(const PresentRect &rect : presentRects)
+        SDL_RenderCopy(renderer, texture, &rect.frame, &rect.picture);
+    SDL_RenderPresent(renderer);
+    presentTimer.add(FrameScheduler::Clock::now() - uploaded);
+    AVP::Trace::end("present", traceTime);
+
+    frameQueue.pop();
+}
+
+void TPlayVideo::seekAudio(int64_t position, int flags)
+{
+    audioSeekPosition.store(av_rescale_q(position, videoFmtCxt->streams[videoStreamID]->time_base, audioFmtCxt->streams[audioStreamID]->time_base));
+    audioSeekFlags.store(flags);
+    // The callback stops playing the old position right away, the decoder stops filling it.
+    // Woken before the seek is published, so the decoder's clearWake() for this seek cannot come before wake()
+    audioQueue.discard();
+    audioQueue.wake();
+    audioSeekPending.store(true);
+    SDL_SemPost(audioSeekSignal);
+    audioClock.reset();
+}
+
+void TPlayVideo::restartAudioLoop()
+{
+    av_seek_frame(audioFmtCxt, audioStreamID, 0, AVSEEK_FLAG_BACKWARD);
+    avcodec_flush_buffers(audioDecoderCxt);
+}
+
+bool TPlayVideo::writeAudioSilence(int64_t samples, int64_t firstSample)
+{
+    if(audioSilence.empty())
+        audioSilence.assign((size_t)audioSpec.samples * audioSpec.channels, 0.0f);
+    while(samples > 0)
+    {
+        int count = (int)qMin<int64_t>(samples, audioSpec.samples);
+        if(!audioQueue.write((const uint8_t*)audioSilence.data(), count, firstSample))
+            return false;
+        samples -= count;
+        firstSample += count;
+    }
+    return true;
+}
+
+void TPlayVideo::reportStats()
+{
+    FrameScheduler::Clock::time_point now = FrameScheduler::Clock::now();
+    if(now - lastStatsReport < std::chrono::milliseconds(500))
+        return;
+    lastStatsReport = now;
+
+    PlaybackStats stats;
+    decodeTimer.take(&stats.decodeMs, &stats.decodeMaxMs);
+    convertTimer.take(&stats.convertMs, &stats.convertMaxMs);
+    uploadTimer.take(&stats.uploadMs, &stats.uploadMaxMs);
+    presentTimer.take(&stats.presentMs, &stats.presentMaxMs);
+    stats.frameQueueDepth = (int)frameQueue.size();
+    stats.frameQueueSize = (int)frameQueue.getCapacity();
+    if(!wavPath.isEmpty())
+    {
+        stats.audioBufferSamples = audioQueue.getFill();
+        stats.audioBufferCapacity = audioQueue.getCapacity();
+        stats.audioBufferMs = stats.audioBufferSamples * 1000.0 / audioSpec.freq;
     }
+    stats.droppedFrames = droppedFrames;
+    stats.repeatedFrames = repeatedFrames;
+    stats.driftMs = syncDrift * 1000;
+    emit playbackStats(stats);
 }
@@ -20,25 +20,32 @@
 
 #define SDL_MAIN_HANDLED
 
-#include "avpsettings.h"
+#include "avhandle.h"
+#include "avplayout.h"
+#include "audioring.h"
+#include "framequeue.h"
+#include "framescheduler.h"
+#include "keyframeindex.h"
+#include "playbackstats.h"
 
 #include <QThread>
 
+#include <atomic>
+#include <vector>
+
 #include <SDL.h>
 
 extern "C" {
 #include <libavutil/avutil.h>
-#include <libavutil/audio_fifo.h>
 #include <libavutil/imgutils.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
-#include <libavfilter/avfilter.h>
-#include <libavfilter/buffersrc.h>
-#include <libavfilter/buffersink.h>
 #include <libswscale/swscale.h>
 #include <libswresample/swresample.h>
 }
 
+Q_DECLARE_METATYPE(PlaybackStats)
+
 class TPlayVideo : public QThread
 {
     Q_OBJECT
@@ -51,6 +58,10 @@ public:
 
     void notifyQuit();
 
+    int SDLVideoDecoderInternal(void *opaque);
+
+    int SDLIndexerInternal(void *opaque);
+
     int SDLAudioDecoderInternal(void *opaque);
 
     void SDLFillAudioInternal(void *data, uint8_t *stream, int length);
@@ -62,9 +73,35 @@ signals:
 
     void setPosition(int val);
 
+    // Stage times, queue depths, dropped and repeated frames and A/V drift, about twice a second
+    void playbackStats(PlaybackStats stats);
+
+    // Startup self-test: decoding speed of this machine against the frame rate of the MXL
+    void selfTestResult(bool realTime, double decodeFps, double frameRate, int threadCount);
+
     void sdlQuit();
 
 private:
+    // Samples per audio callback, AVP_AUDIO_BUFFER overrides the default
+    static const int kDefaultAudioBufferSamples = 1024;
+    static const int kMinAudioBufferSamples = 64;
+    static const int kMaxAudioBufferSamples = 16384;
+    // Samples decoded ahead of the audio callback, about 0.1 s (at least two callback buffers)
+    static const int kAudioQueueSamples = 4096;
+    // Drift tolerated before a frame is dropped or repeated, the frame duration within these bounds
+    static constexpr double kMinSyncThreshold = 0.04;
+    static constexpr double kMaxSyncThreshold = 0.1;
+    // A refresh drops at most this many late frames before presenting one anyway
+    static const int kMaxDroppedFrames = 4;
+    // Frames decoded ahead, 1/3 s at 24 fps
+    static const int kFrameQueueSize = 8;
+    static const int kMaxDecoderThreads = 16;
+    // The startup self-test decodes up to this many frames, for at most this long
+    static const int kSelfTestFrames = 24;
+    static constexpr double kSelfTestSeconds = 1.5;
+    // Decoding speed needed over the frame rate, leaving time for reading, upload and audio
+    static constexpr double kSelfTestMargin = 1.15;
+
     QString mxlPath = "";
     QString wavPath = "";
     AVP::AVPSize size = AVP::kAVPMediumSize;
@@ -80,48 +117,94 @@ private:
 
     const AVCodec *videoDecoder = NULL;
     AVCodecContext *videoDecoderCxt = NULL;
+    AVRational frameDuration = {1, 24};
     const AVCodec *audioDecoder = NULL;
     AVCodecContext *audioDecoderCxt = NULL;
 
-    AVFilterGraph *videoFilterGraph = NULL;
-    AVFilterInOut *videoFilterInput = NULL;
-    AVFilterInOut *videoFilterOutput = NULL;
-
-    const AVFilter *videoFilterSrc = NULL;
-    AVFilterContext *videoFilterSrcCxt = NULL;
-    const AVFilter *videoFilterSink = NULL;
-    AVFilterContext *videoFilterSinkCxt = NULL;
-
     SwsContext *scalerCxt = NULL;
     SwrContext *resamplerCxt = NULL;
 
     AVPacket *vPacket = NULL;
     AVPacket *aPacket = NULL;
     AVFrame *frameIn = NULL;
-    AVFrame *frameFiltered = NULL;
-    AVFrame *frameScaled = NULL;
+    AVP::FramePool framePool;
+    AVP::FramePool scaledFramePool;
+    FrameQueue frameQueue{kFrameQueueSize};
+    KeyframeIndex keyframeIndex;
+    std::atomic<bool> keyframeIndexReady{false};    // Set once by SDLIndexer, keyframeIndex is read only afterwards
+    std::atomic<int64_t> loopDuration{0};           // Of one pass through the MXL (video stream time base), set once by SDLIndexer or the first end of the file
     AVFrame *frame = NULL;
 
-    int iAudioBufferSize = 0;
-    int iAudioBufferSampleCount = 0;
-    uint8_t *iAudioBuffer = NULL;
+    std::vector<float> mixMatrix;       // Device channels x WAV channels, empty if they are the same
+    std::vector<float> audioConverted;
+    std::vector<float> audioMixed;
+    std::vector<float> audioSilence;    // One callback buffer, pads a WAV shorter than the video loop
     int oAudioBufferSize = 0;
     int oAudioBufferSampleCount = 0;
     uint8_t *oAudioBuffer = NULL;
 
-    AVAudioFifo *audioQueue = NULL;
-    SDL_mutex *audioQueueMutex = NULL;
-
-    int volume = 50;
-    SDL_mutex *volumeMutex = NULL;
+    AudioRing audioQueue;
+    // Requested by seekAudio(), carried out by SDLAudioDecoder (audio stream time base)
+    std::atomic<int64_t> audioSeekPosition{0};
+    std::atomic<int> audioSeekFlags{0};
+    std::atomic<bool> audioSeekPending{false};
+    SDL_sem *audioSeekSignal = NULL;    // Posted by seeks and quitting, wakes SDLAudioDecoder when it has nothing to loop
+    AudioClock audioClock;
+
+    qint64 droppedFrames = 0;
+    qint64 repeatedFrames = 0;          // Early frames and refreshes with nothing decoded
+    double syncDrift = 0;
+    FrameScheduler::Clock::time_point lastStatsReport;
+    // Per frame, taken by every report
+    StageTimer decodeTimer;
+    StageTimer convertTimer;
+    StageTimer uploadTimer;
+    StageTimer presentTimer;
+
+    std::atomic<int> volume{50};
 
     SDL_Window *window = NULL;
     SDL_Renderer *renderer = NULL;
-    SDL_Texture *texture = NULL;
+    SDL_Texture *texture = NULL;     // Whole MXL frame
+
+    // A region of the layout: its place in the MXL frame (texture) and in the picture (logical render size)
+    struct PresentRect {
+        SDL_Rect frame;
+        SDL_Rect picture;
+    };
+    std::vector<PresentRect> presentRects;
+
+    FrameScheduler scheduler;
     SDL_Thread *threadRefresh = NULL;
+    SDL_Thread *threadIndex = NULL;
+    SDL_Thread *threadDecodeVideo = NULL;
     SDL_Thread *threadDecodeAudio = NULL;
     SDL_Event eventSDL;
-    SDL_AudioSpec wantedSpec;
+    SDL_AudioDeviceID audioDevice = 0;
+    SDL_AudioSpec audioSpec;            // Obtained from the device, float samples
+
+    int openAudio();
+    // Audio thread: a decoded frame to interleaved float in the device rate and channels. Returns the sample count, *samples stays valid until the next call
+    int convertAudioFrame(AVFrame *frame, const float **samples);
+    // Init only: decodes the first frames, reports the speed and rewinds
+    void runSelfTest();
+    // Decode thread: the next video frame into frameIn. AVERROR_EOF once the end of the file is read and the decoder drained, until it is flushed
+    int decodeVideoFrame();
+    // Rows of the decoded chroma planes per row of the 4:2:0 texture, 0 for formats that need a conversion
+    static int getChromaRowStep(AVPixelFormat format);
+    void initPresentRects(const AVP::AVPLayout &layout);
+    // Render thread: uploads and shows the frame, then removes it from the queue
+    void presentFrame(DecodedFrame *decoded);
+    // Decode thread: seeks to the keyframe before position (video stream time base). Returns its display index, or -1 if the demuxer seeked instead
+    int64_t seekVideo(int64_t position, int flags);
+    // position in the video stream time base. Discards the audio queue and resets the clock, the decoder seeks on its thread
+    void seekAudio(int64_t position, int flags);
+    // Audio thread: back to the start of the WAV for the next pass
+    void restartAudioLoop();
+    // Audio thread: silence into the queue. False if a seek or quitting interrupted it
+    bool writeAudioSilence(int64_t samples, int64_t firstSample);
+    // Render thread: emits playbackStats at most twice a second
+    void reportStats();
 
 private slots:
     void do_updatePosition(int val);
@@ -17,17 +17,22 @@
  */
 #include "genprocess.h"
 
+#include "allocstats.h"
+#include "audiopack.h"
+#include "avhandle.h"
+#include "codecsetup.h"
+#include "trace.h"
+
 #define __STDC_CONSTANT_MACROS
 #define __STDC_FORMAT_MACROS
 
+#include <cstdio>
+
 extern "C" {
 #include <libavutil/avutil.h>
 #include <libavutil/opt.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
-#include <libavfilter/avfilter.h>
-#include <libavfilter/buffersrc.h>
-#include <libavfilter/buffersink.h>
 #include <libswresample/swresample.h>
 }
 
@@ -53,29 +58,29 @@ void TGenProcess::run()
     AVCodecContext *iAudioDecoderCxt = NULL;
 
     AVPacket *packet = NULL;
+    AVPacket *packetOutput = NULL;
     AVFrame *frameInput = NULL;
-    AVFrame *frameFiltered = NULL;
-    AVFrame *frameOutput = NULL;
+    AVP::FramePool floatFramePool(4);
+    AVFrame *frameReady = NULL;
 
-    AVFilterGraph *volumeFilterGraph = NULL;
+    SwrContext *resamplerCxt = NULL;
 
-    const AVFilter *volumeFilter = NULL;
-    AVFilterContext *volumeFilterCxt = NULL;
+    AVP::DitherState audioDither;
+    float audioGain = volumePercent / 100.0;
 
-    const AVFilter *volumeFilterSrc = NULL;
-    AVFilterContext *volumeFilterSrcCxt = NULL;
-    const AVFilter *volumeFilterSink = NULL;
-    AVFilterContext *volumeFilterSinkCxt = NULL;
+    uint64_t audioPTSCounter = 0;
 
-    SwrContext *resamplerCxt = NULL;
+    int64_t traceTime = -1;
 
-    uint64_t audioPTSCounter = 0;
+    AVP::AllocSnapshot allocBegin = AVP::AllocStats::snapshot();
+    int64_t audioFrames = 0;
 
     AVStream *oAudioStream = NULL;
     AVFormatContext *oAudioFmtCxt = NULL;
-    const AVCodec *oAudioEncoder = NULL;
     AVCodecContext *oAudioEncoderCxt = NULL;
 
+    AVP::Trace::setThreadName("TGenProcess");
+
     // Open input file and find stream info
     iAudioFmtCxt = avformat_alloc_context();
     avError = avformat_open_input(&iAudioFmtCxt, this->inputFilePath.toUtf8(), 0, 0);
@@ -98,28 +103,21 @@ void TGenProcess::run()
     }
 
     // Open decoder
-    iAudioDecoderCxt = avcodec_alloc_context3(iAudioDecoder);
-    avError = avcodec_parameters_to_context(iAudioDecoderCxt, iAudioFmtCxt->streams[iAudioStreamID]->codecpar);
+    avError = AVP::openDecoder(iAudioFmtCxt->streams[iAudioStreamID], iAudioDecoder, &iAudioDecoderCxt);
     if(avError < 0)
     {
-        emit showError(tr("不能解析输入信息参数。"), tr("操作失败"));
+        emit showError(tr("不能打开解码器。"), tr("操作失败"));
         goto end;
     }
-    avError = avcodec_open2(iAudioDecoderCxt, iAudioDecoder, 0);
+
+    // Init encoder
+    avError = AVP::setupWavAudioEncoder(&oAudioEncoderCxt, &iAudioDecoderCxt->ch_layout, iAudioDecoderCxt->sample_rate);
     if(avError < 0)
     {
-        emit showError(tr("不能打开解码器。"), tr("操作失败"));
+        emit showError(tr("不能打开编码器。"), tr("操作失败"));
         goto end;
     }
 
-    // Init encoder
-    oAudioEncoder = avcodec_find_encoder(AV_CODEC_ID_PCM_S24LE);
-    oAudioEncoderCxt = avcodec_alloc_context3(oAudioEncoder);
-    oAudioEncoderCxt -> time_base = {1, iAudioDecoderCxt->sample_rate};
-    oAudioEncoderCxt -> ch_layout = iAudioDecoderCxt->ch_layout;
-    oAudioEncoderCxt -> sample_fmt = AV_SAMPLE_FMT_S32;
-    oAudioEncoderCxt -> sample_rate = iAudioDecoderCxt->sample_rate;
-
     // Create output format and stream
     avError = avformat_alloc_output_context2(&oAudioFmtCxt, 0, 0, this->outputFilePath.toUtf8());
     oAudioStream = avformat_new_stream(oAudioFmtCxt, 0);
@@ -127,7 +125,7 @@ void TGenProcess::run()
     oAudioStream -> time_base = oAudioEncoderCxt->time_base;
 
     // Open encoder/file and write file headers
-    avError = avcodec_open2(oAudioEncoderCxt, oAudioEncoder, 0);
+    avError = avcodec_open2(oAudioEncoderCxt, oAudioEncoderCxt->codec, 0);
     if(avError < 0)
     {
         emit showError(tr("不能打开编码器。"), tr("操作失败"));
@@ -148,92 +146,80 @@ void TGenProcess::run()
 
     // Begin conversion
     packet = av_packet_alloc();
+    packetOutput = av_packet_alloc();
     frameInput = av_frame_alloc();
-    frameFiltered = av_frame_alloc();
-    frameOutput = av_frame_alloc();
 
     emit setProgressMax(iAudioFmtCxt->streams[iAudioStreamID]->duration * av_q2d(iAudioFmtCxt->streams[iAudioStreamID]->time_base));
 
-    // Set volume filter
-    char chLayoutDescription[64];
-
-    volumeFilterGraph = avfilter_graph_alloc();
-
-    volumeFilterSrc = avfilter_get_by_name("abuffer");
-    volumeFilterSrcCxt = avfilter_graph_alloc_filter(volumeFilterGraph, volumeFilterSrc, "in");
-    avError = av_channel_layout_describe(&iAudioDecoderCxt->ch_layout, chLayoutDescription, sizeof(chLayoutDescription));
-    avError = av_opt_set(volumeFilterSrcCxt, "channel_layout", chLayoutDescription, AV_OPT_SEARCH_CHILDREN);
-    avError = av_opt_set(volumeFilterSrcCxt, "sample_fmt", av_get_sample_fmt_name(iAudioDecoderCxt->sample_fmt), AV_OPT_SEARCH_CHILDREN);
-    avError = av_opt_set_q(volumeFilterSrcCxt, "time_base", iAudioDecoderCxt->time_base, AV_OPT_SEARCH_CHILDREN);
-    avError = av_opt_set_int(volumeFilterSrcCxt, "sample_rate", iAudioDecoderCxt->sample_rate, AV_OPT_SEARCH_CHILDREN);
-    avError = avfilter_init_str(volumeFilterSrcCxt, 0);
-
-    volumeFilter = avfilter_get_by_name("volume");
-    volumeFilterCxt = avfilter_graph_alloc_filter(volumeFilterGraph, volumeFilter, "volume");
-    avError = av_opt_set(volumeFilterCxt, "volume", QString::number(volumePercent / 100.0, 'f', 2).toUtf8(), AV_OPT_SEARCH_CHILDREN);
-    avError = avfilter_init_str(volumeFilterCxt, 0);
-
-    volumeFilterSink = avfilter_get_by_name("abuffersink");
-    volumeFilterSinkCxt = avfilter_graph_alloc_filter(volumeFilterGraph, volumeFilterSink, "out");
-    avError = av_channel_layout_describe(&iAudioDecoderCxt->ch_layout, chLayoutDescription, sizeof(chLayoutDescription));
-    avError = av_opt_set(volumeFilterSinkCxt, "channel_layout", chLayoutDescription, AV_OPT_SEARCH_CHILDREN);
-    avError = av_opt_set(volumeFilterSinkCxt, "sample_fmt", av_get_sample_fmt_name(iAudioDecoderCxt->sample_fmt), AV_OPT_SEARCH_CHILDREN);
-    avError = av_opt_set_q(volumeFilterSinkCxt, "time_base", iAudioDecoderCxt->time_base, AV_OPT_SEARCH_CHILDREN);
-    avError = av_opt_set_int(volumeFilterSinkCxt, "sample_rate", iAudioDecoderCxt->sample_rate, AV_OPT_SEARCH_CHILDREN);
-    avError = avfilter_init_str(volumeFilterSinkCxt, 0);
-
-    avError = avfilter_link(volumeFilterSrcCxt, 0, volumeFilterCxt, 0);
-    avError = avfilter_link(volumeFilterCxt, 0, volumeFilterSinkCxt, 0);
-    avError = avfilter_graph_config(volumeFilterGraph, 0);
-
-    // Set resampler
-    avError = swr_alloc_set_opts2(&resamplerCxt, &iAudioDecoderCxt->ch_layout, AV_SAMPLE_FMT_S32, iAudioDecoderCxt->sample_rate, &iAudioDecoderCxt->ch_layout, iAudioDecoderCxt->sample_fmt, iAudioDecoderCxt->sample_rate, 0, 0);
-    avError = swr_init(resamplerCxt);
+    // Set resampler (only needed if the decoder does not output planar float)
+    if(iAudioDecoderCxt->sample_fmt != AV_SAMPLE_FMT_FLTP)
+    {
+        avError = swr_alloc_set_opts2(&resamplerCxt, &iAudioDecoderCxt->ch_layout, AV_SAMPLE_FMT_FLTP, iAudioDecoderCxt->sample_rate, &iAudioDecoderCxt->ch_layout, iAudioDecoderCxt->sample_fmt, iAudioDecoderCxt->sample_rate, 0, 0);
+        avError = swr_init(resamplerCxt);
+    }
 
+    traceTime = AVP::Trace::begin();
     while(av_read_frame(iAudioFmtCxt, packet) == 0)
     {
+        AVP::Trace::end("read", traceTime);
+
         if(packet->stream_index == iAudioStreamID)
         {
+            traceTime = AVP::Trace::begin();
             avError = avcodec_send_packet(iAudioDecoderCxt, packet);
+            AVP::Trace::end("decode", traceTime);
             while(true)
             {
+                traceTime = AVP::Trace::begin();
                 avError = avcodec_receive_frame(iAudioDecoderCxt, frameInput);
+                AVP::Trace::end("decode", traceTime);
                 if(avError == AVERROR(EAGAIN) || avError == AVERROR_EOF)
                     break;
 
                 emit setProgress(frameInput->pkt_dts * av_q2d(iAudioFmtCxt->streams[iAudioStreamID]->time_base));
 
-                // Copy frame settings
-                frameOutput -> ch_layout = frameInput -> ch_layout;
-                frameOutput -> sample_rate = frameInput -> sample_rate;
-                frameOutput -> format = AV_SAMPLE_FMT_S32;
-                frameOutput -> nb_samples = av_rescale_rnd(swr_get_delay(resamplerCxt, iAudioDecoderCxt->sample_rate) + frameInput->nb_samples, iAudioDecoderCxt->sample_rate, iAudioDecoderCxt->sample_rate, AV_ROUND_UP);
-
-                // Apply volume filter
-                avError = av_buffersrc_add_frame(volumeFilterSrcCxt, frameInput);
-                avError = av_buffersink_get_frame(volumeFilterSinkCxt, frameFiltered);
-
-                // Resample
-                avError = swr_config_frame(resamplerCxt, frameOutput, frameFiltered);
-                avError = swr_convert_frame(resamplerCxt, frameOutput, frameFiltered);
+                // Convert to planar float if needed
+                traceTime = AVP::Trace::begin();
+                frameReady = frameInput;
+                AVP::PooledFrame frameFloat;
+                if(resamplerCxt)
+                {
+                    frameFloat = floatFramePool.acquireAudio(AV_SAMPLE_FMT_FLTP, &frameInput->ch_layout, frameInput->sample_rate, frameInput->nb_samples);
+                    avError = swr_convert_frame(resamplerCxt, frameFloat.get(), frameInput);
+                    frameReady = frameFloat.get();
+                }
+
+                // Apply volume and pack to PCM S24LE in one pass
+                avError = AVP::reusePacket(packetOutput, frameReady->nb_samples * frameReady->ch_layout.nb_channels * 3);
+                if(avError < 0)
+                {
+                    emit showError(tr("内存不足。"), tr("操作失败"));
+                    goto end;
+                }
+                AVP::packS24((const float * const *)frameReady->extended_data, frameReady->ch_layout.nb_channels, frameReady->nb_samples, audioGain, dither ? &audioDither : NULL, packetOutput->data);
+                AVP::Trace::end("pack", traceTime);
 
                 // Make timestamp
-                frameOutput -> pts = audioPTSCounter;
-                audioPTSCounter += oAudioEncoderCxt->frame_size;
-
-                // Encode
-                avError = avcodec_send_frame(oAudioEncoderCxt, frameOutput);
-                avError = avcodec_receive_packet(oAudioEncoderCxt, packet);
-                avError = av_write_frame(oAudioFmtCxt, packet);
-
-                // Unref frames
+                packetOutput -> pts = audioPTSCounter;
+                packetOutput -> dts = audioPTSCounter;
+                packetOutput -> duration = frameReady->nb_samples;
+                audioPTSCounter += frameReady->nb_samples;
+                av_packet_rescale_ts(packetOutput, oAudioEncoderCxt->time_base, oAudioStream->time_base);
+
+                // Write
+                traceTime = AVP::Trace::begin();
+                avError = av_write_frame(oAudioFmtCxt, packetOutput);
+                AVP::Trace::end("write", traceTime);
+                audioFrames ++;
+
+                // Unref frames. The output packet buffer is kept for the next frame.
                 av_frame_unref(frameInput);
-                av_frame_unref(frameFiltered);
-                av_frame_unref(frameOutput);
             }
             // Unref packet
             av_packet_unref(packet);
         }
+
+        traceTime = AVP::Trace::begin();
     }
 
     // Write file tail
@@ -260,19 +246,17 @@ end:    // Jump flag for errors
     avcodec_free_context(&oAudioEncoderCxt);
 
     av_packet_free(&packet);
+    av_packet_free(&packetOutput);
 
     av_frame_free(&frameInput);
-    av_frame_free(&frameFiltered);
-    av_frame_free(&frameOutput);
-
-    avfilter_free(volumeFilterCxt);
-    avfilter_free(volumeFilterSrcCxt);
-    avfilter_free(volumeFilterSinkCxt);
-
-    avfilter_graph_free(&volumeFilterGraph);
 
     swr_free(&resamplerCxt);
 
+    // Allocation accounting of this conversion
+    if(AVP::AllocStats::isEnabled())
+        fprintf(stderr, "Allocations of %s:\n%s", outputFilePath.toLocal8Bit().constData(),
+                AVP::AllocStats::report(AVP::AllocStats::diff(allocBegin, AVP::AllocStats::snapshot()), audioFrames).c_str());
+
     if(avError == 0)
         emit completed();
 }
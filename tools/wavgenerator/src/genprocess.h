@@ -29,6 +29,7 @@ public:
     QString inputFilePath;
     QString outputFilePath;
     int volumePercent;
+    bool dither = false;
 
 protected:
     void run();
@@ -16,6 +16,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include "mainwindow.h"
+#include "allocstats.h"
+#include "cpudispatch.h"
+#include "trace.h"
 
 #include <QApplication>
 #include <QFile>
@@ -26,6 +29,15 @@ int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
+    // Timeline tracing, if AVP_TRACE is set
+    AVP::Trace::initFromEnvironment();
+
+    // Allocation accounting, if AVP_ALLOC_STATS is set
+    AVP::AllocStats::initFromEnvironment();
+
+    // Forced CPU level, if AVP_CPU_LEVEL is set
+    AVP::CpuDispatch::initFromEnvironment();
+
     QTranslator translator;
     const QStringList uiLanguages = QLocale::system().uiLanguages();
     for (const QString &locale : uiLanguages) {
@@ -45,5 +57,7 @@ int main(int argc, char *argv[])
 
     MainWindow w;
     w.show();
-    return a.exec();
+    int ret = a.exec();
+    AVP::Trace::stop();
+    return ret;
 }
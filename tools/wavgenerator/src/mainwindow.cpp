@@ -100,6 +100,7 @@ void MainWindow::on_pushButtonConvert_clicked()
     }
 
     genProcess = new TGenProcess(this, ui->lineEditInputFile->text(), ui->lineEditOutputFile->text(), ui->spinBoxVolume->value());
+    genProcess->dither = ui->checkBoxDither->isChecked();
 
     connect(genProcess, SIGNAL(setProgressMax(int64_t)), this, SLOT(do_setProgressMax(int64_t)));
     connect(genProcess, SIGNAL(setProgress(int64_t)), this, SLOT(do_setProgress(int64_t)));